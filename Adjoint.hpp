@@ -0,0 +1,140 @@
+#pragma once
+/** @file Adjoint.hpp
+ * @brief Adjoint (backward) P2P of scalar kernels
+ *
+ * For the forward P2P r_i = sum_j K(t_i, s_j; p) c_j and the gradients
+ * g_i = dL/dr_i of a loss L of the results, the adjoint P2P accumulates
+ *   dL/dc_j = sum_i g_i K(t_i, s_j)
+ *   dL/dt_i = g_i sum_j c_j dK(t_i, s_j)/dt
+ *   dL/ds_j = c_j sum_i g_i dK(t_i, s_j)/ds
+ *   dL/dp   = sum_i sum_j g_i c_j dK(t_i, s_j)/dp
+ * in one pass over the pairs, from K.gradient(t, s, dt, ds, dp) of the kernel,
+ * see kernel/KernelSkeleton.kern. The gradients of a point that is both a
+ * source and a target are the sums of its two gradients.
+ */
+
+#include <vector>
+#include <type_traits>
+
+#include "P2P.hpp"
+
+namespace detail {
+
+/** Adjoint block evaluation of the sources [s_first, s_last) and the targets
+ * [t_first, t_last) */
+template <typename Kernel>
+inline void
+block_adjoint(const Kernel& K,
+              const typename Kernel::source_type* s_first,
+              const typename Kernel::source_type* s_last,
+              const typename Kernel::charge_type* c_first,
+              const typename Kernel::target_type* t_first,
+              const typename Kernel::target_type* t_last,
+              const typename Kernel::result_type* g_first,
+              typename Kernel::source_type* ds_first,
+              typename Kernel::charge_type* dc_first,
+              typename Kernel::target_type* dt_first,
+              typename Kernel::param_type& dp)
+{
+  typedef typename Kernel::source_type source_type;
+  typedef typename Kernel::target_type target_type;
+  typedef typename Kernel::result_type result_type;
+  typedef typename Kernel::param_type  param_type;
+
+  target_type kt;
+  source_type ks;
+  param_type  kp;
+  for ( ; t_first != t_last; ++t_first, ++g_first, ++dt_first) {
+    const target_type& t = *t_first;
+    const result_type& g = *g_first;
+    target_type dt = target_type();
+    for (int j = 0; j < s_last - s_first; ++j) {
+      const result_type k = K.gradient(t, s_first[j], kt, ks, kp);
+      const result_type gc = g * c_first[j];
+      dc_first[j] += g * k;
+      ds_first[j] += gc * ks;
+      dt += c_first[j] * kt;
+      dp += gc * kp;
+    }
+    *dt_first += g * dt;
+  }
+}
+
+} // end namespace detail
+
+
+/** Adjoint asymmetric block P2P
+ * dc_j += dL/dc_j, ds_j += dL/ds_j, dt_i += dL/dt_i, dp += dL/dp
+ * for the upstream gradients g_i = dL/dr_i of r_i = sum_j K(t_i,s_j) c_j.
+ *
+ * Each worker owns a balanced group of target tiles and visits its pairs with
+ * all source tiles in Z-order, as the forward P2P. It accumulates the source
+ * gradients and dp privately, and they are summed after the pass.
+ *
+ * @param[in] ds,dc,dt,dp  The gradients to accumulate, or null to skip one
+ */
+template <typename Kernel>
+inline void
+p2p_adjoint(const Kernel& K,
+            const typename Kernel::source_type* s_first,
+            const typename Kernel::source_type* s_last,
+            const typename Kernel::charge_type* c_first,
+            const typename Kernel::target_type* t_first,
+            const typename Kernel::target_type* t_last,
+            const typename Kernel::result_type* g_first,
+            typename Kernel::source_type* ds_first,
+            typename Kernel::charge_type* dc_first,
+            typename Kernel::target_type* dt_first,
+            typename Kernel::param_type* dp,
+            unsigned threads = P2P_NUM_THREADS)
+{
+  typedef typename Kernel::source_type source_type;
+  typedef typename Kernel::charge_type charge_type;
+  typedef typename Kernel::target_type target_type;
+  typedef typename Kernel::result_type result_type;
+  typedef typename Kernel::param_type  param_type;
+  static_assert(std::is_arithmetic<result_type>::value,
+                "The adjoint P2P requires scalar kernels");
+
+  const int ns = s_last - s_first;
+  const int nt = t_last - t_first;
+  p2p_profile::Call call("adjoint", nt, ns, threads);
+
+  // Tiles of the sources, charges, and both of their gradients
+  const int tile = detail::tile_size<source_type,charge_type,
+                                     source_type>(1);
+  const unsigned workers = detail::num_workers(nt, threads);
+  const std::vector<int> group = detail::group_bounds(nt, workers, 1);
+  const std::vector<int> s_tile = detail::tile_bounds(0, ns, tile);
+
+  // Skipped target gradients go to scratch
+  std::vector<target_type> dt_scratch(dt_first ? 0 : nt);
+  target_type* dt = dt_first ? dt_first : dt_scratch.data();
+
+  std::vector<std::vector<source_type>> ds(workers, std::vector<source_type>(ns));
+  std::vector<std::vector<charge_type>> dc(workers, std::vector<charge_type>(ns));
+  std::vector<param_type> dpw(workers, param_type(0));
+
+  detail::run_workers(workers, [&](unsigned w) {
+      const std::vector<int> t_tile = detail::tile_bounds(group[w], group[w+1], tile);
+      detail::zorder_for_each(t_tile.size()-1, s_tile.size()-1,
+                              [&](unsigned i, unsigned j) {
+          const int s0 = s_tile[j], s1 = s_tile[j+1];
+          const int t0 = t_tile[i], t1 = t_tile[i+1];
+          p2p_profile::Leaf leaf((long long)(s1 - s0) * (t1 - t0));
+          detail::block_adjoint(K, s_first + s0, s_first + s1, c_first + s0,
+                                t_first + t0, t_first + t1, g_first + t0,
+                                ds[w].data() + s0, dc[w].data() + s0,
+                                dt + t0, dpw[w]);
+        });
+    });
+
+  for (unsigned w = 0; w < workers; ++w) {
+    for (int j = 0; ds_first && j < ns; ++j)
+      ds_first[j] += ds[w][j];
+    for (int j = 0; dc_first && j < ns; ++j)
+      dc_first[j] += dc[w][j];
+    if (dp)
+      *dp += dpw[w];
+  }
+}
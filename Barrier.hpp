@@ -0,0 +1,34 @@
+#pragma once
+/** @file Barrier.hpp
+ * @brief Reusable thread barrier
+ */
+
+#include <mutex>
+#include <condition_variable>
+
+/** Barrier class, blocks a fixed number of threads until all have arrived.
+ * Reusable: the barrier resets itself once every thread has passed.
+ */
+class Barrier {
+ public:
+  explicit Barrier(unsigned count)
+      : count_(count), waiting_(0), generation_(0) {}
+  // Wait until all threads have called wait()
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    unsigned gen = generation_;
+    if (++waiting_ == count_) {
+      waiting_ = 0;
+      ++generation_;
+      cond_.notify_all();
+    } else {
+      cond_.wait(lock, [&](){ return gen != generation_; });
+    }
+  }
+ private:
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  unsigned count_;
+  unsigned waiting_;
+  unsigned generation_;
+};
@@ -0,0 +1,606 @@
+/** @file CommProfile.cpp
+ * @brief PMPI interposition layer that accounts the communication volume of
+ * the drivers per phase, MPI call, and communicator.
+ *
+ * Build with 'make COMMPROF=1' to link libcommprof.a into the drivers.
+ * At MPI_Finalize every rank's counters and its row of the communication
+ * matrix are collected on rank 0 and written to the file named by the
+ * COMMPROF_FILE environment variable (default commprof.txt). Rank 0 also
+ * prints the counters summed over all ranks.
+ *
+ * Collectives are accounted by their logical data flow: the root sends its
+ * data to every other member in a broadcast or scatter, and every member
+ * sends its data to the root in a gather or reduce. This is the volume the
+ * algorithm requires, independent of the tree the MPI library uses.
+ *
+ * Nonblocking calls are accounted when they are started. The time spent
+ * completing them in MPI_Wait* and MPI_Test* is counted under those calls, for
+ * the communicator of the first pending request.
+ */
+
+#include <mpi.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+
+#include "CommProfile.hpp"
+
+namespace {
+
+/** Counters of a single (phase, call, communicator) */
+struct Counter {
+  long long calls = 0;
+  long long sent = 0;       //< Bytes sent by this rank
+  long long recvd = 0;      //< Bytes received by this rank
+  double time = 0;          //< Seconds spent in MPI
+};
+
+/** A communicator seen by the profiler */
+struct CommInfo {
+  MPI_Comm comm;            //< MPI_COMM_NULL once freed
+  int rank;
+  int size;
+  std::vector<int> world;   //< World rank of each rank in comm
+};
+
+typedef std::tuple<std::string, std::string, int> Key;
+
+std::string phase = "setup";
+std::map<Key, Counter> counters;
+std::vector<CommInfo> comms;
+std::vector<long long> matrix;   //< Bytes sent to each world rank
+std::map<MPI_Request, int> requests;  //< Comm id of each pending request
+
+/** Return the id of @a comm, registering it on first use. Freed
+ * communicators keep their ids and counters, but are never matched again, so
+ * a handle the library reuses is registered anew.
+ */
+int comm_id(MPI_Comm comm) {
+  for (unsigned k = 0; k < comms.size(); ++k) {
+    int result;
+    if (comms[k].comm == MPI_COMM_NULL)
+      continue;
+    if (comms[k].comm == comm)
+      return k;
+    PMPI_Comm_compare(comms[k].comm, comm, &result);
+    if (result == MPI_IDENT)
+      return k;
+  }
+
+  CommInfo info;
+  info.comm = comm;
+  PMPI_Comm_rank(comm, &info.rank);
+  PMPI_Comm_size(comm, &info.size);
+
+  MPI_Group group, world_group;
+  PMPI_Comm_group(comm, &group);
+  PMPI_Comm_group(MPI_COMM_WORLD, &world_group);
+  std::vector<int> ranks(info.size);
+  for (int r = 0; r < info.size; ++r) ranks[r] = r;
+  info.world.resize(info.size);
+  PMPI_Group_translate_ranks(group, info.size, ranks.data(),
+                             world_group, info.world.data());
+  PMPI_Group_free(&group);
+  PMPI_Group_free(&world_group);
+
+  comms.push_back(info);
+  return comms.size() - 1;
+}
+
+long long bytes(int count, MPI_Datatype type) {
+  int size;
+  PMPI_Type_size(type, &size);
+  return (long long) count * size;
+}
+
+int comm_rank(MPI_Comm comm) {
+  int rank;
+  PMPI_Comm_rank(comm, &rank);
+  return rank;
+}
+
+/** Account @a sent bytes to comm rank @a dst of @a id */
+void send_to(int id, int dst, long long sent) {
+  if (dst == MPI_PROC_NULL || sent == 0)
+    return;
+  if (matrix.empty()) {
+    int P;
+    PMPI_Comm_size(MPI_COMM_WORLD, &P);
+    matrix.resize(P);
+  }
+  matrix[comms[id].world[dst]] += sent;
+}
+
+/** Remember the communicator of the started request @a req */
+void track(const MPI_Request* req, MPI_Comm comm) {
+  if (*req != MPI_REQUEST_NULL)
+    requests[*req] = comm_id(comm);
+}
+
+/** The comm id of the first pending request of @a req[0, n), or of
+ * MPI_COMM_WORLD if none was tracked
+ */
+int request_comm(const MPI_Request* req, int n) {
+  for (int k = 0; k < n; ++k) {
+    auto it = requests.find(req[k]);
+    if (it != requests.end())
+      return it->second;
+  }
+  return comm_id(MPI_COMM_WORLD);
+}
+
+/** Forget the requests of @a before that @a after shows completed */
+void untrack(const std::vector<MPI_Request>& before, const MPI_Request* after) {
+  for (unsigned k = 0; k < before.size(); ++k)
+    if (before[k] != MPI_REQUEST_NULL && after[k] == MPI_REQUEST_NULL)
+      requests.erase(before[k]);
+}
+
+/** Scoped record of one MPI call */
+class Record {
+ public:
+  Record(const char* call, MPI_Comm comm)
+      : Record(call, comm_id(comm)) {
+  }
+  Record(const char* call, int id)
+      : id_(id),
+        counter_(counters[Key(phase, call, id_)]),
+        start_(PMPI_Wtime()) {
+    ++counter_.calls;
+  }
+  ~Record() {
+    counter_.time += PMPI_Wtime() - start_;
+  }
+  int id() const { return id_; }
+  int size() const { return comms[id_].size; }
+  // Messages to self are local copies and are not counted
+  void sent(int dst, long long b) {
+    if (dst == MPI_PROC_NULL || dst == comms[id_].rank) return;
+    counter_.sent += b;
+    send_to(id_, dst, b);
+  }
+  void recvd(int src, long long b) {
+    if (src == MPI_PROC_NULL || src == comms[id_].rank) return;
+    counter_.recvd += b;
+  }
+  /** The root sends @a b bytes to every other member */
+  void one_to_all(int root, MPI_Comm comm, long long b) {
+    if (comm_rank(comm) == root) {
+      for (int r = 0; r < size(); ++r)
+        if (r != root) sent(r, b);
+    } else {
+      recvd(root, b);
+    }
+  }
+  /** Every member sends @a b bytes to the root */
+  void all_to_one(int root, MPI_Comm comm, long long b) {
+    if (comm_rank(comm) == root) {
+      counter_.recvd += (size() - 1) * b;
+    } else {
+      sent(root, b);
+    }
+  }
+ private:
+  int id_;
+  Counter& counter_;
+  double start_;
+};
+
+} // end anonymous namespace
+
+
+extern "C" void comm_phase(const char* name) {
+  phase = name;
+}
+
+
+/*******************************/
+/****** Point-to-point *********/
+/*******************************/
+
+extern "C"
+int MPI_Send(const void* buf, int count, MPI_Datatype type,
+             int dest, int tag, MPI_Comm comm) {
+  Record rec("Send", comm);
+  rec.sent(dest, bytes(count, type));
+  return PMPI_Send(buf, count, type, dest, tag, comm);
+}
+
+extern "C"
+int MPI_Recv(void* buf, int count, MPI_Datatype type,
+             int source, int tag, MPI_Comm comm, MPI_Status* status) {
+  Record rec("Recv", comm);
+  MPI_Status s;
+  int err = PMPI_Recv(buf, count, type, source, tag, comm, &s);
+  int received;
+  PMPI_Get_count(&s, type, &received);
+  rec.recvd(s.MPI_SOURCE, bytes(received, type));
+  if (status != MPI_STATUS_IGNORE) *status = s;
+  return err;
+}
+
+extern "C"
+int MPI_Isend(const void* buf, int count, MPI_Datatype type,
+              int dest, int tag, MPI_Comm comm, MPI_Request* request) {
+  Record rec("Isend", comm);
+  rec.sent(dest, bytes(count, type));
+  int err = PMPI_Isend(buf, count, type, dest, tag, comm, request);
+  track(request, comm);
+  return err;
+}
+
+extern "C"
+int MPI_Irecv(void* buf, int count, MPI_Datatype type,
+              int source, int tag, MPI_Comm comm, MPI_Request* request) {
+  Record rec("Irecv", comm);
+  rec.recvd(source, bytes(count, type));
+  int err = PMPI_Irecv(buf, count, type, source, tag, comm, request);
+  track(request, comm);
+  return err;
+}
+
+extern "C"
+int MPI_Sendrecv(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                 int dest, int sendtag,
+                 void* recvbuf, int recvcount, MPI_Datatype recvtype,
+                 int source, int recvtag,
+                 MPI_Comm comm, MPI_Status* status) {
+  Record rec("Sendrecv", comm);
+  rec.sent(dest, bytes(sendcount, sendtype));
+  rec.recvd(source, bytes(recvcount, recvtype));
+  return PMPI_Sendrecv(sendbuf, sendcount, sendtype, dest, sendtag,
+                       recvbuf, recvcount, recvtype, source, recvtag,
+                       comm, status);
+}
+
+extern "C"
+int MPI_Sendrecv_replace(void* buf, int count, MPI_Datatype type,
+                         int dest, int sendtag, int source, int recvtag,
+                         MPI_Comm comm, MPI_Status* status) {
+  Record rec("Sendrecv_replace", comm);
+  rec.sent(dest, bytes(count, type));
+  rec.recvd(source, bytes(count, type));
+  return PMPI_Sendrecv_replace(buf, count, type, dest, sendtag,
+                               source, recvtag, comm, status);
+}
+
+
+/*******************************/
+/****** Completion *************/
+/*******************************/
+
+extern "C"
+int MPI_Wait(MPI_Request* request, MPI_Status* status) {
+  Record rec("Wait", request_comm(request, 1));
+  std::vector<MPI_Request> before(request, request + 1);
+  int err = PMPI_Wait(request, status);
+  untrack(before, request);
+  return err;
+}
+
+extern "C"
+int MPI_Waitall(int count, MPI_Request reqs[], MPI_Status statuses[]) {
+  Record rec("Waitall", request_comm(reqs, count));
+  std::vector<MPI_Request> before(reqs, reqs + count);
+  int err = PMPI_Waitall(count, reqs, statuses);
+  untrack(before, reqs);
+  return err;
+}
+
+extern "C"
+int MPI_Waitany(int count, MPI_Request reqs[], int* index, MPI_Status* status) {
+  Record rec("Waitany", request_comm(reqs, count));
+  std::vector<MPI_Request> before(reqs, reqs + count);
+  int err = PMPI_Waitany(count, reqs, index, status);
+  untrack(before, reqs);
+  return err;
+}
+
+extern "C"
+int MPI_Test(MPI_Request* request, int* flag, MPI_Status* status) {
+  Record rec("Test", request_comm(request, 1));
+  std::vector<MPI_Request> before(request, request + 1);
+  int err = PMPI_Test(request, flag, status);
+  untrack(before, request);
+  return err;
+}
+
+extern "C"
+int MPI_Testall(int count, MPI_Request reqs[], int* flag,
+                MPI_Status statuses[]) {
+  Record rec("Testall", request_comm(reqs, count));
+  std::vector<MPI_Request> before(reqs, reqs + count);
+  int err = PMPI_Testall(count, reqs, flag, statuses);
+  untrack(before, reqs);
+  return err;
+}
+
+extern "C"
+int MPI_Testsome(int count, MPI_Request reqs[], int* outcount, int indices[],
+                 MPI_Status statuses[]) {
+  Record rec("Testsome", request_comm(reqs, count));
+  std::vector<MPI_Request> before(reqs, reqs + count);
+  int err = PMPI_Testsome(count, reqs, outcount, indices, statuses);
+  untrack(before, reqs);
+  return err;
+}
+
+
+/*******************************/
+/****** Collectives ************/
+/*******************************/
+
+extern "C"
+int MPI_Barrier(MPI_Comm comm) {
+  Record rec("Barrier", comm);
+  return PMPI_Barrier(comm);
+}
+
+extern "C"
+int MPI_Bcast(void* buf, int count, MPI_Datatype type, int root, MPI_Comm comm) {
+  Record rec("Bcast", comm);
+  rec.one_to_all(root, comm, bytes(count, type));
+  return PMPI_Bcast(buf, count, type, root, comm);
+}
+
+extern "C"
+int MPI_Scatter(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                void* recvbuf, int recvcount, MPI_Datatype recvtype,
+                int root, MPI_Comm comm) {
+  Record rec("Scatter", comm);
+  rec.one_to_all(root, comm, bytes(recvcount, recvtype));
+  return PMPI_Scatter(sendbuf, sendcount, sendtype,
+                      recvbuf, recvcount, recvtype, root, comm);
+}
+
+extern "C"
+int MPI_Gather(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+               void* recvbuf, int recvcount, MPI_Datatype recvtype,
+               int root, MPI_Comm comm) {
+  Record rec("Gather", comm);
+  rec.all_to_one(root, comm, bytes(sendcount, sendtype));
+  return PMPI_Gather(sendbuf, sendcount, sendtype,
+                     recvbuf, recvcount, recvtype, root, comm);
+}
+
+extern "C"
+int MPI_Gatherv(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                void* recvbuf, const int recvcounts[], const int displs[],
+                MPI_Datatype recvtype, int root, MPI_Comm comm) {
+  Record rec("Gatherv", comm);
+  if (comm_rank(comm) == root) {
+    for (int r = 0; r < rec.size(); ++r)
+      if (r != root) rec.recvd(r, bytes(recvcounts[r], recvtype));
+  } else {
+    rec.sent(root, bytes(sendcount, sendtype));
+  }
+  return PMPI_Gatherv(sendbuf, sendcount, sendtype,
+                      recvbuf, recvcounts, displs, recvtype, root, comm);
+}
+
+extern "C"
+int MPI_Igather(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                void* recvbuf, int recvcount, MPI_Datatype recvtype,
+                int root, MPI_Comm comm, MPI_Request* request) {
+  Record rec("Igather", comm);
+  rec.all_to_one(root, comm, bytes(sendcount, sendtype));
+  int err = PMPI_Igather(sendbuf, sendcount, sendtype,
+                         recvbuf, recvcount, recvtype, root, comm, request);
+  track(request, comm);
+  return err;
+}
+
+extern "C"
+int MPI_Allgather(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                  void* recvbuf, int recvcount, MPI_Datatype recvtype,
+                  MPI_Comm comm) {
+  Record rec("Allgather", comm);
+  int me = comm_rank(comm);
+  for (int r = 0; r < rec.size(); ++r) {
+    if (r == me) continue;
+    rec.sent(r, bytes(sendcount, sendtype));
+    rec.recvd(r, bytes(recvcount, recvtype));
+  }
+  return PMPI_Allgather(sendbuf, sendcount, sendtype,
+                        recvbuf, recvcount, recvtype, comm);
+}
+
+extern "C"
+int MPI_Allgatherv(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                   void* recvbuf, const int recvcounts[], const int displs[],
+                   MPI_Datatype recvtype, MPI_Comm comm) {
+  Record rec("Allgatherv", comm);
+  int me = comm_rank(comm);
+  for (int r = 0; r < rec.size(); ++r) {
+    if (r == me) continue;
+    rec.sent(r, bytes(sendcount, sendtype));
+    rec.recvd(r, bytes(recvcounts[r], recvtype));
+  }
+  return PMPI_Allgatherv(sendbuf, sendcount, sendtype,
+                         recvbuf, recvcounts, displs, recvtype, comm);
+}
+
+extern "C"
+int MPI_Reduce(const void* sendbuf, void* recvbuf, int count,
+               MPI_Datatype type, MPI_Op op, int root, MPI_Comm comm) {
+  Record rec("Reduce", comm);
+  rec.all_to_one(root, comm, bytes(count, type));
+  return PMPI_Reduce(sendbuf, recvbuf, count, type, op, root, comm);
+}
+
+extern "C"
+int MPI_Allreduce(const void* sendbuf, void* recvbuf, int count,
+                  MPI_Datatype type, MPI_Op op, MPI_Comm comm) {
+  Record rec("Allreduce", comm);
+  rec.all_to_one(0, comm, bytes(count, type));
+  rec.one_to_all(0, comm, bytes(count, type));
+  return PMPI_Allreduce(sendbuf, recvbuf, count, type, op, comm);
+}
+
+extern "C"
+int MPI_Ibcast(void* buf, int count, MPI_Datatype type, int root,
+               MPI_Comm comm, MPI_Request* request) {
+  Record rec("Ibcast", comm);
+  rec.one_to_all(root, comm, bytes(count, type));
+  int err = PMPI_Ibcast(buf, count, type, root, comm, request);
+  track(request, comm);
+  return err;
+}
+
+extern "C"
+int MPI_Iallreduce(const void* sendbuf, void* recvbuf, int count,
+                   MPI_Datatype type, MPI_Op op, MPI_Comm comm,
+                   MPI_Request* request) {
+  Record rec("Iallreduce", comm);
+  rec.all_to_one(0, comm, bytes(count, type));
+  rec.one_to_all(0, comm, bytes(count, type));
+  int err = PMPI_Iallreduce(sendbuf, recvbuf, count, type, op, comm, request);
+  track(request, comm);
+  return err;
+}
+
+extern "C"
+int MPI_Reduce_scatter_block(const void* sendbuf, void* recvbuf, int recvcount,
+                             MPI_Datatype type, MPI_Op op, MPI_Comm comm) {
+  Record rec("Reduce_scatter_block", comm);
+  int me = comm_rank(comm);
+  for (int r = 0; r < rec.size(); ++r) {
+    if (r == me) continue;
+    rec.sent(r, bytes(recvcount, type));
+    rec.recvd(r, bytes(recvcount, type));
+  }
+  return PMPI_Reduce_scatter_block(sendbuf, recvbuf, recvcount, type, op, comm);
+}
+
+extern "C"
+int MPI_Alltoall(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+                 void* recvbuf, int recvcount, MPI_Datatype recvtype,
+                 MPI_Comm comm) {
+  Record rec("Alltoall", comm);
+  int me = comm_rank(comm);
+  for (int r = 0; r < rec.size(); ++r) {
+    if (r == me) continue;
+    rec.sent(r, bytes(sendcount, sendtype));
+    rec.recvd(r, bytes(recvcount, recvtype));
+  }
+  return PMPI_Alltoall(sendbuf, sendcount, sendtype,
+                       recvbuf, recvcount, recvtype, comm);
+}
+
+extern "C"
+int MPI_Alltoallv(const void* sendbuf, const int sendcounts[],
+                  const int sdispls[], MPI_Datatype sendtype,
+                  void* recvbuf, const int recvcounts[],
+                  const int rdispls[], MPI_Datatype recvtype,
+                  MPI_Comm comm) {
+  Record rec("Alltoallv", comm);
+  int me = comm_rank(comm);
+  for (int r = 0; r < rec.size(); ++r) {
+    if (r == me) continue;
+    rec.sent(r, bytes(sendcounts[r], sendtype));
+    rec.recvd(r, bytes(recvcounts[r], recvtype));
+  }
+  return PMPI_Alltoallv(sendbuf, sendcounts, sdispls, sendtype,
+                        recvbuf, recvcounts, rdispls, recvtype, comm);
+}
+
+
+/*******************************/
+/****** Communicators **********/
+/*******************************/
+
+extern "C"
+int MPI_Comm_free(MPI_Comm* comm) {
+  for (CommInfo& info : comms)
+    if (info.comm == *comm)
+      info.comm = MPI_COMM_NULL;
+  return PMPI_Comm_free(comm);
+}
+
+
+/*******************************/
+/****** Report *****************/
+/*******************************/
+
+extern "C"
+int MPI_Finalize() {
+  int rank, P;
+  PMPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  PMPI_Comm_size(MPI_COMM_WORLD, &P);
+  matrix.resize(P);
+
+  // Serialize this rank's counters
+  std::ostringstream ss;
+  for (auto& kv : counters) {
+    const Counter& c = kv.second;
+    int id = std::get<2>(kv.first);
+    ss << rank << "\t" << std::get<0>(kv.first) << "\t" << std::get<1>(kv.first)
+       << "\tcomm" << id << "(" << comms[id].size << ")"
+       << "\t" << c.calls << "\t" << c.sent << "\t" << c.recvd
+       << "\t" << c.time << "\n";
+  }
+  std::string text = ss.str();
+
+  // Collect the counters and the communication matrix on rank 0
+  int length = text.size();
+  std::vector<int> lengths(P), displs(P);
+  PMPI_Gather(&length, 1, MPI_INT, lengths.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+  std::vector<char> all_text;
+  if (rank == 0) {
+    for (int r = 1; r < P; ++r) displs[r] = displs[r-1] + lengths[r-1];
+    all_text.resize(displs[P-1] + lengths[P-1]);
+  }
+  PMPI_Gatherv(&text[0], length, MPI_CHAR,
+               all_text.data(), lengths.data(), displs.data(), MPI_CHAR,
+               0, MPI_COMM_WORLD);
+
+  std::vector<long long> all_matrix(rank == 0 ? P * P : 0);
+  PMPI_Gather(matrix.data(), P, MPI_LONG_LONG,
+              all_matrix.data(), P, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+
+  if (rank == 0) {
+    const char* env = std::getenv("COMMPROF_FILE");
+    std::string filename = env ? env : "commprof.txt";
+    std::ofstream file(filename);
+
+    file << "# Rank\tPhase\tCall\tComm(size)\tCalls\tBytesSent\tBytesRecv\tTime\n";
+    file.write(all_text.data(), all_text.size());
+
+    file << "# Communication matrix: bytes sent from row rank to column rank\n";
+    for (int r = 0; r < P; ++r) {
+      for (int s = 0; s < P; ++s)
+        file << all_matrix[r*P + s] << (s+1 < P ? "\t" : "\n");
+    }
+
+    // Summarize by phase over all ranks
+    std::map<std::string, Counter> by_phase;
+    std::istringstream is(std::string(all_text.begin(), all_text.end()));
+    std::string line;
+    while (std::getline(is, line)) {
+      std::istringstream ls(line);
+      std::string r, ph, call, comm;
+      Counter c;
+      ls >> r >> ph >> call >> comm >> c.calls >> c.sent >> c.recvd >> c.time;
+      Counter& total = by_phase[ph];
+      total.calls += c.calls;
+      total.sent  += c.sent;
+      total.recvd += c.recvd;
+      total.time  += c.time;
+    }
+
+    printf("CommProfile written to %s\n", filename.c_str());
+    printf("Phase\tCalls\tBytesSent\tAvgTime\n");
+    for (auto& kv : by_phase)
+      printf("%s\t%lld\t%lld\t%e\n", kv.first.c_str(),
+             kv.second.calls, kv.second.sent, kv.second.time / P);
+  }
+
+  return PMPI_Finalize();
+}
@@ -0,0 +1,15 @@
+#pragma once
+/** @file CommProfile.hpp
+ * @brief Phase markers for the PMPI communication profiler
+ *
+ * When the drivers are built with 'make COMMPROF=1' every MPI call is counted
+ * by libcommprof.a (see CommProfile.cpp) under the phase most recently marked
+ * with comm_phase(). Otherwise the markers compile away.
+ */
+
+#if defined(NBODY_COMM_PROFILE)
+/** Tag all following MPI calls of this process with the phase @a name */
+extern "C" void comm_phase(const char* name);
+#else
+inline void comm_phase(const char*) {}
+#endif
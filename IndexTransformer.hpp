@@ -0,0 +1,29 @@
+#pragma once
+/** @file IndexTransformer.hpp
+ * @brief Block transpose bookkeeping for the symmetric team scatter schedule
+ */
+
+#include <tuple>
+
+typedef std::tuple<int,int>      xy_pair;
+typedef std::tuple<int,int,int>  itc_tuple;
+typedef std::tuple<int,int>      ir_pair;
+
+struct IndexTransformer {
+  IndexTransformer(int num_teams, int team_size)
+      : T(num_teams), C(team_size) {
+  }
+
+  /** Take an (iteration, team, team_rank) tuple
+   * and return the (iteration, rank) pair of the transpose block
+   */
+  ir_pair operator()(int i, int t, int c) const {
+    int Y = (t + c + i * C) % T;  //< Column number
+    int D = (t - Y + T) % T;      //< Positive distance from diag
+    return ir_pair{(D/C), (Y*C) + (D%C)};
+  }
+
+ private:
+  int T;   // The number of process teams in the computation
+  int C;   // The size of the process teams in the computation
+};
@@ -0,0 +1,282 @@
+#pragma once
+/** @file KernelCheck.hpp
+ * @brief Validation and microbenchmarks of kernels for the P2P
+ *
+ * For any kernel type these check that
+ *   K.transpose(K(t,s)) == K(s,t)   on random pairs, if K.transpose exists
+ *   the symmetric P2P agrees with the asymmetric P2P of the same points
+ * and measure the rates of the P2P in pair interactions per second across
+ * sizes and tile sizes, which kernel_card writes as a performance card.
+ *
+ * Kernel values are compared through their products with random charges, so
+ * kernels with compressed kernel_value_types such as Stokeslet are covered.
+ */
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <string>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <type_traits>
+
+#include "Util.hpp"
+#include "meta/kernel_traits.hpp"
+#include "meta/random.hpp"
+
+namespace kernel_check {
+
+/** @a n random values of type T from the default generator */
+template <typename T>
+std::vector<T> generate(unsigned n) {
+  std::vector<T> a;
+  a.reserve(n);
+  for ( ; n != 0; --n)
+    a.push_back(meta::random<T>::get());
+  return a;
+}
+
+/** The relative vector error of @a result against @a exact */
+template <typename R>
+double vec_error(const std::vector<R>& exact, const std::vector<R>& result) {
+  double error_sq = 0, norm_sq = 0;
+  for (unsigned k = 0; k < exact.size(); ++k) {
+    error_sq += normSq(exact[k] - result[k]);
+    norm_sq  += normSq(exact[k]);
+  }
+  return norm_sq == 0 ? std::sqrt(error_sq) : std::sqrt(error_sq / norm_sq);
+}
+
+namespace detail {
+
+template <typename Kernel>
+double transpose_error(const Kernel& K, unsigned pairs, std::true_type) {
+  typedef typename Kernel::source_type source_type;
+  typedef typename Kernel::charge_type charge_type;
+  typedef typename Kernel::result_type result_type;
+
+  double max_err = 0;
+  for (unsigned k = 0; k < pairs; ++k) {
+    const source_type s = meta::random<source_type>::get();
+    const source_type t = meta::random<source_type>::get();
+    const charge_type c = meta::random<charge_type>::get();
+    const result_type kst = K.transpose(K(t,s)) * c;
+    const result_type exact = K(s,t) * c;
+    const double scale = std::max(1e-300, double(norm(exact)));
+    max_err = std::max(max_err, double(norm(kst - exact)) / scale);
+  }
+  return max_err;
+}
+
+template <typename Kernel>
+double transpose_error(const Kernel&, unsigned, std::false_type) {
+  return -1;
+}
+
+template <typename Kernel>
+void symmetric_errors(const Kernel& K, unsigned n, double& diag, double& off,
+                      std::true_type) {
+  typedef typename Kernel::source_type source_type;
+  typedef typename Kernel::charge_type charge_type;
+  typedef typename Kernel::result_type result_type;
+
+  const std::vector<source_type> x = generate<source_type>(n);
+  const std::vector<charge_type> c = generate<charge_type>(n);
+
+  // The diagonal block
+  std::vector<result_type> exact(n), result(n);
+  p2p(K, x.begin(), x.end(), c.begin(), x.begin(), x.end(), exact.begin());
+  p2p(K, x.begin(), x.end(), c.begin(), result.begin());
+  diag = vec_error(exact, result);
+
+  // The off-diagonal blocks of the halves
+  const unsigned h = n / 2;
+  std::fill(exact.begin(), exact.end(), result_type());
+  std::fill(result.begin(), result.end(), result_type());
+  p2p(K, x.begin() + h, x.end(), c.begin() + h,
+      x.begin(), x.begin() + h, exact.begin());
+  p2p(K, x.begin(), x.begin() + h, c.begin(),
+      x.begin() + h, x.end(), exact.begin() + h);
+  p2p(K,
+      x.begin(), x.begin() + h, c.begin(), result.begin(),
+      x.begin() + h, x.end(), c.begin() + h, result.begin() + h);
+  off = vec_error(exact, result);
+}
+
+template <typename Kernel>
+void symmetric_errors(const Kernel&, unsigned, double& diag, double& off,
+                      std::false_type) {
+  diag = off = -1;
+}
+
+} // end namespace detail
+
+/** The largest relative error of K.transpose(K(t,s)) against K(s,t) on
+ * @a pairs random pairs, or -1 if K has no transpose
+ */
+template <typename Kernel>
+double transpose_error(const Kernel& K, unsigned pairs) {
+  return detail::transpose_error(K, pairs,
+      std::integral_constant<bool, KernelTraits<Kernel>::has_transpose>());
+}
+
+/** The relative errors of the symmetric diagonal and off-diagonal P2P of
+ * @a n random points against the asymmetric P2P, or -1 if the sources and
+ * targets differ in type
+ */
+template <typename Kernel>
+void symmetric_errors(const Kernel& K, unsigned n, double& diag, double& off) {
+  detail::symmetric_errors(K, n, diag, off,
+      std::is_same<typename Kernel::source_type, typename Kernel::target_type>());
+}
+
+/** Seconds of the asymmetric P2P of @a n random sources and targets with
+ * target and source tiles of @a tile elements, or of the tile size of
+ * P2P_BLOCK_SIZE if @a tile is 0
+ */
+template <typename Kernel>
+double asymmetric_time(const Kernel& K, unsigned n, int tile = 0,
+                       unsigned threads = P2P_NUM_THREADS) {
+  typedef typename Kernel::source_type source_type;
+  typedef typename Kernel::charge_type charge_type;
+  typedef typename Kernel::target_type target_type;
+  typedef typename Kernel::result_type result_type;
+
+  const std::vector<source_type> s = generate<source_type>(n);
+  const std::vector<charge_type> c = generate<charge_type>(n);
+  const std::vector<target_type> t = generate<target_type>(n);
+  std::vector<result_type> r(n);
+
+  Clock timer;
+  if (tile == 0) {
+    p2p(K, s.begin(), s.end(), c.begin(), t.begin(), t.end(), r.begin(), threads);
+    return timer.elapsed();
+  }
+
+  // The tiled P2P of the engine at the given tile size
+  const unsigned workers = ::detail::num_workers(n, threads);
+  const std::vector<int> group = ::detail::group_bounds(n, workers, 1);
+  const std::vector<int> s_tile = ::detail::tile_bounds(0, n, tile);
+  ::detail::run_workers(workers, [&](unsigned w) {
+      const std::vector<int> t_tile = ::detail::tile_bounds(group[w], group[w+1], tile);
+      ::detail::zorder_for_each(t_tile.size()-1, s_tile.size()-1,
+                                [&](unsigned i, unsigned j) {
+          ::detail::block_eval(K, s.data() + s_tile[j], s.data() + s_tile[j+1],
+                               c.data() + s_tile[j],
+                               t.data() + t_tile[i], t.data() + t_tile[i+1],
+                               r.data() + t_tile[i]);
+        });
+    });
+  return timer.elapsed();
+}
+
+namespace detail {
+
+template <typename Kernel>
+double symmetric_time(const Kernel& K, unsigned n, unsigned threads,
+                      std::true_type) {
+  typedef typename Kernel::source_type source_type;
+  typedef typename Kernel::charge_type charge_type;
+  typedef typename Kernel::result_type result_type;
+
+  const std::vector<source_type> x = generate<source_type>(n);
+  const std::vector<charge_type> c = generate<charge_type>(n);
+  std::vector<result_type> r(n);
+
+  Clock timer;
+  p2p(K, x.begin(), x.end(), c.begin(), r.begin(), threads);
+  return timer.elapsed();
+}
+
+template <typename Kernel>
+double symmetric_time(const Kernel&, unsigned, unsigned, std::false_type) {
+  return -1;
+}
+
+} // end namespace detail
+
+/** Seconds of the symmetric diagonal P2P of @a n random points, or -1 if the
+ * sources and targets differ in type
+ */
+template <typename Kernel>
+double symmetric_time(const Kernel& K, unsigned n,
+                      unsigned threads = P2P_NUM_THREADS) {
+  return detail::symmetric_time(K, n, threads,
+      std::is_same<typename Kernel::source_type, typename Kernel::target_type>());
+}
+
+/** Check the kernel @a K and write its performance card to @a out: the
+ * transpose and symmetric errors against @a tol, the rates of the asymmetric
+ * and symmetric P2P for N = @a n_min .. @a n_max doubling, and the rates of
+ * the asymmetric P2P at N = @a n_max for tile sizes 32 .. n_max doubling.
+ * Rates are in 1e9 pair interactions per second, counting both directions of
+ * every pair of the symmetric P2P.
+ *
+ * @returns Whether the checks passed
+ */
+template <typename Kernel>
+bool kernel_card(const Kernel& K, const std::string& name, std::ostream& out,
+                 unsigned n_min, unsigned n_max, unsigned pairs, double tol) {
+  typedef typename Kernel::source_type source_type;
+  typedef typename Kernel::charge_type charge_type;
+  typedef typename Kernel::target_type target_type;
+  typedef typename Kernel::result_type result_type;
+
+  out << "Kernel: " << name << std::endl;
+  out << "Bytes: source " << sizeof(source_type)
+      << ", charge " << sizeof(charge_type)
+      << ", target " << sizeof(target_type)
+      << ", result " << sizeof(result_type) << std::endl;
+  out << "P2P_BLOCK_SIZE: " << P2P_BLOCK_SIZE
+      << ", tile " << ::detail::tile_size<source_type,charge_type,result_type>(1)
+      << ", threads " << unsigned(P2P_NUM_THREADS) << std::endl;
+
+  bool pass = true;
+  const double t_err = transpose_error(K, pairs);
+  out << "Transpose: ";
+  if (t_err < 0) {
+    out << "not defined" << std::endl;
+  } else {
+    pass &= t_err <= tol;
+    out << "max relative error " << t_err << " on " << pairs << " pairs "
+        << (t_err <= tol ? "PASS" : "FAIL") << std::endl;
+  }
+
+  double d_err, o_err;
+  symmetric_errors(K, n_min, d_err, o_err);
+  out << "Symmetric vs asymmetric: ";
+  if (d_err < 0) {
+    out << "not applicable" << std::endl;
+  } else {
+    const bool ok = d_err <= tol && o_err <= tol;
+    pass &= ok;
+    out << "diagonal " << d_err << ", off-diagonal " << o_err
+        << " at N = " << n_min << " " << (ok ? "PASS" : "FAIL") << std::endl;
+  }
+
+  out << std::setw(8) << "N" << std::setw(14) << "AsymGI/s"
+      << std::setw(14) << "SymmGI/s" << std::endl;
+  for (unsigned n = n_min; n <= n_max; n *= 2) {
+    const double pairs_n = double(n) * n * 1e-9;
+    out << std::setw(8) << n << std::scientific << std::setprecision(3)
+        << std::setw(14) << pairs_n / asymmetric_time(K, n);
+    const double symm = symmetric_time(K, n);
+    if (symm > 0)
+      out << std::setw(14) << pairs_n / symm;
+    out << std::defaultfloat << std::endl;
+  }
+
+  out << std::setw(8) << "Tile" << std::setw(14) << "AsymGI/s"
+      << " at N = " << n_max << std::endl;
+  const double pairs_n = double(n_max) * n_max * 1e-9;
+  for (unsigned tile = 32; tile <= n_max; tile *= 2)
+    out << std::setw(8) << tile << std::scientific << std::setprecision(3)
+        << std::setw(14) << pairs_n / asymmetric_time(K, n_max, tile)
+        << std::defaultfloat << std::endl;
+
+  out << "Result: " << (pass ? "PASS" : "FAIL") << std::endl;
+  return pass;
+}
+
+} // end namespace kernel_check
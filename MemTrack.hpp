@@ -0,0 +1,136 @@
+#pragma once
+/** @file MemTrack.hpp
+ * @brief Allocator that accounts the current and peak bytes of named buffers
+ *
+ * Containers constructed with a tracked_allocator<T>("name") add their
+ * allocations to the counter of that name and to the total of the process,
+ * so the drivers can report the peak footprint per rank and per buffer.
+ * Memory allocated inside MPI (e.g. by MPI_Sendrecv_replace) is not seen.
+ */
+
+#include <cstdio>
+#include <cstddef>
+#include <new>
+#include <string>
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+#include <mpi.h>
+
+namespace mem_track {
+
+/** Current and peak bytes of a buffer */
+struct Counter {
+  std::string name;
+  std::size_t current;
+  std::size_t peak;
+
+  explicit Counter(const std::string& _name)
+      : name(_name), current(0), peak(0) {}
+
+  void add(std::size_t bytes) {
+    current += bytes;
+    peak = std::max(peak, current);
+  }
+  void sub(std::size_t bytes) {
+    current -= bytes;
+  }
+};
+
+/** The buffers of this process, in order of registration */
+inline std::deque<Counter>& counters() {
+  static std::deque<Counter> c;     // Stable addresses for the allocators
+  return c;
+}
+/** The sum over all buffers of this process */
+inline Counter& total() {
+  static Counter t("total");
+  return t;
+}
+
+/** The counter of the buffer @a name, registered on first use */
+inline Counter* counter(const std::string& name) {
+  for (Counter& c : counters())
+    if (c.name == name)
+      return &c;
+  counters().emplace_back(name);
+  return &counters().back();
+}
+
+/** Allocator charging a named counter */
+template <typename T>
+struct tracked_allocator {
+  typedef T value_type;
+
+  Counter* counter;
+
+  explicit tracked_allocator(const std::string& name)
+      : counter(mem_track::counter(name)) {}
+  template <typename U>
+  tracked_allocator(const tracked_allocator<U>& a)
+      : counter(a.counter) {}
+
+  T* allocate(std::size_t n) {
+    const std::size_t bytes = n * sizeof(T);
+    T* p = static_cast<T*>(::operator new(bytes));
+    counter->add(bytes);
+    total().add(bytes);
+    return p;
+  }
+  void deallocate(T* p, std::size_t n) {
+    const std::size_t bytes = n * sizeof(T);
+    counter->sub(bytes);
+    total().sub(bytes);
+    ::operator delete(p);
+  }
+};
+
+template <typename T, typename U>
+inline bool operator==(const tracked_allocator<T>& a,
+                       const tracked_allocator<U>& b) {
+  return a.counter == b.counter;
+}
+template <typename T, typename U>
+inline bool operator!=(const tracked_allocator<T>& a,
+                       const tracked_allocator<U>& b) {
+  return a.counter != b.counter;
+}
+
+/** Print the peak MiB of each buffer on @a root: its value on @a root and the
+ * maximum and mean over the processes of @a comm. Every process must register
+ * the same buffers in the same order, which holds when they declare the same
+ * containers even if some remain empty.
+ */
+inline void report(int root, MPI_Comm comm) {
+  std::vector<double> peak;
+  for (const Counter& c : counters())
+    peak.push_back(c.peak);
+  peak.push_back(total().peak);
+
+  int rank, P;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &P);
+  std::vector<double> max_peak(peak.size()), sum_peak(peak.size());
+  MPI_Reduce(peak.data(), max_peak.data(), peak.size(), MPI_DOUBLE,
+             MPI_MAX, root, comm);
+  MPI_Reduce(peak.data(), sum_peak.data(), peak.size(), MPI_DOUBLE,
+             MPI_SUM, root, comm);
+
+  if (rank != root)
+    return;
+  const double MiB = 1 << 20;
+  printf("Memory (MiB)\tRoot\tMax\tAvg\n");
+  for (unsigned k = 0; k < peak.size(); ++k) {
+    const std::string& name = (k < counters().size()) ? counters()[k].name
+                                                       : total().name;
+    printf("%s\t%.3f\t%.3f\t%.3f\n", name.c_str(),
+           peak[k] / MiB, max_peak[k] / MiB, sum_peak[k] / P / MiB);
+  }
+}
+
+} // end namespace mem_track
+
+/** A std::vector whose storage is accounted by a named tracked_allocator */
+template <typename T>
+using tracked_vector = std::vector<T, mem_track::tracked_allocator<T>>;
@@ -0,0 +1,280 @@
+#pragma once
+/** @file Nystrom.hpp
+ * @brief Distributed Nystrom low-rank approximation of smooth kernels
+ *
+ * For m landmark points l, the kernel matrix of the points x is approximated
+ *   K(x,x) ~ K(x,l) K(l,l)^-1 K(l,x)
+ * which is accurate when K is numerically of low rank, as for wide Gaussians
+ * or NonParaBayesian. The points are distributed over the processes of a
+ * communicator, each owning a block, and every process holds all landmarks
+ * and the factor of K(l,l). A matvec is two skinny P2Ps of O(n m) per process
+ * and an allreduce of m values.
+ *
+ * K(l,l) is factored by a Cholesky decomposition with diagonal pivoting that
+ * stops when the largest remaining pivot falls below tol times the largest
+ * diagonal entry. The landmarks it did not reach are linearly dependent on the
+ * others to that tolerance and are dropped, so rank() may be less than m.
+ */
+
+#include <cstdint>
+#include <cmath>
+#include <set>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <type_traits>
+
+#include <mpi.h>
+
+#include "Util.hpp"
+#include "meta/distribution.hpp"
+
+/** How Nystrom selects its landmarks */
+enum class Landmarks {
+  random,    //< m distinct points, uniformly
+  kmeanspp   //< k-means++ seeding in the feature space of the kernel
+};
+
+template <typename Kernel>
+class Nystrom {
+ public:
+  typedef typename Kernel::source_type point_type;
+  typedef typename Kernel::charge_type charge_type;
+  typedef typename Kernel::result_type result_type;
+
+  static_assert(std::is_same<point_type, typename Kernel::target_type>::value,
+                "Nystrom requires source_type == target_type");
+  static_assert(std::is_arithmetic<result_type>::value &&
+                std::is_same<charge_type, result_type>::value,
+                "Nystrom requires scalar charges and results of one type");
+
+  /** Select @a m landmarks of the points [first, last) of this process and
+   * the other processes of @a comm, and factor their kernel matrix.
+   * Collective over @a comm.
+   */
+  template <typename PointIter>
+  Nystrom(const Kernel& K, PointIter first, PointIter last, unsigned m,
+          Landmarks how, uint64_t seed, MPI_Comm comm, double tol = 1e-10)
+      : K_(K), comm_(comm) {
+    if (how == Landmarks::kmeanspp)
+      select_kmeanspp(first, last, m, seed);
+    else
+      select_random(first, last, m, seed);
+    factor(tol);
+  }
+
+  /** The number of landmarks kept by the factorization */
+  unsigned rank() const {
+    return landmark_.size();
+  }
+
+  const std::vector<point_type>& landmarks() const {
+    return landmark_;
+  }
+
+  /** r_i += sum_j K~(x_i, x_j) c_j over the points of all processes, with
+   * [first, last) and @a c_first the points and charges of this process.
+   * Collective over the communicator.
+   */
+  template <typename PointIter, typename ChargeIter, typename ResultIter>
+  void apply(PointIter first, PointIter last, ChargeIter c_first,
+             ResultIter r_first) const {
+    const int n = std::distance(first, last);
+    const unsigned k = rank();
+    const point_type* x = iter_base(first);
+    const charge_type* c = iter_base(c_first);
+
+    // z = K(l,x) c, each worker summing a group of the sources
+    const unsigned workers = detail::num_workers(n, P2P_NUM_THREADS);
+    const std::vector<int> group = detail::group_bounds(n, workers, 1);
+    std::vector<std::vector<result_type>> zw(workers, std::vector<result_type>(k));
+    detail::run_workers(workers, [&](unsigned w) {
+        detail::p2p(K_, x + group[w], x + group[w+1], c + group[w],
+                    landmark_.data(), landmark_.data() + k, zw[w].data(), 1u);
+      });
+    std::vector<result_type> z(k);
+    for (unsigned w = 0; w < workers; ++w)
+      for (unsigned i = 0; i < k; ++i)
+        z[i] += zw[w][i];
+    MPI_Allreduce(MPI_IN_PLACE, z.data(), k, mpi_type<result_type>::value(),
+                  MPI_SUM, comm_);
+
+    // w = K(l,l)^-1 z = L^-T L^-1 z
+    std::vector<double> y(z.begin(), z.end());
+    for (unsigned i = 0; i < k; ++i) {
+      for (unsigned j = 0; j < i; ++j)
+        y[i] -= L_[i*k + j] * y[j];
+      y[i] /= L_[i*k + i];
+    }
+    for (unsigned i = k; i-- > 0; ) {
+      for (unsigned j = i+1; j < k; ++j)
+        y[i] -= L_[j*k + i] * y[j];
+      y[i] /= L_[i*k + i];
+    }
+    const std::vector<charge_type> wl(y.begin(), y.end());
+
+    // r += K(x,l) w
+    p2p(K_, landmark_.begin(), landmark_.end(), wl.begin(),
+        first, last, r_first);
+  }
+
+ private:
+  Kernel K_;
+  MPI_Comm comm_;
+  std::vector<point_type> landmark_;
+  std::vector<double> L_;   //< Row-major lower triangular factor of K(l,l)
+
+  /** The offset of the points of this process and the total number of points */
+  void offsets(long long n, long long& offset, long long& total) const {
+    MPI_Exscan(&n, &offset, 1, MPI_LONG_LONG, MPI_SUM, comm_);
+    int rank;
+    MPI_Comm_rank(comm_, &rank);
+    if (rank == 0)
+      offset = 0;
+    MPI_Allreduce(&n, &total, 1, MPI_LONG_LONG, MPI_SUM, comm_);
+  }
+
+  /** Gather the local points @a mine of all processes, in process order, into
+   * the landmarks
+   */
+  void gather_landmarks(const std::vector<point_type>& mine) {
+    int P;
+    MPI_Comm_size(comm_, &P);
+    int count = mine.size() * sizeof(point_type);
+    std::vector<int> counts(P), displs(P+1, 0);
+    MPI_Allgather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, comm_);
+    for (int p = 0; p < P; ++p)
+      displs[p+1] = displs[p] + counts[p];
+    landmark_.resize(displs[P] / sizeof(point_type));
+    MPI_Allgatherv(mine.data(), count, MPI_CHAR,
+                   landmark_.data(), counts.data(), displs.data(), MPI_CHAR,
+                   comm_);
+  }
+
+  /** Select m distinct points uniformly by Floyd's algorithm, the same draws
+   * on every process, in the order of their global indices
+   */
+  template <typename PointIter>
+  void select_random(PointIter first, PointIter last, unsigned m, uint64_t seed) {
+    const long long n = std::distance(first, last);
+    long long offset, total;
+    offsets(n, offset, total);
+    m = std::min<long long>(m, total);
+
+    std::set<long long> pick;
+    for (long long j = total - m; j < total; ++j) {
+      const double u = meta::counter_uniform(meta::counter_key(seed, j), 0);
+      const long long t = std::min(j, (long long)(u * (j + 1)));
+      if (!pick.insert(t).second)
+        pick.insert(j);
+    }
+
+    std::vector<point_type> mine;
+    for (auto it = pick.lower_bound(offset); it != pick.end() && *it < offset + n; ++it)
+      mine.push_back(first[*it - offset]);
+    gather_landmarks(mine);
+  }
+
+  /** Select m points by k-means++ seeding: each next landmark is drawn with
+   * probability proportional to its squared feature space distance
+   *   K(x,x) + K(l,l) - 2 K(x,l)
+   * to the nearest landmark chosen so far, the first uniformly
+   */
+  template <typename PointIter>
+  void select_kmeanspp(PointIter first, PointIter last, unsigned m, uint64_t seed) {
+    const int n = std::distance(first, last);
+    int P;
+    MPI_Comm_size(comm_, &P);
+    int rank;
+    MPI_Comm_rank(comm_, &rank);
+
+    std::vector<double> d2(n, 1.0);
+    std::vector<double> sums(P);
+    const unsigned workers = detail::num_workers(n, P2P_NUM_THREADS);
+    const std::vector<int> group = detail::group_bounds(n, workers, 1);
+
+    for (unsigned k = 0; k < m; ++k) {
+      double sum = std::accumulate(d2.begin(), d2.end(), 0.0);
+      MPI_Allgather(&sum, 1, MPI_DOUBLE, sums.data(), 1, MPI_DOUBLE, comm_);
+      const double total = std::accumulate(sums.begin(), sums.end(), 0.0);
+      if (!(total > 0))
+        break;
+
+      // Find the owner of the draw, which finds the point
+      double u = meta::counter_uniform(meta::counter_key(seed, k), 0) * total;
+      int owner = 0;
+      while (owner < P-1 && (sums[owner] == 0 || u >= sums[owner])) {
+        u -= sums[owner];
+        ++owner;
+      }
+      point_type l = point_type();
+      if (rank == owner) {
+        int i = 0;
+        for ( ; i < n-1 && (d2[i] == 0 || u >= d2[i]); ++i)
+          u -= d2[i];
+        l = first[i];
+      }
+      MPI_Bcast(&l, sizeof(point_type), MPI_CHAR, owner, comm_);
+      landmark_.push_back(l);
+
+      const double kll = K_(l, l);
+      detail::run_workers(workers, [&](unsigned w) {
+          for (int i = group[w]; i < group[w+1]; ++i) {
+            const point_type& x = first[i];
+            const double dist = std::max(0.0, K_(x, x) + kll - 2 * double(K_(x, l)));
+            d2[i] = k == 0 ? dist : std::min(d2[i], dist);
+          }
+        });
+    }
+  }
+
+  /** Factor K(l,l) by pivoted Cholesky and keep the landmarks it reaches */
+  void factor(double tol) {
+    const unsigned m = landmark_.size();
+    std::vector<double> A(m*m);
+    for (unsigned i = 0; i < m; ++i)
+      for (unsigned j = 0; j <= i; ++j)
+        A[i*m + j] = A[j*m + i] = K_(landmark_[i], landmark_[j]);
+
+    // Column k of the factor is G[perm[i]*m + k] for the i-th pivot row
+    std::vector<double> G(m*m, 0.0);
+    std::vector<double> d(m);
+    std::vector<unsigned> perm(m);
+    for (unsigned i = 0; i < m; ++i) {
+      d[i] = A[i*m + i];
+      perm[i] = i;
+    }
+    const double dmax = m ? *std::max_element(d.begin(), d.end()) : 0;
+
+    unsigned k = 0;
+    for ( ; k < m; ++k) {
+      unsigned p = k;
+      for (unsigned i = k+1; i < m; ++i)
+        if (d[perm[i]] > d[perm[p]])
+          p = i;
+      if (!(d[perm[p]] > tol * dmax))
+        break;
+      std::swap(perm[k], perm[p]);
+      const unsigned q = perm[k];
+      const double lkk = std::sqrt(d[q]);
+      G[q*m + k] = lkk;
+      for (unsigned i = k+1; i < m; ++i) {
+        const unsigned r = perm[i];
+        double s = A[r*m + q];
+        for (unsigned j = 0; j < k; ++j)
+          s -= G[r*m + j] * G[q*m + j];
+        G[r*m + k] = s / lkk;
+        d[r] -= G[r*m + k] * G[r*m + k];
+      }
+    }
+
+    std::vector<point_type> kept(k);
+    L_.assign(k*k, 0.0);
+    for (unsigned i = 0; i < k; ++i) {
+      kept[i] = landmark_[perm[i]];
+      for (unsigned j = 0; j <= i; ++j)
+        L_[i*k + j] = G[perm[i]*m + j];
+    }
+    landmark_.swap(kept);
+  }
+};
@@ -0,0 +1,90 @@
+#pragma once
+/** @file Observables.hpp
+ * @brief Global accumulators of the results for the distributed drivers
+ *
+ * The observables are linear in the results, so each rank can sweep its own
+ * partial results (before the team reduction) and the sum over all ranks is
+ * the observable of the final result. The drivers pack the per-rank values
+ * into the reduction of the timings, so no extra pass over N or collective
+ * is needed on the master.
+ */
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+#include "numeric/Vec.hpp"
+#include "numeric/Reproducible.hpp"
+
+/** The potential part of a result */
+inline double potential(double r) {
+  return r;
+}
+/** The potential part of a (potential, field) result */
+template <typename T>
+inline T potential(const Vec<4,T>& r) {
+  return r[0];
+}
+
+/** The virial x.F of a charge @a c at @a x with result @a r.
+ * Results without a field do not contribute.
+ */
+template <typename Target>
+inline double virial(const Target&, double, double) {
+  return 0;
+}
+template <typename T>
+inline T virial(const Vec<3,T>& x, T c, const Vec<4,T>& r) {
+  return c * (x[0]*r[1] + x[1]*r[2] + x[2]*r[3]);
+}
+
+/** The potential part of an exact accumulator */
+template <typename T>
+inline auto potential(const Reproducible<T>& r) -> decltype(potential(r.get())) {
+  return potential(r.get());
+}
+/** The virial of an exact accumulator */
+template <typename Target, typename Charge, typename T>
+inline double virial(const Target& x, const Charge& c, const Reproducible<T>& r) {
+  return virial(x, c, r.get());
+}
+
+/** Global sums over the targets i */
+struct Observables {
+  double charge_sum;   //< sum_i c_i phi_i (twice the energy of a symmetric kernel)
+  double virial;       //< sum_i x_i . c_i E_i
+
+  Observables() : charge_sum(0), virial(0) {}
+
+  /** Accumulate the targets [x_first, x_last) with charges and results */
+  template <typename TargetIter, typename ChargeIter, typename ResultIter>
+  void sweep(TargetIter x_first, TargetIter x_last,
+             ChargeIter c_first, ResultIter r_first) {
+    for ( ; x_first != x_last; ++x_first, ++c_first, ++r_first) {
+      charge_sum += (*c_first) * potential(*r_first);
+      virial     += ::virial(*x_first, *c_first, *r_first);
+    }
+  }
+};
+
+/** Print the observables as the drivers do */
+inline void print_observables(const Observables& obs) {
+  printf("ChargeSum: %e\n", obs.charge_sum);
+  printf("Virial: %e\n", obs.virial);
+}
+
+/** Print the relative error of @a obs against the @a exact results */
+template <typename Target, typename Charge, typename Result,
+          typename A1, typename A2, typename A3>
+inline void print_observables_error(const Observables& obs,
+                                    const std::vector<Target,A1>& target,
+                                    const std::vector<Charge,A2>& charge,
+                                    const std::vector<Result,A3>& exact) {
+  Observables direct;
+  direct.sweep(target.begin(), target.end(), charge.begin(), exact.begin());
+  printf("ChargeSum relative error: %e\n",
+         std::abs(obs.charge_sum - direct.charge_sum) / std::abs(direct.charge_sum));
+  if (direct.virial != 0)
+    printf("Virial relative error: %e\n",
+           std::abs(obs.virial - direct.virial) / std::abs(direct.virial));
+}
@@ -7,12 +7,20 @@
 #include <iterator>
 #include <type_traits>
 #include <thread>
+#include <vector>
+#include <algorithm>
 
 #include "meta/kernel_traits.hpp"
 #include "meta/trivial_iterator.hpp"
+#include "numeric/Reproducible.hpp"
+#include "SoA.hpp"
+#include "Reduction.hpp"
+
+#include "P2PProfile.hpp"
+#include "Barrier.hpp"
 
 #if !defined(P2P_BLOCK_SIZE)
-#  define P2P_BLOCK_SIZE 32768
+#  define P2P_BLOCK_SIZE 262144
 #endif
 #if !defined(P2P_NUM_THREADS)
 #  define P2P_NUM_THREADS std::thread::hardware_concurrency()
@@ -148,6 +156,277 @@ block_eval(const Kernel& K,
   }
 }
 
+/** Reproducible sums are evaluated in tiles of this many sources and targets.
+ * Each (target, source tile) partial is summed in a fixed order in the
+ * floating point type and only then deposited in the exact accumulator, so
+ * the cost of the accumulator is amortized over a tile. The results are
+ * reproducible when all block boundaries are multiples of the tile size.
+ */
+#if !defined(P2P_REPRODUCIBLE_TILE)
+#  define P2P_REPRODUCIBLE_TILE 8
+#endif
+
+/** Asymmetric block P2P evaluation into exact accumulators */
+template <typename Kernel,
+          typename SourceIter, typename ChargeIter,
+          typename TargetIter, typename R>
+inline void
+block_eval(const Kernel& K,
+           SourceIter s_first, SourceIter s_last, ChargeIter c_first,
+           TargetIter t_first, TargetIter t_last, Reproducible<R>* r_first)
+{
+  typedef typename std::iterator_traits<TargetIter>::value_type target_type;
+  typedef typename Reproducible<R>::value_type value_type;
+
+  for ( ; t_first != t_last; ++t_first, ++r_first) {
+    const target_type& t = *t_first;
+
+    SourceIter si = s_first;
+    ChargeIter ci = c_first;
+    while (si != s_last) {
+      value_type r = value_type();
+      for (int k = 0; k != P2P_REPRODUCIBLE_TILE && si != s_last; ++k, ++si, ++ci)
+        r += K(t,*si) * (*ci);
+      *r_first += r;
+    }
+  }
+}
+
+/** Symmetric off-diagonal block P2P evaluation into exact accumulators.
+ * The partial of a target over a source tile is summed in increasing source
+ * order whichever side the target is on, matching the asymmetric evaluation.
+ */
+template <typename Kernel,
+          typename SourceIter, typename ChargeIter,
+          typename TargetIter, typename R>
+inline void
+block_eval(const Kernel& K,
+           SourceIter p1_first, SourceIter p1_last,
+           ChargeIter c1_first, Reproducible<R>* r1_first,
+           TargetIter p2_first, TargetIter p2_last,
+           ChargeIter c2_first, Reproducible<R>* r2_first)
+{
+  typedef typename Reproducible<R>::value_type value_type;
+  constexpr int TILE = P2P_REPRODUCIBLE_TILE;
+
+  for ( ; p1_first < p1_last;
+        p1_first += TILE, c1_first += TILE, r1_first += TILE) {
+    const int n1 = std::min<int>(TILE, p1_last - p1_first);
+
+    TargetIter p2j = p2_first;
+    ChargeIter c2j = c2_first;
+    Reproducible<R>* r2j = r2_first;
+    for ( ; p2j < p2_last; p2j += TILE, c2j += TILE, r2j += TILE) {
+      const int n2 = std::min<int>(TILE, p2_last - p2j);
+
+      value_type r2[TILE];
+      std::fill(r2, r2 + n2, value_type());
+      for (int i = 0; i != n1; ++i) {
+        value_type r1 = value_type();
+        for (int j = 0; j != n2; ++j)
+          symm_eval(K, p1_first[i], c1_first[i], r1, p2j[j], c2j[j], r2[j]);
+        r1_first[i] += r1;
+      }
+      for (int j = 0; j != n2; ++j)
+        r2j[j] += r2[j];
+    }
+  }
+}
+
+/** Symmetric diagonal block P2P evaluation into exact accumulators.
+ * Diagonal tiles are evaluated asymmetrically, so that every tile partial is
+ * summed in the same order as in the asymmetric evaluation.
+ */
+template <typename Kernel,
+          typename SourceIter, typename ChargeIter, typename R>
+inline void
+block_eval(const Kernel& K,
+           SourceIter p_first, SourceIter p_last,
+           ChargeIter c_first, Reproducible<R>* r_first)
+{
+  constexpr int TILE = P2P_REPRODUCIBLE_TILE;
+
+  for (int k = 0; k < p_last - p_first; k += TILE) {
+    SourceIter pk_last = p_first + std::min<int>(k + TILE, p_last - p_first);
+    // The diagonal tile
+    block_eval(K, p_first + k, pk_last, c_first + k,
+                  p_first + k, pk_last, r_first + k);
+    // The off-diagonal tiles
+    block_eval(K, p_first + k, pk_last, c_first + k, r_first + k,
+                  p_first, p_first + k, c_first, r_first);
+  }
+}
+
+/** r += sum_{l < n} K(t, s_l) * c_l over the first @a n lanes of the pack
+ * @a p with the lane hook K.eval_lanes of the kernel, see
+ * kernel/KernelSkeleton.kern
+ */
+template <typename Kernel, typename Pack, typename Target, typename Result>
+inline auto
+pack_eval(const Kernel& K, const Target& t, const Pack& p, std::size_t n,
+          Result& r, int)
+    -> decltype(K.eval_lanes(t, p.x, p.c, n, r))
+{
+  return K.eval_lanes(t, p.x, p.c, n, r);
+}
+
+/** r += sum_{l < n} K(t, s_l) * c_l over the first @a n lanes of the pack
+ * @a p, lane by lane, for kernels without the lane hook
+ */
+template <typename Kernel, typename Pack, typename Target, typename Result>
+inline void
+pack_eval(const Kernel& K, const Target& t, const Pack& p, std::size_t n,
+          Result& r, long)
+{
+  for (std::size_t l = 0; l != n; ++l)
+    r += K(t, p.source(l)) * p.c[l];
+}
+
+/** Asymmetric block P2P evaluation from the first @a ns sources of the packs
+ * [s_first, s_last). The padding lanes past them are not evaluated.
+ */
+template <typename Kernel, typename Pack,
+          typename TargetIter, typename ResultIter>
+inline void
+block_eval(const Kernel& K,
+           const Pack* s_first, const Pack* s_last, std::size_t ns,
+           TargetIter t_first, TargetIter t_last, ResultIter r_first)
+{
+  typedef typename std::iterator_traits<TargetIter>::value_type target_type;
+  typedef typename std::iterator_traits<ResultIter>::value_type result_type;
+  constexpr std::size_t W = Pack::width;
+
+  for ( ; t_first != t_last; ++t_first, ++r_first) {
+    const target_type& t = *t_first;
+    result_type r = *r_first;
+
+    std::size_t n = ns;
+    for (const Pack* p = s_first; p != s_last; ++p, n -= W)
+      pack_eval(K, t, *p, std::min(n, W), r, 0);
+
+    *r_first = r;
+  }
+}
+
+/** Asymmetric block P2P evaluation from the first @a ns sources of the packs
+ * into exact accumulators. The lanes are summed in tiles of
+ * P2P_REPRODUCIBLE_TILE as in the evaluation from iterators, so the results
+ * are bitwise those of the unpacked sources.
+ */
+template <typename Kernel, typename Pack,
+          typename TargetIter, typename R>
+inline void
+block_eval(const Kernel& K,
+           const Pack* s_first, const Pack* s_last, std::size_t ns,
+           TargetIter t_first, TargetIter t_last, Reproducible<R>* r_first)
+{
+  typedef typename std::iterator_traits<TargetIter>::value_type target_type;
+  typedef typename Reproducible<R>::value_type value_type;
+  constexpr std::size_t W = Pack::width;
+
+  for ( ; t_first != t_last; ++t_first, ++r_first) {
+    const target_type& t = *t_first;
+
+    value_type r = value_type();
+    int k = 0;
+    std::size_t n = ns;
+    for (const Pack* p = s_first; p != s_last; ++p, n -= W) {
+      for (std::size_t l = 0; l != std::min(n, W); ++l) {
+        r += K(t, p->source(l)) * p->c[l];
+        if (++k == P2P_REPRODUCIBLE_TILE) {
+          *r_first += r;
+          r = value_type();
+          k = 0;
+        }
+      }
+    }
+    if (k != 0)
+      *r_first += r;
+  }
+}
+
+/** Alignment of tile boundaries for results of type Result */
+template <typename Result>
+inline int tile_align(const Result*) {
+  return 1;
+}
+/** Tiles of exact accumulators are aligned to the reproducible tiles */
+template <typename R>
+inline int tile_align(const Reproducible<R>*) {
+  return P2P_REPRODUCIBLE_TILE;
+}
+
+/** The number of elements of a tile, such that the working set of a pair of
+ * tiles fits in P2P_BLOCK_SIZE bytes, rounded down to a multiple of @a align
+ */
+template <typename Source, typename Charge, typename Result>
+inline int tile_size(int align) {
+  const int n = P2P_BLOCK_SIZE / (2*(sizeof(Source)+sizeof(Charge)+sizeof(Result)));
+  return std::max(align, n / align * align);
+}
+
+/** Smallest group of elements worth its own worker thread */
+constexpr int P2P_MIN_GROUP = 256;
+
+/** The number of workers for ranges of @a n elements with @a threads threads */
+inline unsigned num_workers(int n, unsigned threads) {
+  return std::max(1u, std::min(threads, unsigned(n / P2P_MIN_GROUP)));
+}
+
+/** Boundaries of @a parts balanced groups of [0, @a n), aligned to @a align */
+inline std::vector<int> group_bounds(int n, unsigned parts, int align) {
+  std::vector<int> b(parts+1, n);
+  for (unsigned k = 0; k < parts; ++k)
+    b[k] = int((long long) n * k / parts) / align * align;
+  return b;
+}
+
+/** Boundaries of the tiles of at most @a tile elements of [first, last) */
+inline std::vector<int> tile_bounds(int first, int last, int tile) {
+  std::vector<int> b;
+  for ( ; first < last; first += tile)
+    b.push_back(first);
+  b.push_back(last);
+  return b;
+}
+
+/** Extract the even bits of @a z */
+inline unsigned morton_compact(unsigned long long z) {
+  z &= 0x5555555555555555ull;
+  z = (z | (z >> 1))  & 0x3333333333333333ull;
+  z = (z | (z >> 2))  & 0x0F0F0F0F0F0F0F0Full;
+  z = (z | (z >> 4))  & 0x00FF00FF00FF00FFull;
+  z = (z | (z >> 8))  & 0x0000FFFF0000FFFFull;
+  z = (z | (z >> 16)) & 0x00000000FFFFFFFFull;
+  return unsigned(z);
+}
+
+/** Call f(i,j) for the tile pairs 0 <= i < n1, 0 <= j < n2 along a Z-order
+ * curve, so consecutive pairs share a tile and most reuse the other's cache.
+ */
+template <typename F>
+inline void zorder_for_each(unsigned n1, unsigned n2, F f) {
+  unsigned long long side = 1;
+  while (side < std::max(n1, n2))
+    side <<= 1;
+  for (unsigned long long z = 0; z < side*side; ++z) {
+    const unsigned i = morton_compact(z);
+    const unsigned j = morton_compact(z >> 1);
+    if (i < n1 && j < n2)
+      f(i, j);
+  }
+}
+
+/** Run f(w) on @a workers threads, w = 0 on the calling thread */
+template <typename F>
+inline void run_workers(unsigned workers, const F& f) {
+  std::vector<std::thread> thr;
+  for (unsigned w = 1; w < workers; ++w)
+    thr.push_back(p2p_profile::spawn([&f,w](){ f(w); }));
+  f(0);
+  for (std::thread& t : thr)
+    p2p_profile::join(t);
+}
 
 /*************************************/
 /****** Dispatch Methods *************/
@@ -164,6 +443,8 @@ p2p(const Kernel& K,
     TargetIter t_first, TargetIter t_last, ResultIter r_first,
     unsigned)
 {
+  p2p_profile::Leaf leaf(std::distance(s_first, s_last) *
+                         std::distance(t_first, t_last));
   return block_eval(K,
                     s_first, s_last, c_first,
                     t_first, t_last, r_first);
@@ -181,6 +462,8 @@ p2p(const Kernel& K,
     ChargeIter c2_first, ResultIter r2_first,
     unsigned)
 {
+  p2p_profile::Leaf leaf(std::distance(p1_first, p1_last) *
+                         std::distance(p2_first, p2_last));
   return block_eval(K,
                     p1_first, p1_last,
                     c1_first, r1_first,
@@ -197,12 +480,17 @@ p2p(const Kernel& K,
     ChargeIter c_first, ResultIter r_first,
     unsigned)
 {
+  p2p_profile::Leaf leaf(std::distance(p_first, p_last) *
+                         (std::distance(p_first, p_last) + 1) / 2);
   return block_eval(K,
                     p_first, p_last,
                     c_first, r_first);
 }
 
-/** Asymmetric block P2P optimized for pointers-to-data */
+/** Asymmetric block P2P optimized for pointers-to-data.
+ * Each worker owns a balanced group of target tiles and visits its pairs
+ * with all source tiles in Z-order.
+ */
 template <typename Kernel,
           typename Source, typename Charge,
           typename Target, typename Result>
@@ -212,82 +500,111 @@ p2p(const Kernel& K,
     Target* t_first, Target* t_last, Result* r_first,
     unsigned threads = P2P_NUM_THREADS)
 {
-  const int count1 = (s_last - s_first)/2;
-  const int count2 = (t_last - t_first)/2;
+  const int align = tile_align(r_first);
+  const int tile  = tile_size<Source,Charge,Result>(align);
+  const int ns = s_last - s_first;
+  const int nt = t_last - t_first;
+
+  const unsigned workers = num_workers(nt, threads);
+  const std::vector<int> group = group_bounds(nt, workers, align);
+  const std::vector<int> s_tile = tile_bounds(0, ns, tile);
+
+  run_workers(workers, [&](unsigned w) {
+      const std::vector<int> t_tile = tile_bounds(group[w], group[w+1], tile);
+      zorder_for_each(t_tile.size()-1, s_tile.size()-1,
+                      [&](unsigned i, unsigned j) {
+          const int s0 = s_tile[j], s1 = s_tile[j+1];
+          const int t0 = t_tile[i], t1 = t_tile[i+1];
+          p2p_profile::Leaf leaf((long long)(s1 - s0) * (t1 - t0));
+          block_eval(K, s_first + s0, s_first + s1, c_first + s0,
+                        t_first + t0, t_first + t1, r_first + t0);
+        });
+    });
+}
 
-  constexpr int SC_BLOCK = P2P_BLOCK_SIZE/(2*(sizeof(Source)+sizeof(Charge)));
-  constexpr int TR_BLOCK = P2P_BLOCK_SIZE/(2*(sizeof(Target)+sizeof(Result)));
+/** Asymmetric block P2P from the first @a size sources of the packs
+ * [s_first, s_last).
+ * Each worker owns a balanced group of target tiles and visits its pairs
+ * with all source tiles in Z-order. Source tiles are whole packs.
+ */
+template <typename Kernel, typename Pack,
+          typename Target, typename Result>
+inline void
+p2p(const Kernel& K,
+    const Pack* s_first, const Pack* s_last, std::size_t size,
+    Target* t_first, Target* t_last, Result* r_first,
+    unsigned threads = P2P_NUM_THREADS)
+{
+  typedef typename Pack::source_type source_type;
+  typedef typename Pack::charge_type charge_type;
+  constexpr int W = Pack::width;
+
+  const int align = tile_align(r_first);
+  const int tile  = tile_size<source_type,charge_type,Result>(align);
+  // Source tiles of whole packs, and of whole reproducible tiles
+  const int s_tile_packs = tile_size<source_type,charge_type,Result>(W * align) / W;
+  const int ns = s_last - s_first;
+  const int nt = t_last - t_first;
+
+  const unsigned workers = num_workers(nt, threads);
+  const std::vector<int> group = group_bounds(nt, workers, align);
+  const std::vector<int> s_tile = tile_bounds(0, ns, s_tile_packs);
+
+  run_workers(workers, [&](unsigned w) {
+      const std::vector<int> t_tile = tile_bounds(group[w], group[w+1], tile);
+      zorder_for_each(t_tile.size()-1, s_tile.size()-1,
+                      [&](unsigned i, unsigned j) {
+          const int s0 = s_tile[j], s1 = s_tile[j+1];
+          const int t0 = t_tile[i], t1 = t_tile[i+1];
+          const std::size_t n = std::min<std::size_t>((s1 - s0) * W,
+                                                      size - s0 * W);
+          p2p_profile::Leaf leaf((long long) n * (t1 - t0));
+          block_eval(K, s_first + s0, s_first + s1, n,
+                        t_first + t0, t_first + t1, r_first + t0);
+        });
+    });
+}
 
-  const char flag = ((count1 > SC_BLOCK) << 1) |
-                    ((count2 > TR_BLOCK) << 0);
-  switch (flag) {
-    case 0: { // Both are small, evaluate
-      block_eval(K, s_first, s_last, c_first,
-                    t_first, t_last, r_first);
-    } break;
-    case 1: { // Split the targets
-      Target* t_half = t_first + count2;
-      Result* r_half = r_first + count2;
-
-      if (threads > 0) {
-        // In parallel
-        std::thread thr([=](){
-        p2p(K, s_first, s_last, c_first,
-               t_first, t_half, r_first, threads-1);
-          });
-        p2p(K, s_first, s_last, c_first,
-               t_half, t_last, r_half, threads-1);
-        thr.join();
-      } else {
-        p2p(K, s_first, s_last, c_first,
-               t_first, t_half, r_first, threads);
-        p2p(K, s_first, s_last, c_first,
-               t_half, t_last, r_half, threads);
-      }
-    } break;
-    case 2: { // Split the sources
-      Source* s_half = s_first + count1;
-      Charge* c_half = c_first + count1;
-
-      p2p(K, s_first, s_half, c_first,
-             t_first, t_last, r_first, threads);
-      p2p(K, s_half,  s_last, c_half,
-             t_first, t_last, r_first, threads);
-    } break;
-    case 3: { // Split both
-      Source* s_half = s_first + count1;
-      Charge* c_half = c_first + count1;
-      Target* t_half = t_first + count2;
-      Result* r_half = r_first + count2;
-
-      if (threads > 0) {
-        // Top and bottom in parallel
-        std::thread thr([=](){
-        p2p(K, s_first, s_half, c_first,
-               t_first, t_half, r_first, threads-1);
-        p2p(K, s_half,  s_last, c_half,
-               t_first, t_half, r_first, threads-1);
-          });
-        p2p(K, s_first, s_half, c_first,
-               t_half,  t_last, r_half, threads-1);
-        p2p(K, s_half, s_last, c_half,
-               t_half, t_last, r_half, threads-1);
-        thr.join();
-      } else {
-        p2p(K, s_first, s_half, c_first,
-               t_first, t_half, r_first, threads);
-        p2p(K, s_half,  s_last, c_half,
-               t_first, t_half, r_first, threads);
-        p2p(K, s_first, s_half, c_first,
-               t_half,  t_last, r_half, threads);
-        p2p(K, s_half, s_last, c_half,
-               t_half, t_last, r_half, threads);
-      }
-    } break;
-  }
+/** Asymmetric block P2P from source packs to targets that are not pointers */
+template <typename Kernel, typename Pack,
+          typename TargetIter, typename ResultIter>
+inline void
+p2p(const Kernel& K,
+    const Pack* s_first, const Pack* s_last, std::size_t size,
+    TargetIter t_first, TargetIter t_last, ResultIter r_first,
+    unsigned)
+{
+  p2p_profile::Leaf leaf(size * std::distance(t_first, t_last));
+  block_eval(K, s_first, s_last, size, t_first, t_last, r_first);
 }
 
-/** Symmetric off-diagonal block P2P optimized for pointer-to-data */
+/** Symmetric off-diagonal P2P of the tiles of [f1,l1) x [f2,l2) in Z-order */
+template <typename Kernel,
+          typename Source, typename Charge,
+          typename Target, typename Result>
+inline void
+tile_block(const Kernel& K,
+           Source* p1_first, Charge* c1_first, Result* r1_first, int f1, int l1,
+           Target* p2_first, Charge* c2_first, Result* r2_first, int f2, int l2,
+           int tile)
+{
+  const std::vector<int> tile1 = tile_bounds(f1, l1, tile);
+  const std::vector<int> tile2 = tile_bounds(f2, l2, tile);
+  zorder_for_each(tile1.size()-1, tile2.size()-1,
+                  [&](unsigned i, unsigned j) {
+      const int a0 = tile1[i], a1 = tile1[i+1];
+      const int b0 = tile2[j], b1 = tile2[j+1];
+      p2p_profile::Leaf leaf((long long)(a1 - a0) * (b1 - b0));
+      block_eval(K, p1_first + a0, p1_first + a1, c1_first + a0, r1_first + a0,
+                    p2_first + b0, p2_first + b1, c2_first + b0, r2_first + b0);
+    });
+}
+
+/** Symmetric off-diagonal block P2P optimized for pointer-to-data.
+ * Both sides are split into one balanced group per worker. In round k worker
+ * w evaluates groups (w, w+k mod G), so no two workers write the same results
+ * and each round ends with a barrier.
+ */
 template <typename Kernel,
           typename Source, typename Charge,
           typename Target, typename Result>
@@ -299,78 +616,37 @@ p2p(const Kernel& K,
     Charge* c2_first, Result* r2_first,
     unsigned threads = P2P_NUM_THREADS)
 {
-  const int count1 = (p1_last - p1_first)/2;
-  const int count2 = (p2_last - p2_first)/2;
-
-  constexpr int SC_BLOCK = P2P_BLOCK_SIZE/(2*(sizeof(Source)+sizeof(Charge)));
-  constexpr int TR_BLOCK = P2P_BLOCK_SIZE/(2*(sizeof(Target)+sizeof(Result)));
-
-  const char flag = ((count1 > SC_BLOCK) << 1) |
-                    ((count2 > TR_BLOCK) << 0);
-  switch (flag) {
-    case 0: { // Both are small, evaluate
-      block_eval(K, p1_first, p1_last, c1_first, r1_first,
-                    p2_first, p2_last, c2_first, r2_first);
-    } break;
-    case 1: { // Split the p2
-      Target* p2_half = p2_first + count2;
-      Charge* c2_half = c2_first + count2;
-      Result* r2_half = r2_first + count2;
-      p2p(K, p1_first, p1_last, c1_first, r1_first,
-             p2_first, p2_half, c2_first, r2_first, threads);
-      p2p(K, p1_first, p1_last, c1_first, r1_first,
-             p2_half,  p2_last, c2_half, r2_half, threads);
-    } break;
-    case 2: { // Split the p1
-      Source* p1_half = p1_first + count2;
-      Charge* c1_half = c1_first + count2;
-      Result* r1_half = r1_first + count2;
-      p2p(K, p1_first, p1_half, c1_first, r1_first,
-             p2_first, p2_last, c2_first, r2_first, threads);
-      p2p(K, p1_half,  p1_last, c1_half,  r1_half,
-             p2_first, p2_last, c2_first, r2_first, threads);
-    } break;
-    case 3: { // Split both
-      Source* p1_half = p1_first + count1;
-      Charge* c1_half = c1_first + count1;
-      Result* r1_half = r1_first + count1;
-      Target* p2_half = p2_first + count2;
-      Charge* c2_half = c2_first + count2;
-      Result* r2_half = r2_first + count2;
-
-      if (threads > 0) {
-        // Upper left and bottom right in parallel
-        std::thread thr1([=](){
-        p2p(K, p1_first, p1_half, c1_first, r1_first,
-               p2_first, p2_half, c2_first, r2_first, threads-1);
-          });
-        p2p(K, p1_half, p1_last, c1_half, r1_half,
-               p2_half, p2_last, c2_half, r2_half, threads-1);
-        thr1.join();
-
-        // Bottom left and top right in parallel
-        std::thread thr2([=](){
-        p2p(K, p1_half,  p1_last, c1_half,  r1_half,
-               p2_first, p2_half, c2_first, r2_first, threads-1);
-          });
-        p2p(K, p1_first, p1_half, c1_first, r1_first,
-               p2_half,  p2_last, c2_half,  r2_half, threads-1);
-        thr2.join();
-      } else {
-        p2p(K, p1_first, p1_half, c1_first, r1_first,
-               p2_first, p2_half, c2_first, r2_first, threads);
-        p2p(K, p1_half,  p1_last, c1_half,  r1_half,
-               p2_first, p2_half, c2_first, r2_first, threads);
-        p2p(K, p1_first, p1_half, c1_first, r1_first,
-               p2_half,  p2_last, c2_half,  r2_half, threads);
-        p2p(K, p1_half, p1_last, c1_half, r1_half,
-               p2_half, p2_last, c2_half, r2_half, threads);
+  const int align = tile_align(r1_first);
+  const int tile  = tile_size<Source,Charge,Result>(align);
+  const int n1 = p1_last - p1_first;
+  const int n2 = p2_last - p2_first;
+
+  const unsigned workers = num_workers(std::min(n1, n2), threads);
+  const std::vector<int> group1 = group_bounds(n1, workers, align);
+  const std::vector<int> group2 = group_bounds(n2, workers, align);
+  Barrier barrier(workers);
+
+  run_workers(workers, [&](unsigned w) {
+      for (unsigned k = 0; k < workers; ++k) {
+        const unsigned v = (w + k) % workers;
+        tile_block(K, p1_first, c1_first, r1_first, group1[w], group1[w+1],
+                      p2_first, c2_first, r2_first, group2[v], group2[v+1],
+                      tile);
+        {
+          p2p_profile::Wait wait;
+          barrier.wait();
+        }
       }
-    } break;
-  }
+    });
 }
 
-/** Symmetric diagonal block P2P optimized for pointer-to-data */
+/** Symmetric diagonal block P2P optimized for pointer-to-data.
+ * The range is split into 2G balanced groups for G workers. The first round
+ * evaluates the diagonal of every group, two per worker, and the remaining
+ * 2G-1 rounds are a round-robin tournament over the group pairs, so every
+ * round has G conflict-free pairs, one per worker. Only the upper triangle of
+ * tile pairs is evaluated.
+ */
 template <typename Kernel,
           typename Source, typename Charge, typename Result>
 inline void
@@ -379,35 +655,139 @@ p2p(const Kernel& K,
     Charge* c_first, Result* r_first,
     unsigned threads = P2P_NUM_THREADS)
 {
-  constexpr int SRC_BLOCK = P2P_BLOCK_SIZE/(2*(sizeof(Source)+sizeof(Charge)+sizeof(Result)));
-
-  const int count = (p_last - p_first)/2;
-  if (count > SRC_BLOCK) {
-    Source* p_half = p_first + count;
-    Charge* c_half = c_first + count;
-    Result* r_half = r_first + count;
-
-    if (threads > 0) {
-      // Two symmetric diagonal blocks in parallel
-      std::thread thr([=](){
-      p2p(K, p_first, p_half, c_first, r_first, threads-1);
-        });
-      p2p(K, p_half,  p_last, c_half,  r_half, threads-1);
-      thr.join();
-      // Symmetric off-diagonal block
-      p2p(K, p_first, p_half, c_first, r_first,
-             p_half,  p_last, c_half,  r_half, threads);
-    } else {
-      p2p(K, p_first, p_half, c_first, r_first, threads);
-      p2p(K, p_first, p_half, c_first, r_first,
-             p_half,  p_last, c_half,  r_half, threads);
-      p2p(K, p_half,  p_last, c_half,  r_half, threads);
-    }
-  } else {
-    block_eval(K, p_first, p_last, c_first, r_first);
+  const int align = tile_align(r_first);
+  const int tile  = tile_size<Source,Charge,Result>(align);
+  const int n = p_last - p_first;
+
+  const unsigned workers = num_workers(n/2, threads);
+  const unsigned M = 2*workers;
+  const std::vector<int> group = group_bounds(n, M, align);
+  Barrier barrier(workers);
+
+  run_workers(workers, [&](unsigned w) {
+      // The diagonal of groups 2w and 2w+1
+      for (unsigned a = 2*w; a < 2*w+2; ++a) {
+        const std::vector<int> t = tile_bounds(group[a], group[a+1], tile);
+        zorder_for_each(t.size()-1, t.size()-1,
+                        [&](unsigned i, unsigned j) {
+            if (i == j) {
+              p2p_profile::Leaf leaf((long long)(t[i+1] - t[i]) * (t[i+1] - t[i] + 1) / 2);
+              block_eval(K, p_first + t[i], p_first + t[i+1],
+                            c_first + t[i], r_first + t[i]);
+            } else if (i < j) {
+              p2p_profile::Leaf leaf((long long)(t[i+1] - t[i]) * (t[j+1] - t[j]));
+              block_eval(K, p_first + t[i], p_first + t[i+1],
+                            c_first + t[i], r_first + t[i],
+                            p_first + t[j], p_first + t[j+1],
+                            c_first + t[j], r_first + t[j]);
+            }
+          });
+      }
+      {
+        p2p_profile::Wait wait;
+        barrier.wait();
+      }
+
+      // Round-robin tournament of the M groups: M-1 rounds of M/2 pairs
+      for (unsigned k = 0; k < M-1; ++k) {
+        unsigned a, b;
+        if (w == 0) {
+          a = M-1;
+          b = k;
+        } else {
+          a = (k + w) % (M-1);
+          b = (k + (M-1) - w) % (M-1);
+        }
+        tile_block(K, p_first, c_first, r_first, group[a], group[a+1],
+                      p_first, c_first, r_first, group[b], group[b+1],
+                      tile);
+        {
+          p2p_profile::Wait wait;
+          barrier.wait();
+        }
+      }
+    });
+}
+
+/** Asymmetric block P2P evaluation with the reduction policy Reduction.
+ * The sources are numbered from @a j_first.
+ */
+template <typename Reduction, typename Kernel,
+          typename SourceIter, typename ChargeIter,
+          typename TargetIter, typename ResultIter>
+inline void
+block_reduce(const Kernel& K,
+             SourceIter s_first, SourceIter s_last, ChargeIter c_first,
+             long long j_first,
+             TargetIter t_first, TargetIter t_last, ResultIter r_first)
+{
+  typedef typename std::iterator_traits<TargetIter>::value_type target_type;
+  typedef typename std::iterator_traits<ResultIter>::value_type result_type;
+
+  for ( ; t_first != t_last; ++t_first, ++r_first) {
+    const target_type& t = *t_first;
+    result_type& r       = *r_first;
+
+    SourceIter si = s_first;
+    ChargeIter ci = c_first;
+    for (long long j = j_first; si != s_last; ++si, ++ci, ++j)
+      Reduction::apply(r, K(t,*si), *ci, j);
   }
 }
 
+/** Asymmetric block P2P with a reduction policy */
+template <typename Reduction, typename Kernel,
+          typename SourceIter, typename ChargeIter,
+          typename TargetIter, typename ResultIter>
+inline void
+p2p_reduce(const Kernel& K,
+           SourceIter s_first, SourceIter s_last, ChargeIter c_first,
+           long long j_first,
+           TargetIter t_first, TargetIter t_last, ResultIter r_first,
+           unsigned)
+{
+  p2p_profile::Leaf leaf(std::distance(s_first, s_last) *
+                         std::distance(t_first, t_last));
+  block_reduce<Reduction>(K, s_first, s_last, c_first, j_first,
+                          t_first, t_last, r_first);
+}
+
+/** Asymmetric block P2P with a reduction policy optimized for pointers-to-data.
+ * Scheduled as the sum: each worker owns a balanced group of target tiles,
+ * so no results are shared and any policy works without merging.
+ */
+template <typename Reduction, typename Kernel,
+          typename Source, typename Charge,
+          typename Target, typename Result>
+inline void
+p2p_reduce(const Kernel& K,
+           Source* s_first, Source* s_last, Charge* c_first,
+           long long j_first,
+           Target* t_first, Target* t_last, Result* r_first,
+           unsigned threads)
+{
+  const int tile = tile_size<Source,Charge,Result>(1);
+  const int ns = s_last - s_first;
+  const int nt = t_last - t_first;
+
+  const unsigned workers = num_workers(nt, threads);
+  const std::vector<int> group = group_bounds(nt, workers, 1);
+  const std::vector<int> s_tile = tile_bounds(0, ns, tile);
+
+  run_workers(workers, [&](unsigned w) {
+      const std::vector<int> t_tile = tile_bounds(group[w], group[w+1], tile);
+      zorder_for_each(t_tile.size()-1, s_tile.size()-1,
+                      [&](unsigned i, unsigned j) {
+          const int s0 = s_tile[j], s1 = s_tile[j+1];
+          const int t0 = t_tile[i], t1 = t_tile[i+1];
+          p2p_profile::Leaf leaf((long long)(s1 - s0) * (t1 - t0));
+          block_reduce<Reduction>(K, s_first + s0, s_first + s1, c_first + s0,
+                                  j_first + s0,
+                                  t_first + t0, t_first + t1, r_first + t0);
+        });
+    });
+}
+
 } // end namespace detail
 
 
@@ -427,6 +807,8 @@ p2p(const Kernel& K,
     TargetIter t_first, TargetIter t_last, ResultIter r_first,
     unsigned threads = P2P_NUM_THREADS)
 {
+  p2p_profile::Call call("asymmetric", std::distance(t_first, t_last),
+                         std::distance(s_first, s_last), threads);
   return detail::p2p(K,
                      iter_base(s_first), iter_base(s_last),
                      iter_base(c_first),
@@ -435,6 +817,28 @@ p2p(const Kernel& K,
                      threads);
 }
 
+/** Asymmetric block P2P from a blocked SoA buffer of sources, see SoA.hpp
+ * r_i += sum_j K(t_i, s_j) * c_j
+ *
+ * @param[in] s  The sources s_j and charges c_j
+ */
+template <typename Kernel, typename Pack, typename Alloc,
+          typename TargetIter, typename ResultIter>
+inline void
+p2p(const Kernel& K,
+    const SoABuffer<Pack,Alloc>& s,
+    TargetIter t_first, TargetIter t_last, ResultIter r_first,
+    unsigned threads = P2P_NUM_THREADS)
+{
+  p2p_profile::Call call("asymmetric", std::distance(t_first, t_last),
+                         s.size(), threads);
+  return detail::p2p(K,
+                     s.data(), s.data() + s.num_packs(), s.size(),
+                     iter_base(t_first), iter_base(t_last),
+                     iter_base(r_first),
+                     threads);
+}
+
 /** Symmetric off-diagonal block P2P
  * r2_i += sum_j K(p2_i, p1_j) * c1_j
  * r1_j += sum_i K(p1_j, p2_i) * c2_i
@@ -454,6 +858,8 @@ p2p(const Kernel& K,
     ChargeIter c2_first, ResultIter r2_first,
     unsigned threads = P2P_NUM_THREADS)
 {
+  p2p_profile::Call call("symmetric", std::distance(p1_first, p1_last),
+                         std::distance(p2_first, p2_last), threads);
   return detail::p2p(K,
                      iter_base(p1_first), iter_base(p1_last),
                      iter_base(c1_first), iter_base(r1_first),
@@ -475,8 +881,50 @@ p2p(const Kernel& K,
     ChargeIter c_first, ResultIter r_first,
     unsigned threads = P2P_NUM_THREADS)
 {
+  p2p_profile::Call call("diagonal", std::distance(p_first, p_last),
+                         std::distance(p_first, p_last), threads);
   return detail::p2p(K,
                      iter_base(p_first), iter_base(p_last),
                      iter_base(c_first), iter_base(r_first),
                      threads);
 }
+
+/** Asymmetric block P2P with the reduction policy R, see Reduction.hpp
+ * r_i = R(r_i, K(t_i, s_j) * c_j for all j)
+ *
+ * @param[in] j_first The index of the source s_first, e.g. its global index
+ *                    for TopKReduction
+ */
+template <typename Kernel, typename Reduction,
+          typename SourceIter, typename ChargeIter,
+          typename TargetIter, typename ResultIter>
+inline typename std::enable_if<is_reduction<Reduction>::value>::type
+p2p(const Kernel& K, const Reduction&,
+    SourceIter s_first, SourceIter s_last, ChargeIter c_first,
+    TargetIter t_first, TargetIter t_last, ResultIter r_first,
+    long long j_first = 0,
+    unsigned threads = P2P_NUM_THREADS)
+{
+  p2p_profile::Call call("reduction", std::distance(t_first, t_last),
+                         std::distance(s_first, s_last), threads);
+  return detail::p2p_reduce<Reduction>(K,
+                                       iter_base(s_first), iter_base(s_last),
+                                       iter_base(c_first), j_first,
+                                       iter_base(t_first), iter_base(t_last),
+                                       iter_base(r_first),
+                                       threads);
+}
+
+/** The sum policy is the asymmetric block P2P */
+template <typename Kernel,
+          typename SourceIter, typename ChargeIter,
+          typename TargetIter, typename ResultIter>
+inline void
+p2p(const Kernel& K, const SumReduction&,
+    SourceIter s_first, SourceIter s_last, ChargeIter c_first,
+    TargetIter t_first, TargetIter t_last, ResultIter r_first,
+    long long = 0,
+    unsigned threads = P2P_NUM_THREADS)
+{
+  return p2p(K, s_first, s_last, c_first, t_first, t_last, r_first, threads);
+}
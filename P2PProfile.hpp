@@ -0,0 +1,237 @@
+#pragma once
+/** @file P2PProfile.hpp
+ * @brief Per-worker instrumentation of the tiled P2P scheduler
+ *
+ * A p2p call runs its workers with run_workers (P2P.hpp): the calling thread
+ * is worker 0 and spawns the others, and each worker evaluates its tiles as
+ * leaves. Compile with -DP2P_TASK_PROFILE to record, for every worker of a
+ * call, the time spent in leaf evaluations (busy), creating threads (spawn),
+ * and blocked in the barriers between the rounds of the symmetric P2Ps and
+ * in join() (wait), along with the leaf and interaction counts. The rest of
+ * the life of a worker is scheduling overhead (idle). When the outermost p2p
+ * returns, a report with the load balance of the call is written to
+ * std::cerr. Without the flag every hook is a no-op.
+ */
+
+#include <thread>
+#include <utility>
+
+#if defined(P2P_TASK_PROFILE)
+#  include <atomic>
+#  include <chrono>
+#  include <deque>
+#  include <mutex>
+#  include <iostream>
+#  include <sstream>
+#  include <iomanip>
+#  include <algorithm>
+#endif
+
+namespace p2p_profile {
+
+#if defined(P2P_TASK_PROFILE)
+
+inline double now() {
+  typedef std::chrono::duration<double> units;
+  return std::chrono::duration_cast<units>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** Counters of a single worker thread */
+struct Record {
+  unsigned depth = 0;                 //< 0 for the calling thread, else 1
+  double life = 0;                    //< Lifetime of the worker
+  double busy = 0;                    //< Time in leaf evaluations
+  double spawn = 0;                   //< Time constructing child threads
+  double wait = 0;                    //< Time blocked in barriers and join()
+  unsigned long leaves = 0;
+  unsigned long long interactions = 0;
+};
+
+class Call;
+
+/** The record and call of the calling thread, if it is profiled */
+inline Record*& current_record() {
+  static thread_local Record* r = nullptr;
+  return r;
+}
+inline Call*& current_call() {
+  static thread_local Call* c = nullptr;
+  return c;
+}
+
+/** One outermost p2p call and its workers */
+class Call {
+ public:
+  Call(const char* name, std::size_t n1, std::size_t n2, unsigned threads)
+      : name_(name), n1_(n1), n2_(n2), threads_(threads),
+        alive_(0), max_alive_(0), outer_(current_call() == nullptr) {
+    if (!outer_) return;
+    current_call() = this;
+    current_record() = enter(0);
+    start_ = now();
+  }
+
+  ~Call() {
+    if (!outer_) return;
+    double wall = now() - start_;
+    current_record()->life = wall;
+    leave();
+    current_record() = nullptr;
+    current_call() = nullptr;
+    report(wall);
+  }
+
+  /** Register a new worker forked at depth @a depth */
+  Record* enter(unsigned depth) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    records_.emplace_back();
+    records_.back().depth = depth;
+    int alive = ++alive_;
+    if (alive > max_alive_) max_alive_ = alive;
+    return &records_.back();
+  }
+  void leave() { --alive_; }
+
+ private:
+  void report(double wall) const {
+    double busy = 0, spawn = 0, wait = 0, max_busy = 0;
+    unsigned long leaves = 0;
+    unsigned long long interactions = 0;
+    for (const Record& r : records_) {
+      busy  += r.busy;
+      spawn += r.spawn;
+      wait  += r.wait;
+      max_busy = std::max(max_busy, r.busy);
+      leaves += r.leaves;
+      interactions += r.interactions;
+    }
+    // Fraction of the wall time of the concurrent workers spent in leaves
+    double efficiency = (wall > 0) ? busy / (max_alive_ * wall) : 1;
+    // Busy time of the slowest worker relative to a perfect split
+    double imbalance = (busy > 0) ? max_busy * max_alive_ / busy : 1;
+
+    std::ostringstream ss;
+    ss << std::scientific << std::setprecision(3);
+    ss << "P2P " << name_ << " " << n1_ << "x" << n2_
+       << " threads=" << threads_
+       << " workers=" << records_.size()
+       << " concurrent=" << max_alive_ << "\n";
+    ss << "  Wall " << wall << "  Busy " << busy << "  Spawn " << spawn
+       << "  Wait " << wait << "  Leaves " << leaves
+       << "  Interactions " << interactions << "\n";
+    ss << "  Efficiency " << std::fixed << efficiency
+       << "  Imbalance " << imbalance << std::scientific << "\n";
+    ss << "  Worker\tDepth\tLife\tBusy\tSpawn\tWait\tIdle\tLeaves\tInteractions\n";
+    unsigned w = 0;
+    for (const Record& r : records_) {
+      ss << "  " << w++ << "\t" << r.depth << "\t" << r.life
+         << "\t" << r.busy << "\t" << r.spawn << "\t" << r.wait
+         << "\t" << std::max(0.0, r.life - r.busy - r.spawn - r.wait)
+         << "\t" << r.leaves << "\t" << r.interactions << "\n";
+    }
+
+    static std::mutex print_mutex;
+    std::lock_guard<std::mutex> lock(print_mutex);
+    std::cerr << ss.str();
+  }
+
+  const char* name_;
+  std::size_t n1_, n2_;
+  unsigned threads_;
+  std::mutex mutex_;
+  std::deque<Record> records_;     // Stable addresses for the workers
+  std::atomic<int> alive_;
+  int max_alive_;
+  bool outer_;
+  double start_;
+};
+
+/** Scoped timer of a leaf evaluation of @a interactions kernel evaluations */
+class Leaf {
+ public:
+  explicit Leaf(unsigned long long interactions)
+      : record_(current_record()), start_(now()) {
+    if (record_) {
+      ++record_->leaves;
+      record_->interactions += interactions;
+    }
+  }
+  ~Leaf() {
+    if (record_) record_->busy += now() - start_;
+  }
+ private:
+  Record* record_;
+  double start_;
+};
+
+/** Scoped timer of a worker blocked, e.g. in a barrier */
+class Wait {
+ public:
+  Wait() : record_(current_record()), start_(now()) {}
+  ~Wait() {
+    if (record_) record_->wait += now() - start_;
+  }
+ private:
+  Record* record_;
+  double start_;
+};
+
+/** Start a worker thread running @a f */
+template <typename F>
+std::thread spawn(F f) {
+  Record* parent = current_record();
+  Call* call = current_call();
+  if (!parent)
+    return std::thread(std::move(f));
+
+  unsigned depth = parent->depth + 1;
+  double start = now();
+  std::thread thr([=]() {
+      double t0 = now();
+      current_call() = call;
+      current_record() = call->enter(depth);
+      f();
+      current_record()->life = now() - t0;
+      call->leave();
+      current_record() = nullptr;
+      current_call() = nullptr;
+    });
+  parent->spawn += now() - start;
+  return thr;
+}
+
+/** Join @a thr, recording the time blocked */
+inline void join(std::thread& thr) {
+  Record* record = current_record();
+  double start = now();
+  thr.join();
+  if (record) record->wait += now() - start;
+}
+
+#else
+
+struct Call {
+  Call(const char*, std::size_t, std::size_t, unsigned) {}
+};
+
+struct Leaf {
+  explicit Leaf(unsigned long long) {}
+};
+
+struct Wait {
+  Wait() {}
+};
+
+template <typename F>
+inline std::thread spawn(F f) {
+  return std::thread(std::move(f));
+}
+
+inline void join(std::thread& thr) {
+  thr.join();
+}
+
+#endif
+
+} // end namespace p2p_profile
@@ -0,0 +1,293 @@
+#pragma once
+/** @file PairCount.hpp
+ * @brief Pair-distance histograms over the tiles of the P2P engine
+ *
+ * The reduction of pair_count() increments the bin of the separation of every
+ * pair of points instead of accumulating a kernel into a result vector, e.g.
+ * for the pair counts DD, DR, RR of two-point correlation functions. The pairs
+ * are visited by the tile scheduler of P2P.hpp, every worker counts into a
+ * private histogram, and the histograms are merged when the workers are done.
+ *
+ * Before a tile pair is visited, the bins of the smallest and largest
+ * separations of the bounding boxes of the two tiles are compared. If they
+ * are the same bin, e.g. the underflow or the overflow bin of a pair of tiles
+ * that are far apart, all pairs of the tiles are counted in one step. This
+ * only pays off for tiles of nearby points, see morton_sort.
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#include "P2P.hpp"
+
+#if !defined(PAIRCOUNT_TILE)
+#  define PAIRCOUNT_TILE 128
+#endif
+
+/** The separation bins of a pair-distance histogram.
+ *
+ * Bin 0 counts the pairs closer than rmin, bins 1..nbins split [rmin, rmax)
+ * into logarithmic (or linear) intervals and bin nbins+1 counts the pairs at
+ * rmax or farther, so the histogram of a set of pairs sums to its size.
+ */
+class PairBins {
+ public:
+  PairBins(double rmin, double rmax, unsigned nbins, bool logarithmic = true)
+      : rmin_(rmin), rmax_(rmax), nbins_(nbins), log_(logarithmic),
+        rmin2_(rmin*rmin), rmax2_(rmax*rmax),
+        scale_(logarithmic ? nbins / (2*std::log(rmax/rmin))
+                           : nbins / (rmax - rmin)) {}
+
+  /** The number of bins, with the underflow and overflow bins */
+  unsigned size() const {
+    return nbins_ + 2;
+  }
+
+  /** The bin of a pair at squared separation @a r2 */
+  unsigned bin(double r2) const {
+    if (r2 < rmin2_)
+      return 0;
+    if (!(r2 < rmax2_))
+      return nbins_ + 1;
+    const double x = log_ ? std::log(r2 / rmin2_) : std::sqrt(r2) - rmin_;
+    return 1 + std::min(nbins_ - 1, unsigned(x * scale_));
+  }
+
+  /** The lower edge of bin @a k, 1 <= k <= nbins+1 */
+  double edge(unsigned k) const {
+    const double f = double(k - 1) / nbins_;
+    return log_ ? rmin_ * std::pow(rmax_ / rmin_, f) : rmin_ + (rmax_ - rmin_) * f;
+  }
+
+ private:
+  double rmin_, rmax_;
+  unsigned nbins_;
+  bool log_;
+  double rmin2_, rmax2_;
+  double scale_;
+};
+
+/** Pair counts, indexed by the bins of a PairBins */
+typedef std::vector<unsigned long long> PairHistogram;
+
+/** Sort the points [first, last) along the Morton curve of their bounding
+ * box, so consecutive tiles have small bounding boxes. Pair counts do not
+ * depend on the order of the points.
+ */
+template <typename Point>
+void morton_sort(Point* first, Point* last) {
+  if (first == last)
+    return;
+  const unsigned D = Point::size();
+  const unsigned bits = 63 / D;
+  Point lo = *first, hi = *first;
+  for (Point* p = first; p != last; ++p)
+    for (unsigned d = 0; d != D; ++d) {
+      lo[d] = std::min(lo[d], (*p)[d]);
+      hi[d] = std::max(hi[d], (*p)[d]);
+    }
+
+  std::vector<std::pair<unsigned long long, Point>> key;
+  key.reserve(last - first);
+  for (Point* p = first; p != last; ++p) {
+    unsigned long long z = 0;
+    for (unsigned d = 0; d != D; ++d) {
+      const double w = double(hi[d]) - double(lo[d]);
+      const double u = w > 0 ? (double((*p)[d]) - double(lo[d])) / w : 0;
+      const unsigned long long q =
+          std::min((1ull << bits) - 1, (unsigned long long)(u * (1ull << bits)));
+      for (unsigned b = 0; b != bits; ++b)
+        z |= ((q >> b) & 1ull) << (D*b + d);
+    }
+    key.emplace_back(z, *p);
+  }
+  std::sort(key.begin(), key.end(),
+            [](const std::pair<unsigned long long, Point>& a,
+               const std::pair<unsigned long long, Point>& b) {
+              return a.first < b.first;
+            });
+  for (auto& k : key)
+    *first++ = k.second;
+}
+
+namespace detail {
+
+/** The bounding box of a tile of points */
+template <typename Point>
+struct TileBox {
+  Point lo, hi;
+};
+
+/** The bounding boxes of the tiles [b[k], b[k+1]) of @a p */
+template <typename Point>
+std::vector<TileBox<Point>> tile_boxes(const Point* p, const std::vector<int>& b) {
+  std::vector<TileBox<Point>> box(b.size() - 1);
+  for (unsigned k = 0; k + 1 < b.size(); ++k) {
+    TileBox<Point>& t = box[k];
+    t.lo = t.hi = p[b[k]];
+    for (int i = b[k]; i < b[k+1]; ++i)
+      for (unsigned d = 0; d != Point::size(); ++d) {
+        t.lo[d] = std::min(t.lo[d], p[i][d]);
+        t.hi[d] = std::max(t.hi[d], p[i][d]);
+      }
+  }
+  return box;
+}
+
+/** The bin of all pairs between the boxes @a a and @a b, or -1 if they may
+ * fall into different bins. The bounds are widened by a few ulps of the point
+ * type so rounding in the separations of the points can't cross a bin edge.
+ */
+template <typename Point>
+inline int box_bin(const PairBins& bins,
+                   const TileBox<Point>& a, const TileBox<Point>& b) {
+  double dmin2 = 0, dmax2 = 0;
+  for (unsigned d = 0; d != Point::size(); ++d) {
+    const double gap = std::max(0.0, std::max(double(b.lo[d]) - double(a.hi[d]),
+                                              double(a.lo[d]) - double(b.hi[d])));
+    const double span = std::max(double(b.hi[d]) - double(a.lo[d]),
+                                 double(a.hi[d]) - double(b.lo[d]));
+    dmin2 += gap * gap;
+    dmax2 += span * span;
+  }
+  const double eps = 16 * std::numeric_limits<typename Point::value_type>::epsilon();
+  const unsigned k = bins.bin(dmin2 * (1 - eps));
+  return k == bins.bin(dmax2 * (1 + eps)) ? int(k) : -1;
+}
+
+/** Count the pairs of [p1_first, p1_last) x [p2_first, p2_last) into @a h */
+template <typename Point>
+inline void
+block_count(const PairBins& bins,
+            const Point* p1_first, const Point* p1_last,
+            const Point* p2_first, const Point* p2_last,
+            unsigned long long* h)
+{
+  for ( ; p1_first != p1_last; ++p1_first) {
+    const Point& p = *p1_first;
+    for (const Point* q = p2_first; q != p2_last; ++q)
+      ++h[bins.bin(normSq(p - *q))];
+  }
+}
+
+/** Count the pairs i < j of [p_first, p_last) into @a h */
+template <typename Point>
+inline void
+block_count(const PairBins& bins,
+            const Point* p_first, const Point* p_last,
+            unsigned long long* h)
+{
+  for (const Point* p = p_first; p != p_last; ++p)
+    for (const Point* q = p_first; q != p; ++q)
+      ++h[bins.bin(normSq(*p - *q))];
+}
+
+/** Add the private histograms of the workers into @a hist */
+inline void merge_histograms(const std::vector<PairHistogram>& h,
+                             unsigned long long* hist) {
+  for (const PairHistogram& w : h)
+    for (unsigned k = 0; k < w.size(); ++k)
+      hist[k] += w[k];
+}
+
+} // end namespace detail
+
+
+/** Cross pair count
+ * hist[bins.bin(|p1_i - p2_j|^2)] += 1 for all i, j
+ *
+ * Each worker owns a balanced group of the tiles of the first range and
+ * visits its pairs with all tiles of the second range in Z-order.
+ */
+template <typename Point>
+inline void
+pair_count(const PairBins& bins,
+           const Point* p1_first, const Point* p1_last,
+           const Point* p2_first, const Point* p2_last,
+           unsigned long long* hist,
+           unsigned threads = P2P_NUM_THREADS)
+{
+  const int n1 = p1_last - p1_first;
+  const int n2 = p2_last - p2_first;
+  const int tile = PAIRCOUNT_TILE;
+
+  const std::vector<int> tile1 = detail::tile_bounds(0, n1, tile);
+  const std::vector<int> tile2 = detail::tile_bounds(0, n2, tile);
+  const auto box1 = detail::tile_boxes(p1_first, tile1);
+  const auto box2 = detail::tile_boxes(p2_first, tile2);
+
+  const unsigned workers = detail::num_workers(n1, threads);
+  const std::vector<int> group = detail::group_bounds(tile1.size()-1, workers, 1);
+  std::vector<PairHistogram> h(workers, PairHistogram(bins.size()));
+
+  detail::run_workers(workers, [&](unsigned w) {
+      unsigned long long* hw = h[w].data();
+      detail::zorder_for_each(group[w+1] - group[w], tile2.size()-1,
+                              [&](unsigned i, unsigned j) {
+          i += group[w];
+          const int a0 = tile1[i], a1 = tile1[i+1];
+          const int b0 = tile2[j], b1 = tile2[j+1];
+          const int k = detail::box_bin(bins, box1[i], box2[j]);
+          if (k >= 0) {
+            hw[k] += (unsigned long long)(a1 - a0) * (b1 - b0);
+          } else {
+            p2p_profile::Leaf leaf((long long)(a1 - a0) * (b1 - b0));
+            detail::block_count(bins, p1_first + a0, p1_first + a1,
+                                      p2_first + b0, p2_first + b1, hw);
+          }
+        });
+    });
+
+  detail::merge_histograms(h, hist);
+}
+
+/** Diagonal pair count
+ * hist[bins.bin(|p_i - p_j|^2)] += 1 for all i < j
+ *
+ * Only the upper triangle of tile pairs is visited. Worker w owns the tile
+ * rows w, w+G, w+2G, ... of the G workers, which balances the triangle.
+ */
+template <typename Point>
+inline void
+pair_count(const PairBins& bins,
+           const Point* p_first, const Point* p_last,
+           unsigned long long* hist,
+           unsigned threads = P2P_NUM_THREADS)
+{
+  const int n = p_last - p_first;
+  const int tile = PAIRCOUNT_TILE;
+
+  const std::vector<int> t = detail::tile_bounds(0, n, tile);
+  const auto box = detail::tile_boxes(p_first, t);
+  const unsigned nt = t.size() - 1;
+
+  const unsigned workers = detail::num_workers(n/2, threads);
+  std::vector<PairHistogram> h(workers, PairHistogram(bins.size()));
+
+  detail::run_workers(workers, [&](unsigned w) {
+      unsigned long long* hw = h[w].data();
+      for (unsigned i = w; i < nt; i += workers) {
+        const long long ni = t[i+1] - t[i];
+        for (unsigned j = i; j < nt; ++j) {
+          const long long nj = t[j+1] - t[j];
+          const long long pairs = i == j ? ni * (ni - 1) / 2 : ni * nj;
+          const int k = detail::box_bin(bins, box[i], box[j]);
+          if (k >= 0) {
+            hw[k] += pairs;
+          } else if (i == j) {
+            p2p_profile::Leaf leaf(pairs);
+            detail::block_count(bins, p_first + t[i], p_first + t[i+1], hw);
+          } else {
+            p2p_profile::Leaf leaf(pairs);
+            detail::block_count(bins, p_first + t[i], p_first + t[i+1],
+                                      p_first + t[j], p_first + t[j+1], hw);
+          }
+        }
+      }
+    });
+
+  detail::merge_histograms(h, hist);
+}
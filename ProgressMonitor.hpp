@@ -0,0 +1,242 @@
+#pragma once
+/** @file ProgressMonitor.hpp
+ * @brief Live progress of long distributed runs in a status file
+ *
+ * Every rank calls update() once per ring iteration with its progress so far.
+ * An update starts a nonblocking gather of the progress of all ranks to the
+ * root and tests the gathers in flight, so the loop never waits on it. On the
+ * root a thread rewrites the status file with the latest complete gather
+ * every period. The age of that gather tells a hung run from a slow one.
+ *
+ * The gather is a send from every rank and a receive per rank on the root, so
+ * the root knows which ranks a gather is waiting on: while the oldest gather
+ * in flight is incomplete the file lists the ranks that have not sent to it.
+ * Of a complete gather, the rank that reported last is the slowest.
+ *
+ * All ranks must call update() the same number of times.
+ */
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+#include <mpi.h>
+
+class ProgressMonitor {
+ public:
+  /** Monitor the ranks of @a comm into @a filename on @a root every
+   * @a period seconds. An empty @a filename disables the monitor. */
+  ProgressMonitor(const std::string& filename, int root, MPI_Comm comm,
+                  double period = 1)
+      : filename_(filename), root_(root), period_(period),
+        start_(clock::now()), last_(start_), have_snapshot_(false),
+        waiting_iteration_(0), stop_(false) {
+    if (!enabled())
+      return;
+    MPI_Comm_dup(comm, &comm_);
+    MPI_Comm_rank(comm_, &rank_);
+    MPI_Comm_size(comm_, &size_);
+    if (rank_ == root_)
+      writer_ = std::thread([this] { write_loop(); });
+  }
+
+  ~ProgressMonitor() {
+    finish();
+  }
+
+  bool enabled() const {
+    return !filename_.empty();
+  }
+
+  /** Report the progress of this rank: the ring @a iteration, the compute and
+   * communication seconds and the kernel @a interactions evaluated so far */
+  void update(int iteration, double comp, double comm, double interactions) {
+    if (!enabled())
+      return;
+    gathers_.emplace_back();
+    Gather& g = gathers_.back();
+    g.local[0] = iteration;
+    g.local[1] = comp;
+    g.local[2] = comm;
+    g.local[3] = interactions;
+    g.local[4] = seconds(clock::now() - start_);
+    if (rank_ == root_) {
+      g.all.resize(fields * size_);
+      std::copy(g.local, g.local + fields, &g.all[fields * root_]);
+      g.requests.assign(size_, MPI_REQUEST_NULL);
+      for (int r = 0; r < size_; ++r)
+        if (r != root_)
+          MPI_Irecv(&g.all[fields * r], fields, MPI_DOUBLE, r, 0, comm_,
+                    &g.requests[r]);
+    } else {
+      g.requests.resize(1);
+      MPI_Isend(g.local, fields, MPI_DOUBLE, root_, 0, comm_, &g.requests[0]);
+    }
+    test();
+  }
+
+  /** Complete the gathers in flight and write the final status */
+  void finish() {
+    if (!enabled() || stop_)
+      return;
+    while (!gathers_.empty()) {
+      Gather& g = gathers_.front();
+      MPI_Waitall(g.requests.size(), g.requests.data(), MPI_STATUSES_IGNORE);
+      complete(g);
+      gathers_.pop_front();
+    }
+    if (rank_ == root_) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      cv_.notify_one();
+      writer_.join();
+      write(true);
+    }
+    stop_ = true;
+    MPI_Comm_free(&comm_);
+  }
+
+ private:
+  typedef std::chrono::steady_clock clock;
+  static constexpr int fields = 5;
+
+  struct Gather {
+    double local[fields];
+    std::vector<double> all;
+    std::vector<MPI_Request> requests;   // Per rank on the root
+  };
+
+  static double seconds(clock::duration d) {
+    return std::chrono::duration<double>(d).count();
+  }
+
+  /** Retire the gathers that completed, in order, and note the ranks the
+   * oldest remaining one waits on */
+  void test() {
+    while (!gathers_.empty()) {
+      Gather& g = gathers_.front();
+      int count;
+      std::vector<int> index(g.requests.size());
+      MPI_Testsome(g.requests.size(), g.requests.data(), &count, index.data(),
+                   MPI_STATUSES_IGNORE);
+      if (count != MPI_UNDEFINED) {
+        std::vector<int> missing;
+        for (unsigned r = 0; r < g.requests.size(); ++r)
+          if (g.requests[r] != MPI_REQUEST_NULL)
+            missing.push_back(r);
+        if (!missing.empty()) {
+          if (rank_ == root_) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            waiting_iteration_ = int(g.local[0]);
+            waiting_.swap(missing);
+          }
+          return;
+        }
+      }
+      complete(g);
+      gathers_.pop_front();
+    }
+  }
+
+  void complete(Gather& g) {
+    if (rank_ != root_)
+      return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    snapshot_.swap(g.all);
+    last_ = clock::now();
+    have_snapshot_ = true;
+    waiting_.clear();
+  }
+
+  void write_loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+      cv_.wait_for(lock, std::chrono::duration<double>(period_));
+      if (stop_)
+        break;
+      lock.unlock();
+      write(false);
+      lock.lock();
+    }
+  }
+
+  /** Rewrite the status file, through a rename so readers see whole files */
+  void write(bool final) {
+    std::vector<double> s;
+    std::vector<int> waiting;
+    int waiting_iteration;
+    double age;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (have_snapshot_)
+        s = snapshot_;
+      waiting = waiting_;
+      waiting_iteration = waiting_iteration_;
+      age = seconds(clock::now() - last_);
+    }
+
+    const std::string tmp = filename_ + ".tmp";
+    FILE* f = std::fopen(tmp.c_str(), "w");
+    if (!f)
+      return;
+    std::fprintf(f, "State\t%s\n", final ? "finished" : "running");
+    std::fprintf(f, "Elapsed\t%.3f\n", seconds(clock::now() - start_));
+    std::fprintf(f, "SnapshotAge\t%.3f\n", age);
+    if (!waiting.empty()) {
+      std::fprintf(f, "Waiting\titeration %d on ranks", waiting_iteration);
+      for (int r : waiting)
+        std::fprintf(f, " %d", r);
+      std::fprintf(f, "\n");
+    }
+    if (!s.empty()) {
+      // The last to report to the snapshot held the others up
+      int slowest = 0;
+      double rate_sum = 0;
+      for (int r = 0; r < size_; ++r) {
+        const double* p = &s[fields * r];
+        if (p[4] > s[fields * slowest + 4])
+          slowest = r;
+        rate_sum += p[1] > 0 ? p[3] / p[1] : 0;
+      }
+      std::fprintf(f, "Slowest\t%d\n", slowest);
+      std::fprintf(f, "Interactions/s\t%e\n", rate_sum);
+      std::fprintf(f, "Rank\tIteration\tComputation\tCommunication\tInteractions/s\tReported\n");
+      for (int r = 0; r < size_; ++r) {
+        const double* p = &s[fields * r];
+        std::fprintf(f, "%d\t%d\t%e\t%e\t%e\t%.3f\n", r, int(p[0]), p[1], p[2],
+                     p[1] > 0 ? p[3] / p[1] : 0, p[4]);
+      }
+    }
+    std::fclose(f);
+    std::rename(tmp.c_str(), filename_.c_str());
+  }
+
+  std::string filename_;
+  int root_;
+  double period_;
+  MPI_Comm comm_;
+  int rank_;
+  int size_;
+
+  clock::time_point start_;
+  std::deque<Gather> gathers_;     // In flight, in the order they were started
+
+  // Shared with the writer thread on the root
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<double> snapshot_;
+  clock::time_point last_;
+  bool have_snapshot_;
+  std::vector<int> waiting_;       // Ranks the oldest gather in flight waits on
+  int waiting_iteration_;
+  bool stop_;
+  std::thread writer_;
+};
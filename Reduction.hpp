@@ -0,0 +1,153 @@
+#pragma once
+/** @file Reduction.hpp
+ * @brief Reduction policies of the P2P evaluation
+ *
+ * The default P2P accumulates r_i += sum_j K(t_i,s_j) * c_j. With a policy R,
+ * p2p(K, R, ...) instead computes r_i = R_j K(t_i,s_j) * c_j where R is
+ *   SumReduction     the sum, the default P2P itself
+ *   MinReduction     the minimum, e.g. nearest-neighbor distances
+ *   MaxReduction     the maximum, e.g. Hausdorff distances
+ *   TopKReduction    the K first values in an order and their source indices,
+ *                    e.g. k nearest neighbors or top-k similarities
+ *
+ * A policy defines, for its result type Result,
+ *   Result identity<Result>()                  the result of no sources
+ *   void apply(Result& r, v, c, j)             add the value v * c of source j
+ *   void merge(Result& a, const Result& b)     add the result b into a
+ * merge is associative and commutative, so results over disjoint sets of
+ * sources can be merged in any order, e.g. by reduce_results in Util.hpp.
+ */
+
+#include <cstddef>
+#include <limits>
+#include <functional>
+#include <type_traits>
+
+/** The K first (value, index) pairs of a set in the order of Compare.
+ * Ties in value are broken by the smaller index, so the result does not
+ * depend on the order the pairs were pushed or merged in.
+ */
+template <typename T, unsigned K, typename Compare = std::less<T>>
+struct TopK {
+  typedef T value_type;
+  static constexpr unsigned capacity = K;
+
+  T value[K];             //< The values, first to last in the order
+  long long index[K];     //< The source indices of the values
+  unsigned size = 0;      //< The number of pairs held, at most K
+
+  /** Add the pair (@a v, @a j) if it is among the K first */
+  void push(const T& v, long long j) {
+    if (size == K && !before(v, j, value[K-1], index[K-1]))
+      return;
+    unsigned k = size < K ? size++ : K-1;
+    for ( ; k > 0 && before(v, j, value[k-1], index[k-1]); --k) {
+      value[k] = value[k-1];
+      index[k] = index[k-1];
+    }
+    value[k] = v;
+    index[k] = j;
+  }
+
+  /** Add the pairs of @a b */
+  void merge(const TopK& b) {
+    for (unsigned k = 0; k < b.size; ++k)
+      push(b.value[k], b.index[k]);
+  }
+
+ private:
+  static bool before(const T& v1, long long j1, const T& v2, long long j2) {
+    Compare less;
+    return less(v1, v2) || (!less(v2, v1) && j1 < j2);
+  }
+};
+
+/** Sum of the values, see p2p */
+struct SumReduction {
+  typedef void is_reduction;
+
+  template <typename Result>
+  static Result identity() {
+    return Result();
+  }
+  template <typename Result, typename Value, typename Charge>
+  static void apply(Result& r, const Value& v, const Charge& c, long long) {
+    r += v * c;
+  }
+  template <typename Result>
+  static void merge(Result& a, const Result& b) {
+    a += b;
+  }
+};
+
+/** Minimum of the values */
+struct MinReduction {
+  typedef void is_reduction;
+
+  template <typename Result>
+  static Result identity() {
+    return std::numeric_limits<Result>::has_infinity
+        ? std::numeric_limits<Result>::infinity()
+        : std::numeric_limits<Result>::max();
+  }
+  template <typename Result, typename Value, typename Charge>
+  static void apply(Result& r, const Value& v, const Charge& c, long long) {
+    const Result x = v * c;
+    if (x < r)
+      r = x;
+  }
+  template <typename Result>
+  static void merge(Result& a, const Result& b) {
+    if (b < a)
+      a = b;
+  }
+};
+
+/** Maximum of the values */
+struct MaxReduction {
+  typedef void is_reduction;
+
+  template <typename Result>
+  static Result identity() {
+    return std::numeric_limits<Result>::has_infinity
+        ? -std::numeric_limits<Result>::infinity()
+        : std::numeric_limits<Result>::lowest();
+  }
+  template <typename Result, typename Value, typename Charge>
+  static void apply(Result& r, const Value& v, const Charge& c, long long) {
+    const Result x = v * c;
+    if (r < x)
+      r = x;
+  }
+  template <typename Result>
+  static void merge(Result& a, const Result& b) {
+    if (a < b)
+      a = b;
+  }
+};
+
+/** The K first values and their source indices in a TopK result, e.g. the
+ * smallest with std::less or the largest with std::greater
+ */
+struct TopKReduction {
+  typedef void is_reduction;
+
+  template <typename Result>
+  static Result identity() {
+    return Result();
+  }
+  template <typename Result, typename Value, typename Charge>
+  static void apply(Result& r, const Value& v, const Charge& c, long long j) {
+    r.push(v * c, j);
+  }
+  template <typename Result>
+  static void merge(Result& a, const Result& b) {
+    a.merge(b);
+  }
+};
+
+/** Whether R is a reduction policy of this file */
+template <typename R, typename _ = void>
+struct is_reduction : std::false_type {};
+template <typename R>
+struct is_reduction<R, typename R::is_reduction> : std::true_type {};
@@ -0,0 +1,148 @@
+#pragma once
+/** @file Sampled.hpp
+ * @brief Importance-sampled approximate P2P
+ *
+ * p2p_sampled estimates r_i += sum_j K(t_i,s_j) * c_j from m sources drawn
+ * with replacement for every tile of targets, with probabilities p_j that are
+ * uniform or proportional to |c_j|:
+ *   r_i += 1/m sum_k K(t_i,s_jk) * c_jk / p_jk
+ * The estimate is unbiased, and costs O(m) instead of O(N) per target. With
+ * it, v_i += the sample variance of the m terms divided by m, an unbiased
+ * estimate of the variance of the estimate; for vector results it is the
+ * trace, the expected squared norm of the error.
+ *
+ * The draws of a tile are a function of the seed and the tile alone, so the
+ * results do not depend on the number of threads. Vary the seed between calls
+ * for independent estimates.
+ */
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+
+#include "P2P.hpp"
+#include "numeric/Norm.hpp"
+#include "meta/distribution.hpp"
+
+/** How p2p_sampled draws the sources */
+enum class SampleBy {
+  uniform,   //< p_j = 1/N
+  charge     //< p_j = |c_j| / sum_k |c_k|
+};
+
+namespace detail {
+
+/** Evaluate the estimate of the targets [t_first, t_last) from the @a m
+ * sampled sources @a s with weights @a w = c/(m p)
+ */
+template <typename Kernel, typename Source, typename Charge,
+          typename TargetIter, typename ResultIter, typename VarianceIter>
+inline void
+sampled_eval(const Kernel& K, const Source* s, const Charge* w, unsigned m,
+             TargetIter t_first, TargetIter t_last,
+             ResultIter r_first, VarianceIter v_first)
+{
+  typedef typename std::iterator_traits<TargetIter>::value_type target_type;
+  typedef typename std::iterator_traits<ResultIter>::value_type result_type;
+
+  for ( ; t_first != t_last; ++t_first, ++r_first, ++v_first) {
+    const target_type& t = *t_first;
+    result_type sum = result_type();
+    double sum_sq = 0;
+    for (unsigned k = 0; k < m; ++k) {
+      const result_type x = K(t, s[k]) * w[k];
+      sum += x;
+      sum_sq += normSq(x);
+    }
+    *r_first += sum;
+    // The terms are m*x, so their sample variance over m is
+    // (m sum_sq - |sum|^2) / (m - 1)
+    if (m > 1)
+      *v_first += std::max(0.0, (m * sum_sq - normSq(sum)) / (m - 1));
+  }
+}
+
+} // end namespace detail
+
+
+/** Importance-sampled asymmetric block P2P
+ * r_i += an unbiased estimate of sum_j K(t_i, s_j) * c_j from @a m samples
+ * v_i += an estimate of the variance of that estimate
+ *
+ * Each worker owns a balanced group of target tiles, as the exact P2P.
+ *
+ * @param[in] m     The number of sources drawn per tile of targets
+ * @param[in] by    Draw the sources uniformly or by charge magnitude
+ * @param[in] seed  The seed of the draws
+ * @pre The source and charge iterators are random access
+ */
+template <typename Kernel,
+          typename SourceIter, typename ChargeIter,
+          typename TargetIter, typename ResultIter, typename VarianceIter>
+inline void
+p2p_sampled(const Kernel& K,
+            SourceIter s_first, SourceIter s_last, ChargeIter c_first,
+            TargetIter t_first, TargetIter t_last,
+            ResultIter r_first, VarianceIter v_first,
+            unsigned m, SampleBy by = SampleBy::uniform, uint64_t seed = 0,
+            unsigned threads = P2P_NUM_THREADS)
+{
+  typedef typename std::iterator_traits<SourceIter>::value_type source_type;
+  typedef typename std::iterator_traits<ChargeIter>::value_type charge_type;
+  typedef typename std::iterator_traits<ResultIter>::value_type result_type;
+
+  const std::size_t ns = std::distance(s_first, s_last);
+  const int nt = std::distance(t_first, t_last);
+  if (ns == 0 || nt == 0 || m == 0)
+    return;
+  p2p_profile::Call call("sampled", nt, m, threads);
+
+  // The cumulative |c_j| to draw by charge
+  std::vector<double> cdf;
+  if (by == SampleBy::charge) {
+    cdf.resize(ns);
+    double total = 0;
+    for (std::size_t j = 0; j < ns; ++j)
+      cdf[j] = total += std::abs(double(c_first[j]));
+    if (total == 0)
+      return;
+  }
+
+  const int tile = detail::tile_size<source_type,charge_type,result_type>(1);
+  const std::vector<int> t_tile = detail::tile_bounds(0, nt, tile);
+  const unsigned workers = detail::num_workers(nt, threads);
+  const std::vector<int> group = detail::group_bounds(t_tile.size()-1, workers, 1);
+
+  detail::run_workers(workers, [&](unsigned w) {
+      std::vector<source_type> s(m);
+      std::vector<charge_type> wt(m);
+      for (int i = group[w]; i < group[w+1]; ++i) {
+        // Draw the sources of tile i and their weights c / (m p)
+        const uint64_t key = meta::counter_key(seed, i);
+        for (unsigned k = 0; k < m; ++k) {
+          const double u = meta::counter_uniform(key, k);
+          std::size_t j;
+          double p;
+          if (by == SampleBy::charge) {
+            j = std::upper_bound(cdf.begin(), cdf.end(), u * cdf.back())
+                - cdf.begin();
+            j = std::min(j, ns - 1);
+            p = std::abs(double(c_first[j])) / cdf.back();
+          } else {
+            j = std::min(ns - 1, std::size_t(u * ns));
+            p = 1.0 / ns;
+          }
+          s[k] = s_first[j];
+          wt[k] = charge_type(c_first[j] / (m * p));
+        }
+
+        const int t0 = t_tile[i], t1 = t_tile[i+1];
+        p2p_profile::Leaf leaf((long long) m * (t1 - t0));
+        detail::sampled_eval(K, s.data(), wt.data(), m,
+                             t_first + t0, t_first + t1,
+                             r_first + t0, v_first + t0);
+      }
+    });
+}
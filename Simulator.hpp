@@ -0,0 +1,453 @@
+#pragma once
+/** @file Simulator.hpp
+ * @brief Replay the message schedules of the distributed drivers against an
+ * alpha-beta network model and a measured P2P rate.
+ *
+ * Every rank keeps a virtual clock. Computation advances a single clock,
+ * point-to-point exchanges and collectives advance the clocks of all
+ * participants to the time the slowest of them arrives plus the cost of the
+ * message. Time spent is charged to the same phases the drivers time, so the
+ * predictions can be compared directly against their output.
+ */
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+
+#include "Util.hpp"
+#include "meta/random.hpp"
+#include "IndexTransformer.hpp"
+
+/** Hockney (alpha-beta) model of the interconnect */
+struct NetworkModel {
+  double alpha;   //< Latency of a message (s)
+  double beta;    //< Inverse bandwidth (s/byte)
+
+  NetworkModel(double a = 5e-6, double b = 1e-9) : alpha(a), beta(b) {}
+
+  /** Time of a single message of @a bytes */
+  double message(double bytes) const {
+    return alpha + bytes * beta;
+  }
+  /** Time of a binomial tree broadcast of @a bytes among @a p processes */
+  double bcast(unsigned p, double bytes) const {
+    return std::ceil(std::log2(double(p))) * message(bytes);
+  }
+  /** Time of a binomial tree reduction of @a bytes among @a p processes */
+  double reduce(unsigned p, double bytes) const {
+    return bcast(p, bytes);
+  }
+  /** Time of a scatter or gather of @a bytes per process among @a p */
+  double scatter(unsigned p, double bytes) const {
+    return std::ceil(std::log2(double(p))) * alpha + (p - 1) * bytes * beta;
+  }
+};
+
+/** Rate model of the P2P evaluations */
+struct ComputeModel {
+  double asym_rate;   //< Asymmetric kernel evaluations per second
+  double symm_rate;   //< Symmetric pair evaluations per second
+
+  ComputeModel(double a = 1e8, double s = 1e8) : asym_rate(a), symm_rate(s) {}
+
+  /** Time of an asymmetric n1 x n2 block */
+  double asym(double n1, double n2) const {
+    return n1 * n2 / asym_rate;
+  }
+  /** Time of a symmetric off-diagonal n1 x n2 block */
+  double symm(double n1, double n2) const {
+    return n1 * n2 / symm_rate;
+  }
+  /** Time of a symmetric diagonal n x n block */
+  double diag(double n) const {
+    return n * (n + 1) / 2 / symm_rate;
+  }
+};
+
+/** Measure the ComputeModel rates of a kernel on this machine
+ * @param[in] K  The kernel to measure
+ * @param[in] n  The size of the blocks to evaluate
+ * @param[in] threads  The number of threads passed to p2p
+ */
+template <typename Kernel>
+ComputeModel measure_compute(const Kernel& K, unsigned n, unsigned threads = 0) {
+  typedef typename Kernel::source_type source_type;
+  typedef typename Kernel::charge_type charge_type;
+  typedef typename Kernel::result_type result_type;
+
+  std::vector<source_type> s, t;
+  std::vector<charge_type> c;
+  for (unsigned i = 0; i < n; ++i) {
+    s.push_back(meta::random<source_type>::get());
+    t.push_back(meta::random<source_type>::get());
+    c.push_back(meta::random<charge_type>::get());
+  }
+  std::vector<result_type> rs(n), rt(n);
+
+  Clock timer;
+  p2p(K, s.begin(), s.end(), c.begin(), t.begin(), t.end(), rt.begin(), threads);
+  double asym_time = timer.elapsed();
+
+  timer.start();
+  p2p(K, s.begin(), s.end(), c.begin(), rs.begin(),
+         t.begin(), t.end(), c.begin(), rt.begin(), threads);
+  double symm_time = timer.elapsed();
+
+  return ComputeModel(double(n) * n / asym_time, double(n) * n / symm_time);
+}
+
+/** The times of each phase on a rank, named as in the drivers */
+struct PhaseTimes {
+  double comp;
+  double split;
+  double shift;
+  double sendrecv;
+  double reduce;
+
+  PhaseTimes() : comp(0), split(0), shift(0), sendrecv(0), reduce(0) {}
+
+  PhaseTimes& operator+=(const PhaseTimes& b) {
+    comp += b.comp; split += b.split; shift += b.shift;
+    sendrecv += b.sendrecv; reduce += b.reduce;
+    return *this;
+  }
+  PhaseTimes& operator/=(double d) {
+    comp /= d; split /= d; shift /= d; sendrecv /= d; reduce /= d;
+    return *this;
+  }
+  /** Total communication time, as reported by the 1D drivers */
+  double comm() const {
+    return split + shift + sendrecv + reduce;
+  }
+};
+
+/** Pointer to the phase a simulated operation is charged to */
+typedef double PhaseTimes::* Phase;
+
+/** Lockstep simulation of P ranks */
+class Simulator {
+ public:
+  explicit Simulator(unsigned P) : clock_(P), times_(P) {}
+
+  unsigned size() const { return clock_.size(); }
+
+  /** Rank @a r computes for @a seconds */
+  void compute(int r, double seconds) {
+    clock_[r] += seconds;
+    times_[r].comp += seconds;
+  }
+
+  /** Every rank r exchanges with send partner dst[r] and receive partner
+   * src[r] (-1 for none) at cost[r]. Charged to @a phase if non-null.
+   */
+  void sendrecv(const std::vector<int>& dst, const std::vector<int>& src,
+                const std::vector<double>& cost, Phase phase) {
+    std::vector<double> start = clock_;
+    for (unsigned r = 0; r < size(); ++r) {
+      if (dst[r] < 0 && src[r] < 0)
+        continue;
+      double t = start[r];
+      if (dst[r] >= 0) t = std::max(t, start[dst[r]]);
+      if (src[r] >= 0) t = std::max(t, start[src[r]]);
+      // A message to oneself is a local copy
+      bool local = (dst[r] < 0 || dst[r] == int(r)) && (src[r] < 0 || src[r] == int(r));
+      t += local ? 0 : cost[r];
+      charge(r, t, phase);
+    }
+  }
+
+  /** A collective among each group of ranks at @a cost.
+   * @param[in] group  group[r] is the id of the communicator containing r,
+   *                   or -1 if r does not participate.
+   */
+  void collective(const std::vector<int>& group, double cost, Phase phase) {
+    std::vector<double> finish(size(), 0);
+    for (unsigned r = 0; r < size(); ++r)
+      if (group[r] >= 0)
+        finish[group[r]] = std::max(finish[group[r]], clock_[r]);
+    for (unsigned r = 0; r < size(); ++r)
+      if (group[r] >= 0)
+        charge(r, finish[group[r]] + cost, phase);
+  }
+
+  /** The clock of rank @a r */
+  double clock(int r) const { return clock_[r]; }
+  /** The phase times of rank @a r */
+  const PhaseTimes& times(int r) const { return times_[r]; }
+  /** The phase times averaged over all ranks, as reduced by the drivers */
+  PhaseTimes average() const {
+    PhaseTimes avg;
+    for (auto& t : times_) avg += t;
+    avg /= size();
+    return avg;
+  }
+
+ private:
+  void charge(int r, double t, Phase phase) {
+    if (phase)
+      times_[r].*phase += t - clock_[r];
+    clock_[r] = t;
+  }
+
+  std::vector<double> clock_;
+  std::vector<PhaseTimes> times_;
+};
+
+
+/** Message sizes of the drivers for a kernel */
+template <typename Kernel>
+struct MessageSizes {
+  static constexpr double source = sizeof(typename Kernel::source_type);
+  static constexpr double charge = sizeof(typename Kernel::charge_type);
+  static constexpr double result = sizeof(typename Kernel::result_type);
+};
+
+/** Replay broadcast.cpp */
+template <typename Kernel>
+Simulator simulate_broadcast(unsigned N, unsigned P,
+                             const NetworkModel& net, const ComputeModel& cpu) {
+  typedef MessageSizes<Kernel> B;
+  Simulator sim(P);
+  std::vector<int> world(P, 0);
+  const unsigned n = idiv_up(N,P);
+
+  // Broadcast N and the data, charged to communication
+  sim.collective(world, net.bcast(P, sizeof(N)), &PhaseTimes::split);
+  sim.collective(world, net.bcast(P, N * B::source), &PhaseTimes::split);
+  sim.collective(world, net.bcast(P, N * B::charge), &PhaseTimes::split);
+  for (unsigned r = 0; r < P; ++r)
+    sim.compute(r, cpu.asym(N, n));
+  sim.collective(world, net.scatter(P, n * B::result), &PhaseTimes::reduce);
+  return sim;
+}
+
+/** Replay scatter.cpp */
+template <typename Kernel>
+Simulator simulate_scatter(unsigned N, unsigned P,
+                           const NetworkModel& net, const ComputeModel& cpu) {
+  typedef MessageSizes<Kernel> B;
+  Simulator sim(P);
+  std::vector<int> world(P, 0);
+  const unsigned n = idiv_up(N,P);
+
+  sim.collective(world, net.bcast(P, sizeof(N)), &PhaseTimes::split);
+  sim.collective(world, net.scatter(P, n * B::source), &PhaseTimes::split);
+  sim.collective(world, net.scatter(P, n * B::charge), &PhaseTimes::split);
+
+  for (unsigned r = 0; r < P; ++r)
+    sim.compute(r, cpu.diag(n));
+
+  std::vector<int> dst(P), src(P);
+  for (unsigned r = 0; r < P; ++r) {
+    dst[r] = (r - 1 + P) % P;
+    src[r] = (r + 1) % P;
+  }
+  for (unsigned shift = 1; shift < P; ++shift) {
+    sim.sendrecv(dst, src, std::vector<double>(P, net.message(n * B::source)),
+                 &PhaseTimes::shift);
+    sim.sendrecv(dst, src, std::vector<double>(P, net.message(n * B::charge)),
+                 &PhaseTimes::shift);
+    for (unsigned r = 0; r < P; ++r)
+      sim.compute(r, cpu.asym(n, n));
+  }
+
+  sim.collective(world, net.scatter(P, n * B::result), &PhaseTimes::reduce);
+  return sim;
+}
+
+/** Replay teamscatter.cpp */
+template <typename Kernel>
+Simulator simulate_teamscatter(unsigned N, unsigned P, unsigned c,
+                               const NetworkModel& net, const ComputeModel& cpu) {
+  typedef MessageSizes<Kernel> B;
+  Simulator sim(P);
+  const unsigned num_teams = P / c;
+  const unsigned n = idiv_up(N,num_teams);
+
+  std::vector<int> world(P, 0), team_comm(P), row_comm(P), leaders(P, -1);
+  for (unsigned r = 0; r < P; ++r) {
+    team_comm[r] = r / c;
+    row_comm[r]  = r % c;
+    if (r % c == 0) leaders[r] = 0;
+  }
+
+  // Broadcast N and the teamsize
+  sim.collective(world, net.bcast(P, sizeof(N)), &PhaseTimes::split);
+  sim.collective(world, net.bcast(P, sizeof(c)), &PhaseTimes::split);
+  // Scatter to the team leaders (untimed in the driver)
+  sim.collective(leaders, net.scatter(num_teams, n * B::source), nullptr);
+  sim.collective(leaders, net.scatter(num_teams, n * B::charge), nullptr);
+  // Team leaders broadcast to the team
+  sim.collective(team_comm, net.bcast(c, n * B::source), &PhaseTimes::split);
+  sim.collective(team_comm, net.bcast(c, n * B::charge), &PhaseTimes::split);
+
+  // Initial offset by teamrank, and the ring shift
+  std::vector<int> dst(P), src(P);
+  auto shift = [&](int offset) {
+    for (unsigned r = 0; r < P; ++r) {
+      int team = r / c, trank = r % c;
+      dst[r] = ((team - offset + num_teams) % num_teams) * c + trank;
+      src[r] = ((team + offset + num_teams) % num_teams) * c + trank;
+    }
+    sim.sendrecv(dst, src, std::vector<double>(P, net.message(n * B::source)),
+                 &PhaseTimes::shift);
+    sim.sendrecv(dst, src, std::vector<double>(P, net.message(n * B::charge)),
+                 &PhaseTimes::shift);
+  };
+  for (unsigned r = 0; r < P; ++r) {
+    int team = r / c, trank = r % c;
+    dst[r] = ((team - trank + num_teams) % num_teams) * c + trank;
+    src[r] = ((team + trank + num_teams) % num_teams) * c + trank;
+  }
+  sim.sendrecv(dst, src, std::vector<double>(P, net.message(n * B::source)),
+               &PhaseTimes::shift);
+  sim.sendrecv(dst, src, std::vector<double>(P, net.message(n * B::charge)),
+               &PhaseTimes::shift);
+
+  int last_iter = idiv_up(P, c*c) - 1;
+  for (unsigned r = 0; r < P; ++r)
+    sim.compute(r, (r % c == 0) ? cpu.diag(n) : cpu.asym(n, n));
+
+  for (int curr_iter = 1; curr_iter <= last_iter; ++curr_iter) {
+    shift(c);
+    for (unsigned r = 0; r < P; ++r) {
+      unsigned trank = r % c;
+      if (curr_iter < last_iter
+          || (num_teams % c == 0 || trank < num_teams % c))
+        sim.compute(r, cpu.asym(n, n));
+    }
+  }
+
+  // Reduce to the team leader, gather to master (untimed in the driver)
+  sim.collective(team_comm, net.reduce(c, n * B::result), &PhaseTimes::reduce);
+  sim.collective(leaders, net.scatter(num_teams, n * B::result), nullptr);
+  return sim;
+}
+
+/** Replay symmetric.cpp */
+template <typename Kernel>
+Simulator simulate_symmetric(unsigned N, unsigned P, unsigned c,
+                             const NetworkModel& net, const ComputeModel& cpu) {
+  typedef MessageSizes<Kernel> B;
+  Simulator sim(P);
+  const unsigned num_teams = P / c;
+  const unsigned n = idiv_up(N,num_teams);
+  IndexTransformer transposer(num_teams, c);
+
+  std::vector<int> team_comm(P), leaders(P, -1);
+  for (unsigned r = 0; r < P; ++r) {
+    team_comm[r] = r / c;
+    if (r % c == 0) leaders[r] = 0;
+  }
+
+  // Scatter to the team leaders (untimed), broadcast to the team
+  sim.collective(leaders, net.scatter(num_teams, n * B::source), nullptr);
+  sim.collective(leaders, net.scatter(num_teams, n * B::charge), nullptr);
+  sim.collective(team_comm, net.bcast(c, n * B::source), &PhaseTimes::split);
+  sim.collective(team_comm, net.bcast(c, n * B::charge), &PhaseTimes::split);
+
+  std::vector<int> dst(P), src(P);
+  std::vector<double> data_cost(P, net.message(n * B::source));
+  std::vector<double> charge_cost(P, net.message(n * B::charge));
+  std::vector<double> result_cost(P, net.message(n * B::result));
+
+  // Initial offset by teamrank
+  for (unsigned r = 0; r < P; ++r) {
+    int team = r / c, trank = r % c;
+    src[r] = ((team + trank + num_teams) % num_teams) * c + trank;
+    dst[r] = ((team - trank + num_teams) % num_teams) * c + trank;
+  }
+  sim.sendrecv(dst, src, data_cost, &PhaseTimes::shift);
+  sim.sendrecv(dst, src, charge_cost, &PhaseTimes::shift);
+
+  int last_iter = idiv_up(num_teams + 1, 2*c) - 1;
+  std::vector<int> r_dst(P, -1), r_src(P, -1);
+  int i_dst;
+
+  // Zeroth iteration
+  for (unsigned r = 0; r < P; ++r) {
+    int team = r / c, trank = r % c;
+    if (trank == 0) {
+      sim.compute(r, cpu.diag(n));
+    } else {
+      std::tie(i_dst, r_dst[r]) = transposer(0, team, trank);
+      if (i_dst != last_iter) {
+        sim.compute(r, cpu.symm(n, n));
+      } else {
+        r_dst[r] = -1;
+        sim.compute(r, cpu.asym(n, n));
+      }
+    }
+  }
+
+  for (int curr_iter = 1; curr_iter <= last_iter; ++curr_iter) {
+    // Send/Recv the symmetric data from the last iteration
+    for (unsigned r = 0; r < P; ++r) {
+      int team = r / c, trank = r % c;
+      int iPrimeOffset = (trank == 0) ? 0 : 1;
+      int i_src = num_teams/c - (curr_iter-1) - iPrimeOffset;
+      std::tie(std::ignore, r_src[r]) = transposer(i_src, team, trank);
+      if (i_src == last_iter || r_src[r] == int(r))
+        r_src[r] = -1;
+    }
+    sim.sendrecv(r_dst, r_src, result_cost, &PhaseTimes::sendrecv);
+
+    // Shift data to the next process
+    for (unsigned r = 0; r < P; ++r) {
+      int team = r / c, trank = r % c;
+      src[r] = ((team + c + num_teams) % num_teams) * c + trank;
+      dst[r] = ((team - c + num_teams) % num_teams) * c + trank;
+    }
+    sim.sendrecv(dst, src, data_cost, &PhaseTimes::shift);
+    sim.sendrecv(dst, src, charge_cost, &PhaseTimes::shift);
+
+    for (unsigned r = 0; r < P; ++r) {
+      int team = r / c, trank = r % c;
+      std::tie(i_dst, r_dst[r]) = transposer(curr_iter, team, trank);
+      if (i_dst != last_iter) {
+        sim.compute(r, cpu.symm(n, n));
+      } else {
+        r_dst[r] = -1;
+        sim.compute(r, cpu.asym(n, n));
+      }
+    }
+  }
+
+  sim.collective(team_comm, net.reduce(c, n * B::result), &PhaseTimes::reduce);
+  sim.collective(leaders, net.scatter(num_teams, n * B::result), nullptr);
+  return sim;
+}
+
+/** Replay checkerboard.cpp */
+template <typename Kernel>
+Simulator simulate_checkerboard(unsigned N, unsigned P,
+                                const NetworkModel& net, const ComputeModel& cpu) {
+  typedef MessageSizes<Kernel> B;
+  Simulator sim(P);
+  const unsigned q = unsigned(std::sqrt(double(P)) + 0.5);
+  const unsigned n = idiv_up(N,q);
+
+  std::vector<int> row_comm(P), col_comm(P), first_col(P, -1), first_row(P, -1);
+  for (unsigned r = 0; r < P; ++r) {
+    row_comm[r] = r / q;
+    col_comm[r] = r % q;
+    if (r % q == 0) first_col[r] = 0;
+    if (r / q == 0) first_row[r] = 0;
+  }
+
+  // Scatters from master (untimed), then row and column broadcasts
+  sim.collective(first_col, net.scatter(q, n * B::source), nullptr);
+  sim.collective(first_row, net.scatter(q, n * B::source), nullptr);
+  sim.collective(first_row, net.scatter(q, n * B::charge), nullptr);
+  sim.collective(row_comm, net.bcast(q, n * B::source), &PhaseTimes::split);
+  sim.collective(col_comm, net.bcast(q, n * B::source), &PhaseTimes::split);
+  sim.collective(col_comm, net.bcast(q, n * B::charge), &PhaseTimes::split);
+
+  for (unsigned r = 0; r < P; ++r)
+    sim.compute(r, cpu.asym(n, n));
+
+  sim.collective(row_comm, net.reduce(q, n * B::result), &PhaseTimes::reduce);
+  sim.collective(first_col, net.scatter(q, n * B::result), nullptr);
+  return sim;
+}
@@ -0,0 +1,132 @@
+#pragma once
+/** @file SoA.hpp
+ * @brief Blocked structure-of-arrays (AoSoA) buffers of sources and charges
+ *
+ * A buffer stores its sources Vec<D,T> and charges C in packs of W: the W
+ * first coordinates, then the W second coordinates, ..., then the W charges.
+ * The coordinates of consecutive sources are contiguous, so the P2P leaf over
+ * a buffer (see P2P.hpp) streams them into the kernel without a transpose,
+ * and the buffer is a plain array of packs that is sent and received as is
+ * (see pack_mpi_type in Util.hpp).
+ *
+ * The lanes of the last pack past the size of the buffer repeat the last
+ * source with a zero charge, so every lane holds finite values. The leaves
+ * mask these padding lanes rather than rely on the zero charge, since a
+ * kernel that is infinite at the repeated source would give 0 * inf = NaN.
+ */
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include "numeric/Vec.hpp"
+
+#if !defined(SOA_WIDTH)
+#  define SOA_WIDTH 8
+#endif
+
+/** W sources of type Source and their charges of type Charge */
+template <typename Source, typename Charge, std::size_t W = SOA_WIDTH>
+struct SoAPack;
+
+template <std::size_t D, typename T, typename C, std::size_t W>
+struct SoAPack<Vec<D,T>, C, W> {
+  typedef Vec<D,T> source_type;
+  typedef C        charge_type;
+  typedef T        value_type;
+
+  static constexpr std::size_t dimension = D;
+  static constexpr std::size_t width = W;
+
+  T x[D][W];   //< x[d][l] is coordinate d of lane l
+  C c[W];      //< c[l] is the charge of lane l
+
+  source_type source(std::size_t l) const {
+    source_type s;
+    for (std::size_t d = 0; d != D; ++d)
+      s[d] = x[d][l];
+    return s;
+  }
+  void set(std::size_t l, const source_type& s, const charge_type& q) {
+    for (std::size_t d = 0; d != D; ++d)
+      x[d][l] = s[d];
+    c[l] = q;
+  }
+};
+
+/** A resizable buffer of sources and charges in packs */
+template <typename Pack, typename Alloc = std::allocator<Pack>>
+class SoABuffer {
+ public:
+  typedef Pack                        pack_type;
+  typedef typename Pack::source_type  source_type;
+  typedef typename Pack::charge_type  charge_type;
+
+  static constexpr std::size_t width = Pack::width;
+
+  explicit SoABuffer(const Alloc& a = Alloc())
+      : packs_(a), size_(0) {}
+  SoABuffer(std::size_t n, const Alloc& a)
+      : packs_(num_packs(n), Pack(), a), size_(n) {}
+
+  /** The number of sources */
+  std::size_t size() const {
+    return size_;
+  }
+  /** The number of packs holding the sources */
+  std::size_t num_packs() const {
+    return num_packs(size_);
+  }
+  /** The number of packs allocated */
+  std::size_t capacity_packs() const {
+    return packs_.size();
+  }
+
+  Pack* data() {
+    return packs_.data();
+  }
+  const Pack* data() const {
+    return packs_.data();
+  }
+
+  /** Set the size to @a n, e.g. after receiving into the packs. Storage is
+   * only ever grown. */
+  void resize(std::size_t n) {
+    if (num_packs(n) > packs_.size())
+      packs_.resize(num_packs(n));
+    size_ = n;
+  }
+
+  /** Pack the sources [s_first, s_last) and the charges from @a c_first */
+  template <typename SourceIter, typename ChargeIter>
+  void assign(SourceIter s_first, SourceIter s_last, ChargeIter c_first) {
+    resize(std::distance(s_first, s_last));
+    std::size_t i = 0;
+    for ( ; s_first != s_last; ++s_first, ++c_first, ++i)
+      packs_[i / width].set(i % width, *s_first, *c_first);
+    // Pad the last pack
+    for ( ; i % width != 0; ++i)
+      packs_[i / width].set(i % width, source(size_ - 1), charge_type(0));
+  }
+
+  source_type source(std::size_t i) const {
+    return packs_[i / width].source(i % width);
+  }
+  charge_type charge(std::size_t i) const {
+    return packs_[i / width].c[i % width];
+  }
+
+  void swap(SoABuffer& b) {
+    packs_.swap(b.packs_);
+    std::swap(size_, b.size_);
+  }
+
+ private:
+  static std::size_t num_packs(std::size_t n) {
+    return (n + width - 1) / width;
+  }
+
+  std::vector<Pack, Alloc> packs_;
+  std::size_t size_;
+};
@@ -0,0 +1,68 @@
+#pragma once
+/** @file Sparse.hpp
+ * @brief Charge sparsity in the ring drivers
+ *
+ * A source with zero charge contributes nothing to any target, so when few
+ * charges are nonzero a ring driver compacts its circulating block to the
+ * nonzero-charge sources once and shifts blocks of varying size. The targets
+ * keep all their points. Above sparse_threshold of nonzero charges the
+ * compaction saves too little and the drivers keep their dense ring.
+ *
+ * This applies to the drivers whose circulating block carries only sources,
+ * scatter and teamscatter. In symmetric the circulating block also carries
+ * the results of its points, which every point needs, charged or not.
+ */
+
+#include <iterator>
+#include <algorithm>
+
+#include <mpi.h>
+
+#include "meta/distribution.hpp"
+
+/** The largest fraction of nonzero charges for which the ring compacts */
+const double sparse_threshold = 0.5;
+
+/** Zero the charges [c_first, c_first+count) with indices first, first+1, ...
+ * with probability 1 - @a density. The choice hashes the index, so a block
+ * can be masked without the rest of the sequence.
+ */
+template <typename ChargeIter>
+void mask_charges(ChargeIter c_first, unsigned first, unsigned count,
+                  double density) {
+  for (unsigned i = first; i < first + count; ++i, ++c_first) {
+    // Uniform in [0,1) from the hash of the index
+    if ((meta::hash64(i) >> 11) * (1.0 / 9007199254740992.0) >= density)
+      *c_first = 0;
+  }
+}
+
+/** The number of nonzero charges of [c_first, c_first+n) summed over the
+ * processes of @a comm. Collective over @a comm.
+ */
+template <typename ChargeIter>
+unsigned count_nonzero(ChargeIter c_first, unsigned n, MPI_Comm comm) {
+  typedef typename std::iterator_traits<ChargeIter>::value_type charge_type;
+  unsigned nnz = n - std::count(c_first, c_first + n, charge_type(0));
+  unsigned total_nnz;
+  MPI_Allreduce(&nnz, &total_nnz, 1, MPI_UNSIGNED, MPI_SUM, comm);
+  return total_nnz;
+}
+
+/** Move the sources of [x_first, x_first+n) with nonzero charges and their
+ * charges to the front of the ranges, in order.
+ * @returns The number of nonzero-charge sources
+ */
+template <typename SourceIter, typename ChargeIter>
+unsigned compact_nonzero(SourceIter x_first, ChargeIter c_first, unsigned n) {
+  typedef typename std::iterator_traits<ChargeIter>::value_type charge_type;
+  unsigned nnz = 0;
+  for (unsigned k = 0; k < n; ++k) {
+    if (c_first[k] != charge_type(0)) {
+      x_first[nnz] = x_first[k];
+      c_first[nnz] = c_first[k];
+      ++nnz;
+    }
+  }
+  return nnz;
+}
@@ -0,0 +1,142 @@
+#pragma once
+/** @file Stream.hpp
+ * @brief Kernel sums over a sliding window of streaming sources
+ *
+ * SlidingWindow holds the last @a capacity sources of a stream in a ring
+ * buffer and the kernel sums r_i = sum_j K(t_i, s_j) c_j of a fixed set of
+ * targets over them. An update of k arriving sources expires the k oldest once
+ * the window is full, and adds the contributions of the arrivals and subtracts
+ * those of the expired sources in a single P2P of the 2k sources, the expired
+ * ones with negated charges, so an update costs O(k) per target instead of
+ * O(capacity).
+ *
+ * The rounding errors of the additions and subtractions accumulate, so every
+ * @a refresh updates the sums are recomputed from the window. The live
+ * sources are at most two contiguous segments of the ring, which the blocked
+ * P2P evaluates in place.
+ */
+
+#include <vector>
+#include <iterator>
+#include <algorithm>
+
+#include "P2P.hpp"
+
+template <typename Kernel>
+class SlidingWindow {
+ public:
+  typedef typename Kernel::source_type source_type;
+  typedef typename Kernel::charge_type charge_type;
+  typedef typename Kernel::target_type target_type;
+  typedef typename Kernel::result_type result_type;
+
+  /** An empty window of @a capacity sources, recomputed every @a refresh
+   * updates, or never if @a refresh is 0
+   */
+  SlidingWindow(const Kernel& K, std::size_t capacity, unsigned refresh)
+      : K_(K), x_(capacity), c_(capacity), head_(0), size_(0),
+        refresh_(refresh), updates_(0) {
+  }
+
+  /** Evaluate the window at the targets [first, last) from now on */
+  template <typename TargetIter>
+  void set_targets(TargetIter first, TargetIter last) {
+    t_.assign(first, last);
+    recompute();
+  }
+
+  /** Slide the window over the sources [s_first, s_last) with charges
+   * @a c_first, expiring the oldest sources beyond the capacity
+   */
+  template <typename SourceIter, typename ChargeIter>
+  void push(SourceIter s_first, SourceIter s_last, ChargeIter c_first) {
+    const std::size_t cap = capacity();
+    std::size_t k = std::distance(s_first, s_last);
+    // Only the last cap arrivals can be in the window
+    if (k > cap) {
+      std::advance(s_first, k - cap);
+      std::advance(c_first, k - cap);
+      k = cap;
+    }
+    const std::size_t expired = std::min(size_, size_ + k > cap ? size_ + k - cap : 0);
+
+    // The arrivals and the expired sources with negated charges
+    xs_.clear();
+    cs_.clear();
+    xs_.insert(xs_.end(), s_first, s_last);
+    cs_.insert(cs_.end(), c_first, c_first + k);
+    for (std::size_t e = 0; e < expired; ++e) {
+      const std::size_t j = (head_ + e) % cap;
+      xs_.push_back(x_[j]);
+      cs_.push_back(-c_[j]);
+    }
+
+    // Overwrite the expired sources and the free slots with the arrivals
+    head_ = (head_ + expired) % cap;
+    size_ -= expired;
+    for (std::size_t a = 0; a < k; ++a) {
+      const std::size_t j = (head_ + size_ + a) % cap;
+      x_[j] = xs_[a];
+      c_[j] = cs_[a];
+    }
+    size_ += k;
+
+    if (refresh_ && ++updates_ % refresh_ == 0)
+      recompute();
+    else
+      p2p(K_, xs_.begin(), xs_.end(), cs_.begin(), t_.begin(), t_.end(), r_.begin());
+  }
+
+  /** Recompute the sums from the sources of the window */
+  void recompute() {
+    r_.assign(t_.size(), result_type());
+    const std::size_t cap = capacity();
+    const std::size_t end = std::min(cap, head_ + size_);
+    p2p(K_, x_.begin() + head_, x_.begin() + end, c_.begin() + head_,
+        t_.begin(), t_.end(), r_.begin());
+    const std::size_t wrap = head_ + size_ - end;
+    p2p(K_, x_.begin(), x_.begin() + wrap, c_.begin(),
+        t_.begin(), t_.end(), r_.begin());
+  }
+
+  /** The kernel sums at the targets over the current window */
+  const std::vector<result_type>& results() const {
+    return r_;
+  }
+
+  /** The sources of the window, oldest first */
+  std::vector<source_type> sources() const {
+    std::vector<source_type> s;
+    for (std::size_t e = 0; e < size_; ++e)
+      s.push_back(x_[(head_ + e) % capacity()]);
+    return s;
+  }
+
+  /** The charges of the window, oldest first */
+  std::vector<charge_type> charges() const {
+    std::vector<charge_type> c;
+    for (std::size_t e = 0; e < size_; ++e)
+      c.push_back(c_[(head_ + e) % capacity()]);
+    return c;
+  }
+
+  std::size_t size() const {
+    return size_;
+  }
+  std::size_t capacity() const {
+    return x_.size();
+  }
+
+ private:
+  Kernel K_;
+  std::vector<target_type> t_;
+  std::vector<result_type> r_;
+  std::vector<source_type> x_;    //< Ring buffer of the window
+  std::vector<charge_type> c_;
+  std::size_t head_;              //< The oldest source of the window
+  std::size_t size_;
+  unsigned refresh_;
+  unsigned long long updates_;
+  std::vector<source_type> xs_;   //< Scratch sources and charges of an update
+  std::vector<charge_type> cs_;
+};
@@ -0,0 +1,267 @@
+#pragma once
+/** @file Treecode.hpp
+ * @brief Barnes-Hut octrees of the Laplace potential and their locally
+ * essential trees
+ *
+ * The points of a tree are sorted by their Morton keys in a global cube, so
+ * every cell is a contiguous range of the points and the cells of all ranks
+ * are cubes of the same hierarchy. Every cell carries the monopole, dipole and
+ * quadrupole moments of its charges about the center of its cube.
+ *
+ * A cell is accepted as a multipole for a box of targets if
+ *   radius < theta * distance(box, center)
+ * where radius is the largest distance of its points from the center. The
+ * locally essential tree (LET) of a tree for a remote box is the part of the
+ * tree the traversal for that box visits: accepted cells without their
+ * subtrees, and the leaves that must be opened with their points. It is a
+ * tree itself, so the remote rank evaluates it as its own tree.
+ */
+
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#include "P2P.hpp"
+#include "numeric/Vec.hpp"
+
+namespace treecode {
+
+/** Bits per dimension of the Morton keys */
+constexpr unsigned key_bits = 21;
+
+/** The Morton key of @a p in the cube of corner @a lo and side @a side */
+template <typename T>
+inline uint64_t morton_key(const Vec<3,T>& p, const Vec<3,double>& lo, double side) {
+  uint64_t key = 0;
+  for (unsigned d = 0; d != 3; ++d) {
+    const double u = (double(p[d]) - lo[d]) / side * (1u << key_bits);
+    const uint64_t q = std::min<uint64_t>((1u << key_bits) - 1,
+                                          uint64_t(std::max(0.0, u)));
+    for (unsigned b = 0; b != key_bits; ++b)
+      key |= ((q >> b) & 1u) << (3*b + d);
+  }
+  return key;
+}
+
+/** A cell of an octree or of a locally essential tree */
+template <typename T>
+struct Cell {
+  Vec<3,T> center;  //< Center of the cube, the center of the expansion
+  T radius;         //< Largest distance of a point from the center
+  T q;              //< Monopole
+  Vec<3,T> d;       //< Dipole
+  T Q[6];           //< Quadrupole xx, xy, xz, yy, yz, zz
+  int child;        //< The first of the consecutive children, or -1
+  int nchild;
+  int first, last;  //< The points of a leaf, empty if the LET cut the cell
+
+  bool is_leaf() const {
+    return child < 0;
+  }
+};
+
+/** The potential of the moments of @a C at @a t */
+template <typename T>
+inline T evaluate_multipole(const Cell<T>& C, const Vec<3,T>& t) {
+  const Vec<3,T> R = t - C.center;
+  const T invR2 = T(1) / normSq(R);
+  const T invR  = std::sqrt(invR2);
+  const T invR3 = invR * invR2;
+  const T quad = C.Q[0]*R[0]*R[0] + C.Q[3]*R[1]*R[1] + C.Q[5]*R[2]*R[2]
+      + 2 * (C.Q[1]*R[0]*R[1] + C.Q[2]*R[0]*R[2] + C.Q[4]*R[1]*R[2]);
+  const T dR = C.d[0]*R[0] + C.d[1]*R[1] + C.d[2]*R[2];
+  return C.q * invR + dR * invR3 + T(0.5) * quad * invR3 * invR2;
+}
+
+/** Whether @a C is accepted as a multipole for the targets in [lo, hi] */
+template <typename T>
+inline bool accept(const Cell<T>& C, const Vec<3,T>& lo, const Vec<3,T>& hi,
+                   double theta) {
+  double dist2 = 0;
+  for (unsigned d = 0; d != 3; ++d) {
+    const double g = std::max(0.0, std::max(double(lo[d]) - double(C.center[d]),
+                                            double(C.center[d]) - double(hi[d])));
+    dist2 += g * g;
+  }
+  return double(C.radius) * C.radius < theta * theta * dist2;
+}
+
+/** The bounding box [lo, hi] of the points [first, last) */
+template <typename T>
+inline void bounding_box(const Vec<3,T>* first, const Vec<3,T>* last,
+                         Vec<3,T>& lo, Vec<3,T>& hi) {
+  for (unsigned d = 0; d != 3; ++d) {
+    lo[d] =  std::numeric_limits<T>::max();
+    hi[d] = -std::numeric_limits<T>::max();
+  }
+  for ( ; first != last; ++first)
+    for (unsigned d = 0; d != 3; ++d) {
+      lo[d] = std::min(lo[d], (*first)[d]);
+      hi[d] = std::max(hi[d], (*first)[d]);
+    }
+}
+
+namespace detail {
+
+/** Set the moments and radius of cell @a C from its points */
+template <typename T>
+void compute_moments(Cell<T>& C, const Vec<3,T>* x, const T* c) {
+  C.q = 0;
+  C.d = Vec<3,T>(0, 0, 0);
+  std::fill(C.Q, C.Q + 6, T(0));
+  T r2 = 0;
+  for (int i = C.first; i < C.last; ++i) {
+    const Vec<3,T> s = x[i] - C.center;
+    const T s2 = normSq(s);
+    r2 = std::max(r2, s2);
+    C.q += c[i];
+    C.d += c[i] * s;
+    C.Q[0] += c[i] * (3*s[0]*s[0] - s2);
+    C.Q[1] += c[i] * (3*s[0]*s[1]);
+    C.Q[2] += c[i] * (3*s[0]*s[2]);
+    C.Q[3] += c[i] * (3*s[1]*s[1] - s2);
+    C.Q[4] += c[i] * (3*s[1]*s[2]);
+    C.Q[5] += c[i] * (3*s[2]*s[2] - s2);
+  }
+  C.radius = std::sqrt(r2);
+}
+
+template <typename T>
+void build_cell(std::vector<Cell<T>>& cell, int k, unsigned level, double half,
+                const Vec<3,T>* x, const T* c, const uint64_t* key, int ncrit) {
+  compute_moments(cell[k], x, c);
+  const int first = cell[k].first, last = cell[k].last;
+  if (last - first <= ncrit || level == key_bits)
+    return;
+
+  // The octants of the points, in order since the points are sorted by key
+  const unsigned shift = 3 * (key_bits - 1 - level);
+  int bound[9];
+  bound[0] = first;
+  for (unsigned o = 1; o <= 8; ++o)
+    bound[o] = std::partition_point(key + bound[o-1], key + last,
+                                    [&](uint64_t z) { return ((z >> shift) & 7) < o; })
+        - key;
+
+  const int child = cell.size();
+  int nchild = 0;
+  for (unsigned o = 0; o < 8; ++o) {
+    if (bound[o] == bound[o+1])
+      continue;
+    Cell<T> C;
+    for (unsigned d = 0; d != 3; ++d)
+      C.center[d] = cell[k].center[d] + ((o >> d) & 1 ? half : -half) / 2;
+    C.child = -1;
+    C.nchild = 0;
+    C.first = bound[o];
+    C.last = bound[o+1];
+    cell.push_back(C);
+    ++nchild;
+  }
+  cell[k].child = child;
+  cell[k].nchild = nchild;
+  for (int j = 0; j < nchild; ++j)
+    build_cell(cell, child + j, level + 1, half / 2, x, c, key, ncrit);
+}
+
+/** Copy cell @a k of @a cell into slot @a o of the LET for [lo, hi] */
+template <typename T>
+void extract_cell(const std::vector<Cell<T>>& cell, int k,
+                  const Vec<3,T>* x, const T* c,
+                  const Vec<3,T>& lo, const Vec<3,T>& hi, double theta,
+                  std::vector<Cell<T>>& out, int o,
+                  std::vector<Vec<3,T>>& ox, std::vector<T>& oc) {
+  const Cell<T>& C = cell[k];
+  out[o] = C;
+  out[o].child = -1;
+  out[o].nchild = 0;
+  out[o].first = out[o].last = ox.size();
+  if (accept(C, lo, hi, theta))
+    return;
+  if (C.is_leaf()) {
+    ox.insert(ox.end(), x + C.first, x + C.last);
+    oc.insert(oc.end(), c + C.first, c + C.last);
+    out[o].last = ox.size();
+    return;
+  }
+  const int child = out.size();
+  out.resize(child + C.nchild);
+  out[o].child = child;
+  out[o].nchild = C.nchild;
+  for (int j = 0; j < C.nchild; ++j)
+    extract_cell(cell, C.child + j, x, c, lo, hi, theta, out, child + j, ox, oc);
+}
+
+} // end namespace detail
+
+/** Build the octree of the @a n points @a x with charges @a c and Morton keys
+ * @a key, sorted by key, in the cube of corner @a lo and side @a side. Cells
+ * of at most @a ncrit points are leaves. The root is cell 0.
+ */
+template <typename T>
+std::vector<Cell<T>> build(const Vec<3,T>* x, const T* c, const uint64_t* key,
+                           int n, const Vec<3,double>& lo, double side,
+                           int ncrit) {
+  std::vector<Cell<T>> cell;
+  if (n == 0)
+    return cell;
+  Cell<T> root;
+  for (unsigned d = 0; d != 3; ++d)
+    root.center[d] = lo[d] + side / 2;
+  root.child = -1;
+  root.nchild = 0;
+  root.first = 0;
+  root.last = n;
+  cell.push_back(root);
+  detail::build_cell(cell, 0, 0, side / 2, x, c, key, ncrit);
+  return cell;
+}
+
+/** Append the locally essential tree of the tree @a cell of the points @a x
+ * and charges @a c for the targets in [lo, hi] to @a out, and its points to
+ * @a ox and @a oc. The cells index the points from the sizes of @a ox and
+ * @a oc on entry, and the children from the size of @a out on entry.
+ */
+template <typename T>
+void extract_let(const std::vector<Cell<T>>& cell,
+                 const Vec<3,T>* x, const T* c,
+                 const Vec<3,T>& lo, const Vec<3,T>& hi, double theta,
+                 std::vector<Cell<T>>& out,
+                 std::vector<Vec<3,T>>& ox, std::vector<T>& oc) {
+  if (cell.empty())
+    return;
+  const int root = out.size();
+  out.resize(root + 1);
+  detail::extract_cell(cell, 0, x, c, lo, hi, theta, out, root, ox, oc);
+}
+
+/** Add the potential of the tree @a cell of the points @a x and charges @a c
+ * at the @a nt targets @a t in [lo, hi] to @a r. Opened leaves are evaluated
+ * with the kernel @a K by the P2P, accepted cells by their moments.
+ */
+template <typename Kernel, typename T, typename Result>
+void evaluate(const Kernel& K, const Cell<T>* cell,
+              const Vec<3,T>* x, const T* c,
+              const Vec<3,T>* t, int nt, const Vec<3,T>& lo, const Vec<3,T>& hi,
+              Result* r, double theta) {
+  std::vector<int> stack(1, 0);
+  while (!stack.empty()) {
+    const Cell<T>& C = cell[stack.back()];
+    stack.pop_back();
+    // A cell the LET cut was accepted for a box that contains [lo, hi]
+    const bool cut = C.is_leaf() && C.first == C.last;
+    if (cut || accept(C, lo, hi, theta)) {
+      for (int i = 0; i < nt; ++i)
+        r[i] += evaluate_multipole(C, t[i]);
+    } else if (C.is_leaf()) {
+      ::detail::p2p(K, x + C.first, x + C.last, c + C.first, t, t + nt, r, 1u);
+    } else {
+      for (int j = 0; j < C.nchild; ++j)
+        stack.push_back(C.child + j);
+    }
+  }
+}
+
+} // end namespace treecode
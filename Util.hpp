@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdlib>
+#include <cstddef>
 #include <iostream>
 #include <sstream>
 #include <fstream>
@@ -13,11 +14,15 @@
 #include <numeric>
 #include <algorithm>
 #include <chrono>
+#include <mutex>
+#include <condition_variable>
 
 #include <mpi.h>
 
 #include "P2P.hpp"
+#include "Barrier.hpp"
 #include "numeric/Norm.hpp"
+#include "numeric/Reproducible.hpp"
 
 /** Integer divide, rounded up
  * @param[in] a Numerator
@@ -137,9 +142,9 @@ inline T string_to_(const std::string& s) {
   return val;
 }
 
-template <typename result_type>
-void print_error(const std::vector<result_type>& exact,
-                 const std::vector<result_type>& result) {
+template <typename result_type, typename A1, typename A2>
+void print_error(const std::vector<result_type,A1>& exact,
+                 const std::vector<result_type,A2>& result) {
   assert(exact.size() == result.size());
 
   double tot_error_sq = 0;
@@ -168,4 +173,256 @@ void print_error(const std::vector<result_type>& exact,
   std::cout << "Maximum relative error: " << max_ind_rel_err << std::endl;
 }
 
+/** The floating point type of the drivers, float with NBODY_SINGLE */
+#if defined(NBODY_SINGLE)
+typedef float  real_type;
+#else
+typedef double real_type;
+#endif
+
+/** The MPI datatype of a floating point type */
+template <typename T>
+struct mpi_type;
+template <>
+struct mpi_type<double> {
+  static MPI_Datatype value() { return MPI_DOUBLE; }
+};
+template <>
+struct mpi_type<float> {
+  static MPI_Datatype value() { return MPI_FLOAT; }
+};
+
+/** The MPI datatype of a pack of sources and charges, see SoA.hpp: the D*W
+ * coordinates followed by the W charges. Committed on first use, after
+ * MPI_Init.
+ */
+template <typename Pack>
+MPI_Datatype pack_mpi_type() {
+  static MPI_Datatype type = [] {
+    typedef typename Pack::value_type  value_type;
+    typedef typename Pack::charge_type charge_type;
+    int length[] = {int(Pack::dimension * Pack::width), int(Pack::width)};
+    MPI_Aint disp[] = {offsetof(Pack, x), offsetof(Pack, c)};
+    MPI_Datatype types[] = {mpi_type<value_type>::value(),
+                            mpi_type<charge_type>::value()};
+    MPI_Datatype s, t;
+    MPI_Type_create_struct(2, length, disp, types, &s);
+    MPI_Type_create_resized(s, 0, sizeof(Pack), &t);
+    MPI_Type_commit(&t);
+    MPI_Type_free(&s);
+    return t;
+  }();
+  return type;
+}
+
+/** Tag of the precision of @a T in the names of the result files */
+inline std::string precision_tag(double) {
+  return "";
+}
+inline std::string precision_tag(float) {
+  return "_float";
+}
+
+/** Sum the result blocks @a in of the processes of @a comm into @a out on @a root */
+template <typename T, typename A1, typename A2>
+void reduce_results(const std::vector<T,A1>& in, std::vector<T,A2>& out,
+                    int root, MPI_Comm comm) {
+  MPI_Reduce(in.data(), out.data(), in.size(), mpi_type<T>::value(),
+             MPI_SUM, root, comm);
+}
+
+/** Sum the exact accumulators @a in of the processes of @a comm and round
+ * them into @a out on @a root. The sum is independent of the process order.
+ */
+template <typename T, typename A1, typename A2>
+void reduce_results(const std::vector<Reproducible<T>,A1>& in, std::vector<T,A2>& out,
+                    int root, MPI_Comm comm) {
+  const int L = Reproducible<T>::limbs;
+  std::vector<int64_t> limbs(L * in.size());
+  for (unsigned k = 0; k < in.size(); ++k)
+    in[k].to_limbs(&limbs[L*k]);
+
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  std::vector<int64_t> sum(rank == root ? limbs.size() : 0);
+  MPI_Reduce(limbs.data(), sum.data(), limbs.size(), MPI_INT64_T,
+             MPI_SUM, root, comm);
+
+  if (rank == root) {
+    Reproducible<T> acc;
+    for (unsigned k = 0; k < in.size(); ++k) {
+      acc.from_limbs(&sum[L*k]);
+      out[k] = acc.get();
+    }
+  }
+}
+
+/** Sum the result blocks @a r of the processes of @a comm in place on @a root */
+template <typename T, typename A>
+void reduce_results(std::vector<T,A>& r, int root, MPI_Comm comm) {
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Reduce(rank == root ? MPI_IN_PLACE : r.data(), r.data(), r.size(),
+             mpi_type<T>::value(), MPI_SUM, root, comm);
+}
+
+/** Sum the exact accumulators @a r of the processes of @a comm in place on @a root */
+template <typename T, typename A>
+void reduce_results(std::vector<Reproducible<T>,A>& r, int root, MPI_Comm comm) {
+  const int L = Reproducible<T>::limbs;
+  std::vector<int64_t> limbs(L * r.size());
+  for (unsigned k = 0; k < r.size(); ++k)
+    r[k].to_limbs(&limbs[L*k]);
+
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Reduce(rank == root ? MPI_IN_PLACE : limbs.data(), limbs.data(),
+             limbs.size(), MPI_INT64_T, MPI_SUM, root, comm);
+
+  if (rank == root)
+    for (unsigned k = 0; k < r.size(); ++k)
+      r[k].from_limbs(&limbs[L*k]);
+}
+
+/** Sum the full-length result vectors @a in of the P processes of @a comm and
+ * scatter block k of @a out.size() elements of the sum to process k
+ */
+template <typename T, typename A1, typename A2>
+void reduce_scatter_results(const std::vector<T,A1>& in, std::vector<T,A2>& out,
+                            MPI_Comm comm) {
+  MPI_Reduce_scatter_block(in.data(), out.data(), out.size(),
+                           mpi_type<T>::value(), MPI_SUM, comm);
+}
+
+/** Sum the full-length exact accumulators @a in of the P processes of @a comm
+ * and scatter block k of @a out.size() elements of the sum to process k
+ */
+template <typename T, typename A1, typename A2>
+void reduce_scatter_results(const std::vector<Reproducible<T>,A1>& in,
+                            std::vector<Reproducible<T>,A2>& out,
+                            MPI_Comm comm) {
+  const int L = Reproducible<T>::limbs;
+  std::vector<int64_t> limbs(L * in.size());
+  for (unsigned k = 0; k < in.size(); ++k)
+    in[k].to_limbs(&limbs[L*k]);
+
+  std::vector<int64_t> sum(L * out.size());
+  MPI_Reduce_scatter_block(limbs.data(), sum.data(), sum.size(),
+                           MPI_INT64_T, MPI_SUM, comm);
+  for (unsigned k = 0; k < out.size(); ++k)
+    out[k].from_limbs(&sum[L*k]);
+}
+
+/** The MPI datatype of the bytes of a T. Committed on first use, after MPI_Init. */
+template <typename T>
+MPI_Datatype bytes_mpi_type() {
+  static MPI_Datatype type = [] {
+    MPI_Datatype t;
+    MPI_Type_contiguous(sizeof(T), MPI_BYTE, &t);
+    MPI_Type_commit(&t);
+    return t;
+  }();
+  return type;
+}
+
+/** inout[k] = Reduction::merge(inout[k], in[k]) as an MPI_User_function */
+template <typename Reduction, typename T>
+void reduction_mpi_merge(void* in, void* inout, int* len, MPI_Datatype*) {
+  const T* a = static_cast<const T*>(in);
+  T* b = static_cast<T*>(inout);
+  for (int k = 0; k < *len; ++k)
+    Reduction::merge(b[k], a[k]);
+}
+
+/** The MPI_Op merging T's with the policy Reduction, see Reduction.hpp.
+ * Created on first use, after MPI_Init.
+ */
+template <typename Reduction, typename T>
+MPI_Op reduction_mpi_op() {
+  static MPI_Op op = [] {
+    MPI_Op o;
+    MPI_Op_create(&reduction_mpi_merge<Reduction,T>, 1, &o);
+    return o;
+  }();
+  return op;
+}
+
+/** Merge the result blocks @a r of the processes of @a comm in place on
+ * @a root with the reduction policy Reduction
+ */
+template <typename Reduction, typename T, typename A>
+typename std::enable_if<is_reduction<Reduction>::value>::type
+reduce_results(std::vector<T,A>& r, int root, MPI_Comm comm, const Reduction&) {
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Reduce(rank == root ? MPI_IN_PLACE : r.data(), r.data(), r.size(),
+             bytes_mpi_type<T>(), reduction_mpi_op<Reduction,T>(), root, comm);
+}
+/** The sum policy is the sum of the results */
+template <typename T, typename A>
+void reduce_results(std::vector<T,A>& r, int root, MPI_Comm comm, const SumReduction&) {
+  reduce_results(r, root, comm);
+}
+
+/** The type results are accumulated in, exact with NBODY_REPRODUCIBLE */
+template <typename T>
+struct accumulator {
+#if defined(NBODY_REPRODUCIBLE)
+  typedef Reproducible<T> type;
+#else
+  typedef T type;
+#endif
+};
+
+/** Round an accumulated result to its value type */
+template <typename T>
+inline T round_result(T r) {
+  return r;
+}
+template <typename T>
+inline T round_result(const Reproducible<T>& r) {
+  return r.get();
+}
+
+/** Round accumulated results to their value type */
+template <typename T>
+inline const std::vector<T>& round_results(const std::vector<T>& r) {
+  return r;
+}
+template <typename T>
+std::vector<T> round_results(const std::vector<Reproducible<T>>& r) {
+  std::vector<T> out;
+  out.reserve(r.size());
+  for (auto& a : r)
+    out.push_back(a.get());
+  return out;
+}
+
+/** FNV-1a hash of the bits of @a v, to compare results across runs */
+template <typename T, typename A>
+uint64_t checksum(const std::vector<T,A>& v) {
+  uint64_t hash = 14695981039346656037ull;
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(v.data());
+  for (std::size_t k = 0; k < v.size() * sizeof(T); ++k)
+    hash = (hash ^ bytes[k]) * 1099511628211ull;
+  return hash;
+}
+
+/** With NBODY_REPRODUCIBLE, print the checksum of the results. The results
+ * are only independent of the partition if the blocks of @a block elements
+ * are aligned to the P2P tiles.
+ */
+template <typename T, typename A>
+void print_checksum(const std::vector<T,A>& result, std::size_t block) {
+#if defined(NBODY_REPRODUCIBLE)
+  printf("Result checksum: %016llx\n", (unsigned long long) checksum(result));
+  if (block % P2P_REPRODUCIBLE_TILE != 0)
+    printf("Warning: block size %zu is not a multiple of P2P_REPRODUCIBLE_TILE=%d,"
+           " the checksum depends on the partition\n",
+           block, P2P_REPRODUCIBLE_TILE);
+#else
+  (void) result; (void) block;
+#endif
+}
+
 #define MASTER 0
@@ -0,0 +1,272 @@
+#include "Util.hpp"
+#include "CommProfile.hpp"
+#include "Adjoint.hpp"
+
+#include "kernel/Yukawa.kern"
+#include "kernel/Gaussian.kern"
+#include "kernel/NonParaBayesian.kern"
+#include "meta/random.hpp"
+#include "meta/distribution.hpp"
+
+// Ring version of the adjoint P2P
+//
+// Every process owns a block of the points, which are both the sources and
+// the targets, their charges, and the upstream gradients g = dL/dr of the
+// results of the forward P2P. The source blocks circulate around the ring with
+// their position and charge gradients and return home after P shifts, while
+// the target gradients and the parameter gradient stay on their process.
+
+/** The source of a kernel from a point of a distribution */
+inline void from_point(const Vec<3,double>& p, double& s) {
+  s = p[0];
+}
+template <typename T>
+inline void from_point(const Vec<3,double>& p, Vec<3,T>& s) {
+  for (unsigned d = 0; d != 3; ++d)
+    s[d] = p[d];
+}
+
+template <typename Kernel>
+void run(const Kernel& K, unsigned N, const std::string& dist, bool checkErrors) {
+  typedef typename Kernel::source_type source_type;
+  typedef typename Kernel::charge_type charge_type;
+  typedef typename Kernel::result_type result_type;
+  typedef typename Kernel::param_type  param_type;
+  typedef typename param_type::value_type param_value_type;
+
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  int P;
+  MPI_Comm_size(MPI_COMM_WORLD, &P);
+
+  const int seed = 1337;
+
+  std::vector<source_type> source;
+  std::vector<charge_type> charge;
+  std::vector<result_type> grad;
+  if (rank == MASTER) {
+    // generate source data
+    std::vector<Vec<3,double>> point;
+    meta::default_generator.seed(seed);
+    meta::distribution_block<Vec<3,double>>(dist, seed, 0, N, N,
+                                            std::back_inserter(point));
+    source.resize(N);
+    for (unsigned i = 0; i < N; ++i)
+      from_point(point[i], source[i]);
+
+    // generate charge data and the upstream gradients
+    for (unsigned i = 0; i < N; ++i)
+      charge.push_back(meta::random<charge_type>::get());
+    for (unsigned i = 0; i < N; ++i)
+      grad.push_back(meta::random<result_type>::get());
+  }
+
+  Clock timer;
+  Clock commTimer;
+  Clock compTimer;
+
+  double totalCommTime = 0;
+  double totalCompTime = 0;
+
+  timer.start();
+
+  // Scatter the data to all processes
+  const unsigned n = N / P;
+  std::vector<source_type> xI(n);
+  std::vector<charge_type> cJ(n);
+  std::vector<result_type> gI(n);
+  comm_phase("scatter");
+  commTimer.start();
+  MPI_Scatter(source.data(), sizeof(source_type) * n, MPI_CHAR,
+              xI.data(), sizeof(source_type) * n, MPI_CHAR,
+              MASTER, MPI_COMM_WORLD);
+  MPI_Scatter(charge.data(), sizeof(charge_type) * n, MPI_CHAR,
+              cJ.data(), sizeof(charge_type) * n, MPI_CHAR,
+              MASTER, MPI_COMM_WORLD);
+  MPI_Scatter(grad.data(), sizeof(result_type) * n, MPI_CHAR,
+              gI.data(), sizeof(result_type) * n, MPI_CHAR,
+              MASTER, MPI_COMM_WORLD);
+  totalCommTime += commTimer.elapsed();
+
+  // The circulating sources and their gradients, the stationary targets'
+  std::vector<source_type> xJ = xI;
+  std::vector<source_type> dxJ(n, source_type(0));
+  std::vector<charge_type> dcJ(n);
+  std::vector<source_type> dxI(n, source_type(0));
+  param_type dp(0);
+
+  const int dst = (rank - 1 + P) % P;
+  const int src = (rank + 1) % P;
+
+  for (int shiftCount = 0; shiftCount < P; ++shiftCount) {
+    compTimer.start();
+    p2p_adjoint(K, xJ.data(), xJ.data() + n, cJ.data(),
+                xI.data(), xI.data() + n, gI.data(),
+                dxJ.data(), dcJ.data(), dxI.data(), &dp);
+    totalCompTime += compTimer.elapsed();
+
+    // Pass the sources on, the last shift returns their gradients home
+    comm_phase("shift");
+    commTimer.start();
+    if (shiftCount + 1 < P) {
+      MPI_Sendrecv_replace(xJ.data(), sizeof(source_type) * n, MPI_CHAR,
+                           src, 0, dst, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+      MPI_Sendrecv_replace(cJ.data(), sizeof(charge_type) * n, MPI_CHAR,
+                           src, 0, dst, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    }
+    MPI_Sendrecv_replace(dxJ.data(), sizeof(source_type) * n, MPI_CHAR,
+                         src, 0, dst, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    MPI_Sendrecv_replace(dcJ.data(), sizeof(charge_type) * n, MPI_CHAR,
+                         src, 0, dst, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    totalCommTime += commTimer.elapsed();
+  }
+
+  // A point's gradient is the sum of its target and source gradients
+  for (unsigned i = 0; i < n; ++i)
+    dxI[i] += dxJ[i];
+
+  // Collect the gradients on the master
+  std::vector<source_type> dx;
+  std::vector<charge_type> dc;
+  if (rank == MASTER) {
+    dx.resize(N);
+    dc.resize(N);
+  }
+  comm_phase("gather");
+  commTimer.start();
+  MPI_Gather(dxI.data(), sizeof(source_type) * n, MPI_CHAR,
+             dx.data(), sizeof(source_type) * n, MPI_CHAR,
+             MASTER, MPI_COMM_WORLD);
+  MPI_Gather(dcJ.data(), sizeof(charge_type) * n, MPI_CHAR,
+             dc.data(), sizeof(charge_type) * n, MPI_CHAR,
+             MASTER, MPI_COMM_WORLD);
+  param_type dp_sum(0);
+  MPI_Reduce(&dp, &dp_sum, param_type::size(), mpi_type<param_value_type>::value(),
+             MPI_SUM, MASTER, MPI_COMM_WORLD);
+  totalCommTime += commTimer.elapsed();
+
+  double time = timer.elapsed();
+
+  // Collect times to MASTER
+  comm_phase("timing");
+  double local[] = {totalCompTime, totalCommTime};
+  double global[2];
+  MPI_Reduce(local, global, 2, MPI_DOUBLE, MPI_SUM, MASTER, MPI_COMM_WORLD);
+
+  if (rank == MASTER) {
+    printf("Label\tComputation\tCommunication\n");
+    printf("P=%d\t%e\t%e\n", P, global[0] / P, global[1] / P);
+    printf("Rank 0 Total Time: %e\n", time);
+    std::cout << "dL/dp = " << dp_sum << std::endl;
+  }
+
+  // Check the result
+  if (rank == MASTER && checkErrors) {
+    std::cout << "Computing direct adjoint..." << std::endl;
+
+    std::vector<source_type> exact_dx(N, source_type(0));
+    std::vector<source_type> exact_ds(N, source_type(0));
+    std::vector<charge_type> exact_dc(N);
+    param_type exact_dp(0);
+
+    compTimer.start();
+    p2p_adjoint(K, source.data(), source.data() + N, charge.data(),
+                source.data(), source.data() + N, grad.data(),
+                exact_ds.data(), exact_dc.data(), exact_dx.data(), &exact_dp);
+    double directCompTime = compTimer.elapsed();
+    for (unsigned i = 0; i < N; ++i)
+      exact_dx[i] += exact_ds[i];
+
+    std::cout << "Position gradients:" << std::endl;
+    print_error(exact_dx, dx);
+    std::cout << "Charge gradients:" << std::endl;
+    print_error(exact_dc, dc);
+    std::cout << "Parameter gradient relative error: "
+              << norm(exact_dp - dp_sum) / norm(exact_dp) << std::endl;
+    std::cout << "DirectCompTime: " << directCompTime << std::endl;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  bool checkErrors = true;
+  std::string dist = "uniform";
+  std::string kernel = "yukawa";
+
+  // Parse optional command line args
+  std::vector<std::string> arg(argv, argv + argc);
+  for (unsigned i = 1; i < arg.size(); ++i) {
+    if (arg[i] == "-nocheck") {
+      checkErrors = false;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+    }
+    if (arg[i] == "-kernel") {
+      if (i+1 < arg.size()) {
+        kernel = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-kernel option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+    if (arg[i] == "-dist") {
+      if (i+1 < arg.size()) {
+        dist = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-dist option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  if (arg.size() < 2) {
+    std::cerr << "Usage: " << arg[0] << " NUMPOINTS [-kernel yukawa|gaussian|bayes] [-nocheck] [-dist DIST]" << std::endl;
+    exit(1);
+  }
+
+  if (!meta::is_distribution(dist)) {
+    std::cerr << "Unknown distribution " << dist << std::endl;
+    exit(1);
+  }
+
+  if (kernel != "yukawa" && kernel != "gaussian" && kernel != "bayes") {
+    std::cerr << "Unknown kernel " << kernel << std::endl;
+    exit(1);
+  }
+
+  unsigned N = string_to_<int>(arg[1]);
+
+  MPI_Init(&argc, &argv);
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  int P;
+  MPI_Comm_size(MPI_COMM_WORLD, &P);
+
+  if (N % P != 0) {
+    if (rank == MASTER)
+      printf("Quitting. The number of processors must divide the number of points.\n");
+    MPI_Abort(MPI_COMM_WORLD, -1);
+    exit(0);
+  }
+
+  if (rank == MASTER) {
+    // display metadata
+    std::cout << "N = " << N << std::endl;
+    std::cout << "P = " << P << std::endl;
+    std::cout << "Kernel = " << kernel << std::endl;
+  }
+
+  if (kernel == "yukawa")
+    run(YukawaPotentialT<real_type>(1), N, dist, checkErrors);
+  else if (kernel == "gaussian")
+    run(GaussianT<real_type>(0.2), N, dist, checkErrors);
+  else
+    run(NonParaBayesian(1, 1), N, dist, checkErrors);
+
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,492 @@
+#include "Util.hpp"
+#include "Simulator.hpp"
+
+#include "kernel/InvSq.kern"
+#include "kernel/Laplace.kern"
+#include "kernel/Yukawa.kern"
+#include "meta/kernel_traits.hpp"
+#include "meta/random.hpp"
+
+#include <unistd.h>
+
+// Automatic selection among the distributed n-body drivers
+//
+// Estimates the time of broadcast, scatter, teamscatter and symmetric (for
+// every valid teamsize) for N points on P processes by replaying their
+// schedules in the Simulator with calibrated network and compute rates,
+// discards those the driver would refuse (N%P, P%c, c^2 <= P) or that
+// exceed the memory budget of any rank, the master included (running the team
+// drivers with -lean when only that fits), logs the estimates
+// and the decision, and runs the fastest driver with the launcher.
+//
+// Calibration is done by launching this program on P processes with
+// -calibrate. Calibrations and decisions are appended to a cache file so
+// later runs of the same configuration start the driver immediately.
+// The drivers evaluate InvSq; -kernel selects the kernel the rates are
+// calibrated and the messages are sized with.
+
+struct Options {
+  unsigned N = 0;
+  unsigned P = 1;
+  std::string kernel = "invsq";
+  double memory = 0;                  // Bytes per rank, 0 for no limit
+  std::string cache = "autoselect.cache";
+  std::string launcher = "mpirun -np {P}";
+  bool recalibrate = false;
+  bool dry = false;                   // Log the decision but do not run it
+  std::vector<std::string> driver_args;
+};
+
+/** Calibrated rates for a kernel on P processes */
+struct Calibration {
+  NetworkModel net;
+  ComputeModel cpu;
+};
+
+/** Estimate of one driver configuration */
+struct Candidate {
+  std::string alg;
+  unsigned c;
+  double time;       // Predicted total time
+  double comm;       // Predicted average communication time
+  double memory;     // Bytes per non-master rank
+  double master;     // Bytes on the master rank
+  bool lean;         // Run the driver with -lean
+};
+
+/** Block size used to calibrate the compute rate for N points on P processes */
+unsigned calibration_size(unsigned N, unsigned P) {
+  return std::max(256u, std::min(8192u, idiv_up(N, P)));
+}
+
+/*******************************/
+/****** Cache ******************/
+/*******************************/
+
+// The cache holds one entry per line:
+//   calibration KERNEL P n ALPHA BETA ASYMRATE SYMMRATE
+//   decision KERNEL N P MEMORY ALG C TIME LEAN
+
+bool find_calibration(const Options& opt, unsigned n, Calibration& cal) {
+  std::ifstream file(opt.cache);
+  std::string line;
+  bool found = false;
+  while (std::getline(file, line)) {    // The last entry wins
+    std::istringstream ss(line);
+    std::string type, kernel;
+    unsigned P, bn;
+    Calibration c;
+    ss >> type >> kernel >> P >> bn
+       >> c.net.alpha >> c.net.beta >> c.cpu.asym_rate >> c.cpu.symm_rate;
+    if (ss && type == "calibration" && kernel == opt.kernel
+        && P == opt.P && bn == n) {
+      cal = c;
+      found = true;
+    }
+  }
+  return found;
+}
+
+bool find_decision(const Options& opt, Candidate& best) {
+  std::ifstream file(opt.cache);
+  std::string line;
+  bool found = false;
+  while (std::getline(file, line)) {    // The last entry wins
+    std::istringstream ss(line);
+    std::string type, kernel;
+    unsigned N, P;
+    double memory;
+    Candidate c;
+    ss >> type >> kernel >> N >> P >> memory >> c.alg >> c.c >> c.time;
+    if (ss && type == "decision" && kernel == opt.kernel
+        && N == opt.N && P == opt.P && memory == opt.memory) {
+      // Entries before -lean was selected have no LEAN field
+      int lean = 0;
+      ss >> lean;
+      c.lean = lean;
+      best = c;
+      found = true;
+    }
+  }
+  return found;
+}
+
+/*******************************/
+/****** Calibration ************/
+/*******************************/
+
+/** Average round trip time of @a bytes between ranks 0 and @a partner */
+double ping_pong(int rank, int partner, unsigned bytes, int reps) {
+  std::vector<char> buf(bytes);
+  MPI_Status status;
+  MPI_Barrier(MPI_COMM_WORLD);
+  Clock timer;
+  for (int i = 0; i < reps; ++i) {
+    if (rank == 0) {
+      MPI_Send(buf.data(), bytes, MPI_CHAR, partner, 0, MPI_COMM_WORLD);
+      MPI_Recv(buf.data(), bytes, MPI_CHAR, partner, 0, MPI_COMM_WORLD, &status);
+    } else if (rank == partner) {
+      MPI_Recv(buf.data(), bytes, MPI_CHAR, 0, 0, MPI_COMM_WORLD, &status);
+      MPI_Send(buf.data(), bytes, MPI_CHAR, 0, 0, MPI_COMM_WORLD);
+    }
+  }
+  return timer.elapsed() / reps;
+}
+
+/** Measure the rates on every process and append them to the cache */
+template <typename Kernel>
+void calibrate(const Kernel& K, const Options& opt, unsigned n) {
+  int rank, P;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &P);
+
+  Calibration cal;
+  if (P > 1) {
+    // The last rank is the most likely to be on another node
+    const unsigned small = 8, large = 1 << 22;
+    double t_small = ping_pong(rank, P-1, small, 100);
+    double t_large = ping_pong(rank, P-1, large, 10);
+    cal.net.alpha = t_small / 2;
+    cal.net.beta  = std::max(0.0, (t_large - t_small) / 2 / (large - small));
+  }
+
+  // All processes evaluate at once, as in the drivers; the slowest sets the pace
+  ComputeModel cpu = measure_compute(K, n, P2P_NUM_THREADS);
+  MPI_Reduce(&cpu.asym_rate, &cal.cpu.asym_rate, 1, MPI_DOUBLE,
+             MPI_MIN, MASTER, MPI_COMM_WORLD);
+  MPI_Reduce(&cpu.symm_rate, &cal.cpu.symm_rate, 1, MPI_DOUBLE,
+             MPI_MIN, MASTER, MPI_COMM_WORLD);
+
+  if (rank == MASTER) {
+    std::ofstream file(opt.cache, std::ios::app);
+    file << std::scientific
+         << "calibration " << opt.kernel << " " << P << " " << n
+         << " " << cal.net.alpha << " " << cal.net.beta
+         << " " << cal.cpu.asym_rate << " " << cal.cpu.symm_rate << std::endl;
+  }
+}
+
+/*******************************/
+/****** Selection **************/
+/*******************************/
+
+/** Bytes held by a non-master rank of each driver.
+ * The master additionally holds all N sources, charges, and results.
+ */
+template <typename Kernel>
+double driver_memory(const std::string& alg, unsigned N, unsigned P, unsigned c) {
+  typedef MessageSizes<Kernel> B;
+  if (alg == "broadcast") {
+    // All sources and charges, and a block of results
+    return N * (B::source + B::charge) + idiv_up(N,P) * B::result;
+  }
+  const double n = (alg == "scatter") ? idiv_up(N,P) : idiv_up(N,P/c);
+  // xJ, cJ, xI, rI, and the MPI buffer of the largest shifted block
+  double bytes = n * (3*B::source + B::charge + B::result);
+  if (alg == "teamscatter")
+    bytes += n * B::result;                           // teamrI
+  if (alg == "symmetric")
+    bytes += n * (B::charge + 2*B::result);           // cI, rJ, temp_rI
+  return bytes;
+}
+
+/** Bytes held by the master rank of each driver: those of a non-master rank,
+ * and unless @a lean all N sources and charges, the gathered results, and
+ * with @a check the exact results.
+ * The lean modes of teamscatter and symmetric hold no N-sized arrays.
+ */
+template <typename Kernel>
+double master_memory(const std::string& alg, unsigned N, unsigned P, unsigned c,
+                     bool lean, bool check) {
+  typedef MessageSizes<Kernel> B;
+  double bytes = driver_memory<Kernel>(alg, N, P, c);
+  if (lean)
+    return bytes;
+  if (alg != "broadcast")                   // Broadcast counted them already
+    bytes += N * (B::source + B::charge);
+  bytes += P * idiv_up(N,P) * B::result;    // result
+  if (check)
+    bytes += N * B::result;                 // exact
+  return bytes;
+}
+
+template <typename Kernel>
+Candidate estimate(const std::string& alg, unsigned N, unsigned P, unsigned c,
+                   const Calibration& cal) {
+  Simulator sim(P);
+  if      (alg == "broadcast")   sim = simulate_broadcast<Kernel>(N, P, cal.net, cal.cpu);
+  else if (alg == "scatter")     sim = simulate_scatter<Kernel>(N, P, cal.net, cal.cpu);
+  else if (alg == "teamscatter") sim = simulate_teamscatter<Kernel>(N, P, c, cal.net, cal.cpu);
+  else                           sim = simulate_symmetric<Kernel>(N, P, c, cal.net, cal.cpu);
+
+  Candidate result;
+  result.alg = alg;
+  result.c = c;
+  result.time = 0;
+  for (unsigned r = 0; r < P; ++r)
+    result.time = std::max(result.time, sim.clock(r));
+  result.comm = sim.average().comm();
+  result.memory = driver_memory<Kernel>(alg, N, P, c);
+  result.lean = false;
+  return result;
+}
+
+/** Why the driver @a alg would quit on N points, P processes and teamsize c,
+ * or empty if it runs. These are the checks of the drivers themselves;
+ * broadcast has none, so it is always a candidate.
+ */
+std::string driver_rejects(const std::string& alg,
+                           unsigned N, unsigned P, unsigned c) {
+  if (alg == "broadcast")
+    return "";
+  if (N % P != 0)
+    return "P does not divide N";
+  if (alg == "scatter")
+    return "";
+  if (P % c != 0)
+    return "c does not divide P";
+  if (c * c > P)
+    return "c^2 exceeds P";
+  return "";
+}
+
+/** Estimate every driver, log the estimates and return the fastest that fits */
+template <typename Kernel>
+Candidate select(const Options& opt, const Calibration& cal) {
+  printf("Alpha = %e\n", cal.net.alpha);
+  printf("Beta = %e\n", cal.net.beta);
+  printf("Rate = %e\n", cal.cpu.asym_rate);
+  printf("SymmRate = %e\n", cal.cpu.symm_rate);
+
+  // The configurations, dropping those the drivers would refuse
+  std::vector<std::pair<std::string,unsigned>> configs;
+  configs.emplace_back("broadcast", 1);
+  configs.emplace_back("scatter", 1);
+  for (unsigned c = 1; c * c <= opt.P; ++c) {
+    configs.emplace_back("teamscatter", c);
+    configs.emplace_back("symmetric", c);
+  }
+  std::vector<Candidate> candidates;
+  for (auto& config : configs) {
+    std::string why = driver_rejects(config.first, opt.N, opt.P, config.second);
+    if (why.empty())
+      candidates.push_back(estimate<Kernel>(config.first, opt.N, opt.P,
+                                            config.second, cal));
+    else
+      printf("Rejected %s c=%d: %s\n", config.first.c_str(), config.second,
+             why.c_str());
+  }
+
+  // The master checks the results unless the driver is told not to
+  const bool check = std::find(opt.driver_args.begin(), opt.driver_args.end(),
+                               "-nocheck") == opt.driver_args.end();
+
+  printf("Driver\tc\tPredicted\tComm\tMemory\tMaster\tFits\n");
+
+  int best = -1, runner_up = -1;
+  for (unsigned k = 0; k < candidates.size(); ++k) {
+    Candidate& cand = candidates[k];
+    cand.master = master_memory<Kernel>(cand.alg, opt.N, opt.P, cand.c,
+                                        false, check);
+    // The team drivers fall back to -lean if the master would not fit
+    if (opt.memory != 0 && cand.master > opt.memory
+        && (cand.alg == "teamscatter" || cand.alg == "symmetric")) {
+      cand.lean = true;
+      cand.master = master_memory<Kernel>(cand.alg, opt.N, opt.P, cand.c,
+                                          true, check);
+    }
+    bool fits = opt.memory == 0
+        || (cand.memory <= opt.memory && cand.master <= opt.memory);
+    printf("%s\t%d\t%e\t%e\t%e\t%e\t%s\n", cand.alg.c_str(), cand.c,
+           cand.time, cand.comm, cand.memory, cand.master,
+           fits ? (cand.lean ? "lean" : "yes") : "no");
+    if (!fits)
+      continue;
+    if (best < 0 || cand.time < candidates[best].time) {
+      runner_up = best;
+      best = k;
+    } else if (runner_up < 0 || cand.time < candidates[runner_up].time) {
+      runner_up = k;
+    }
+  }
+
+  if (best < 0) {
+    std::cerr << "No driver fits in " << opt.memory << " bytes per rank." << std::endl;
+    exit(1);
+  }
+
+  // Rationale
+  const Candidate& b = candidates[best];
+  printf("Selected %s c=%d%s: predicted %e s, %.1f%% communication",
+         b.alg.c_str(), b.c, b.lean ? " -lean" : "", b.time,
+         100 * b.comm / b.time);
+  if (runner_up >= 0) {
+    const Candidate& r = candidates[runner_up];
+    printf(", %.1f%% faster than %s c=%d", 100 * (r.time / b.time - 1),
+           r.alg.c_str(), r.c);
+  }
+  printf("\n");
+  return b;
+}
+
+/*******************************/
+/****** Launch *****************/
+/*******************************/
+
+/** The launcher command for P processes, split into words */
+std::vector<std::string> launcher(const Options& opt, unsigned P) {
+  std::string cmd = opt.launcher;
+  std::string::size_type pos = cmd.find("{P}");
+  if (pos != std::string::npos)
+    cmd.replace(pos, 3, std::to_string(P));
+  std::istringstream ss(cmd);
+  std::vector<std::string> words;
+  std::string word;
+  while (ss >> word)
+    words.push_back(word);
+  return words;
+}
+
+/** Path of the driver @a name next to this executable */
+std::string sibling(const std::string& self, const std::string& name) {
+  std::string::size_type pos = self.rfind('/');
+  return (pos == std::string::npos) ? "./" + name : self.substr(0, pos+1) + name;
+}
+
+std::string join(const std::vector<std::string>& words) {
+  std::string s;
+  for (auto& w : words)
+    s += (s.empty() ? "" : " ") + w;
+  return s;
+}
+
+template <typename Kernel>
+void run(const Options& opt, const std::string& self) {
+  std::cout << "N = " << opt.N << std::endl;
+  std::cout << "P = " << opt.P << std::endl;
+  std::cout << "Kernel = " << opt.kernel << std::endl;
+  std::cout << "Memory = " << opt.memory << std::endl;
+
+  Candidate best;
+  if (!opt.recalibrate && find_decision(opt, best)) {
+    printf("Selected %s c=%d%s: predicted %e s (cached in %s)\n",
+           best.alg.c_str(), best.c, best.lean ? " -lean" : "", best.time,
+           opt.cache.c_str());
+  } else {
+    unsigned n = calibration_size(opt.N, opt.P);
+    Calibration cal;
+    if (opt.recalibrate || !find_calibration(opt, n, cal)) {
+      std::vector<std::string> cmd = launcher(opt, opt.P);
+      cmd.insert(cmd.end(), {self, "-calibrate", "-kernel", opt.kernel,
+                             "-cache", opt.cache, "-n", std::to_string(n)});
+      std::cout << "Calibrating: " << join(cmd) << std::endl;
+      if (std::system(join(cmd).c_str()) != 0 || !find_calibration(opt, n, cal)) {
+        std::cerr << "Calibration failed." << std::endl;
+        exit(1);
+      }
+    }
+    best = select<Kernel>(opt, cal);
+
+    std::ofstream file(opt.cache, std::ios::app);
+    file << std::scientific
+         << "decision " << opt.kernel << " " << opt.N << " " << opt.P
+         << " " << opt.memory << " " << best.alg << " " << best.c
+         << " " << best.time << " " << best.lean << std::endl;
+  }
+
+  // Replace this process with the selected driver
+  std::vector<std::string> cmd = launcher(opt, opt.P);
+  cmd.push_back(sibling(self, best.alg));
+  cmd.push_back(std::to_string(opt.N));
+  if (best.alg == "teamscatter" || best.alg == "symmetric") {
+    cmd.push_back("-c");
+    cmd.push_back(std::to_string(best.c));
+  }
+  if (best.lean)
+    cmd.push_back("-lean");
+  cmd.insert(cmd.end(), opt.driver_args.begin(), opt.driver_args.end());
+  std::cout << "Running: " << join(cmd) << std::endl;
+  if (opt.dry)
+    return;
+
+  std::vector<char*> argv;
+  for (auto& w : cmd)
+    argv.push_back(const_cast<char*>(w.c_str()));
+  argv.push_back(nullptr);
+  std::cout.flush();
+  fflush(stdout);
+  execvp(argv[0], argv.data());
+  std::cerr << "Could not execute " << argv[0] << std::endl;
+  exit(1);
+}
+
+
+int main(int argc, char** argv)
+{
+  Options opt;
+  bool calibrate_mode = false;
+  unsigned n = 0;
+
+  // Parse optional command line args
+  std::vector<std::string> arg(argv, argv + argc);
+  for (unsigned i = 1; i < arg.size(); ++i) {
+    if (arg[i] == "--") {           // Pass the remaining args to the driver
+      opt.driver_args.assign(arg.begin() + i + 1, arg.end());
+      arg.erase(arg.begin() + i, arg.end());
+      break;
+    }
+    if (arg[i][0] != '-')
+      continue;
+    if (arg[i] == "-calibrate" || arg[i] == "-recalibrate" || arg[i] == "-dry") {
+      if (arg[i] == "-calibrate")   calibrate_mode = true;
+      if (arg[i] == "-recalibrate") opt.recalibrate = true;
+      if (arg[i] == "-dry")         opt.dry = true;
+      arg.erase(arg.begin() + i);
+      --i;
+      continue;
+    }
+    if (i+1 >= arg.size()) {
+      std::cerr << arg[i] << " option requires one argument." << std::endl;
+      return 1;
+    }
+    if      (arg[i] == "-kernel")   opt.kernel = arg[i+1];
+    else if (arg[i] == "-mem")      opt.memory = string_to_<double>(arg[i+1]);
+    else if (arg[i] == "-cache")    opt.cache = arg[i+1];
+    else if (arg[i] == "-launcher") opt.launcher = arg[i+1];
+    else if (arg[i] == "-n")        n = string_to_<unsigned>(arg[i+1]);
+    else {
+      std::cerr << "Unknown option " << arg[i] << std::endl;
+      return 1;
+    }
+    arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+    --i;                                              // Reset index
+  }
+
+  if (calibrate_mode) {
+    MPI_Init(&argc, &argv);
+    if (opt.kernel == "laplace")
+      calibrate(LaplaceKernel(), opt, n);
+    else if (opt.kernel == "yukawa")
+      calibrate(YukawaKernel(), opt, n);
+    else
+      calibrate(InvSq(), opt, n);
+    MPI_Finalize();
+    return 0;
+  }
+
+  if (arg.size() < 3) {
+    std::cerr << "Usage: " << arg[0] << " NUMPOINTS NUMPROCS [-kernel invsq|laplace|yukawa] [-mem BYTES] [-cache FILE] [-launcher CMD] [-recalibrate] [-dry] [-- DRIVER_ARGS]" << std::endl;
+    exit(1);
+  }
+  opt.N = string_to_<unsigned>(arg[1]);
+  opt.P = string_to_<unsigned>(arg[2]);
+
+  if (opt.kernel == "laplace")
+    run<LaplaceKernel>(opt, arg[0]);
+  else if (opt.kernel == "yukawa")
+    run<YukawaKernel>(opt, arg[0]);
+  else
+    run<InvSq>(opt, arg[0]);
+
+  return 0;
+}
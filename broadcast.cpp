@@ -1,8 +1,10 @@
 #include "Util.hpp"
+#include "CommProfile.hpp"
 
 #include "kernel/InvSq.kern"
 #include "meta/kernel_traits.hpp"
 #include "meta/random.hpp"
+#include "meta/distribution.hpp"
 
 #include <type_traits>
 
@@ -20,6 +22,7 @@ inline unsigned calcEnd(unsigned r, unsigned P, unsigned N) {
 int main(int argc, char** argv)
 {
   bool checkErrors = true;
+  std::string dist = "uniform";
 
   // Parse optional command line args
   std::vector<std::string> arg(argv, argv + argc);
@@ -29,13 +32,28 @@ int main(int argc, char** argv)
       arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
       --i;                                              // Reset index
     }
+    if (arg[i] == "-dist") {
+      if (i+1 < arg.size()) {
+        dist = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-dist option requires one argument." << std::endl;
+        return 1;
+      }
+    }
 
     if (arg.size() < 2) {
-      std::cerr << "Usage: " << arg[0] << " NUMPOINTS [-nocheck]" << std::endl;
+      std::cerr << "Usage: " << arg[0] << " NUMPOINTS [-nocheck] [-dist DIST]" << std::endl;
       exit(1);
     }
   }
 
+  if (!meta::is_distribution(dist)) {
+    std::cerr << "Unknown distribution " << dist << std::endl;
+    exit(1);
+  }
+
   srand(time(NULL));
   unsigned N = string_to_<int>(arg[1]);
 
@@ -46,7 +64,7 @@ int main(int argc, char** argv)
   MPI_Comm_size(MPI_COMM_WORLD, &P);
 
   // Define the kernel
-  typedef InvSq kernel_type;
+  typedef InvSqT<real_type> kernel_type;
   kernel_type K;
 
   // Define source_type, target_type, charge_type, result_type
@@ -54,6 +72,8 @@ int main(int argc, char** argv)
   typedef kernel_type::charge_type charge_type;
   typedef kernel_type::target_type target_type;
   typedef kernel_type::result_type result_type;
+  // Type to accumulate results in, exact with NBODY_REPRODUCIBLE
+  typedef accumulator<result_type>::type accum_type;
 
   // We are testing symmetric kernels
   static_assert(std::is_same<source_type, target_type>::value,
@@ -62,10 +82,14 @@ int main(int argc, char** argv)
   std::vector<source_type> source;
   std::vector<charge_type> charge;
 
+  const int seed = 1337;
+
   if (rank == MASTER) {
+    meta::default_generator.seed(seed);
+
     // generate source data
-    for (unsigned i = 0; i < N; ++i)
-      source.push_back(meta::random<source_type>::get());
+    meta::distribution_block<source_type>(dist, seed, 0, N, N,
+                                          std::back_inserter(source));
 
     // generate charge data
     for (unsigned i = 0; i < N; ++i)
@@ -96,6 +120,7 @@ int main(int argc, char** argv)
   }
 
   // Broadcast the data to all processes
+  comm_phase("split");
   commTimer.start();
   MPI_Bcast(source.data(), sizeof(source_type) * source.size(), MPI_CHAR,
             MASTER, MPI_COMM_WORLD);
@@ -104,7 +129,7 @@ int main(int argc, char** argv)
   totalCommTime += commTimer.elapsed();
 
   // All processors have a chunk to hold their temporary answers
-  std::vector<result_type> rI(idiv_up(N,P));
+  std::vector<accum_type> rI(idiv_up(N,P));
 
   // Evaluate computation
   compTimer.start();
@@ -116,20 +141,27 @@ int main(int argc, char** argv)
   totalCompTime += compTimer.elapsed();
 
   // Collect results and display
+  // Every block is gathered whole, the last may extend past N
   std::vector<result_type> result;
   if (rank == MASTER)
-    result = std::vector<result_type>(N);
+    result = std::vector<result_type>(P*idiv_up(N,P));
 
+  comm_phase("gather");
   commTimer.start();
-  MPI_Gather(rI.data(), sizeof(result_type) * rI.size(), MPI_CHAR,
+  const std::vector<result_type>& rounded_rI = round_results(rI);
+  MPI_Gather(rounded_rI.data(), sizeof(result_type) * rI.size(), MPI_CHAR,
              result.data(), sizeof(result_type) * rI.size(), MPI_CHAR,
              MASTER, MPI_COMM_WORLD);
   totalCommTime += commTimer.elapsed();
+  if (rank == MASTER)
+    result.resize(N);
 
   double time = timer.elapsed();
   printf("[%d] Timer: %e\n", rank, time);
   printf("[%d] CommTimer: %e\n", rank, totalCommTime);
   printf("[%d] CompTimer: %e\n", rank, totalCompTime);
+  if (rank == MASTER)
+    print_checksum(result, idiv_up(N,P));
 
   // Check the result
   if (rank == MASTER && checkErrors) {
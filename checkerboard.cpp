@@ -0,0 +1,305 @@
+#include "Util.hpp"
+#include "CommProfile.hpp"
+
+#include "kernel/InvSq.kern"
+#include "meta/kernel_traits.hpp"
+#include "meta/random.hpp"
+#include "meta/distribution.hpp"
+
+// 2D Checkerboard version of the n-body algorithm
+//
+// The processes are arranged in a q x q grid with P = q^2. Process (i,j)
+// computes the interactions of source block j onto target block i. The master
+// scatters the target blocks down the first column and the source blocks
+// across the first row. Target blocks are then broadcast along the rows from
+// column 0, source blocks down the columns from row 0, and partial results
+// are reduced along the rows.
+
+int main(int argc, char** argv)
+{
+  bool checkErrors = true;
+  std::string dist = "uniform";
+
+  // Parse optional command line args
+  std::vector<std::string> arg(argv, argv + argc);
+  for (unsigned i = 1; i < arg.size(); ++i) {
+    if (arg[i] == "-nocheck") {
+      checkErrors = false;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+    }
+    if (arg[i] == "-dist") {
+      if (i+1 < arg.size()) {
+        dist = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-dist option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  if (arg.size() < 2) {
+    std::cerr << "Usage: " << arg[0] << " NUMPOINTS [-nocheck] [-dist DIST]" << std::endl;
+    exit(1);
+  }
+
+  if (!meta::is_distribution(dist)) {
+    std::cerr << "Unknown distribution " << dist << std::endl;
+    exit(1);
+  }
+
+  unsigned N = string_to_<int>(arg[1]);
+
+  MPI_Init(&argc, &argv);
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  int P;
+  MPI_Comm_size(MPI_COMM_WORLD, &P);
+
+  typedef InvSqT<real_type> kernel_type;
+  kernel_type K;
+
+  // Define source_type, target_type, charge_type, result_type
+  typedef kernel_type::source_type source_type;
+  typedef kernel_type::charge_type charge_type;
+  typedef kernel_type::target_type target_type;
+  typedef kernel_type::result_type result_type;
+  // Type to accumulate results in, exact with NBODY_REPRODUCIBLE
+  typedef accumulator<result_type>::type accum_type;
+
+  // We are testing symmetric kernels
+  static_assert(std::is_same<source_type, target_type>::value,
+                "Testing symmetric kernels, need source_type == target_type");
+
+  std::vector<source_type> source;
+  std::vector<charge_type> charge;
+
+  const int seed = 1337;
+
+  // The side length of the process grid
+  unsigned q = unsigned(std::sqrt(double(P)) + 0.5);
+
+  if (rank == MASTER) {
+    meta::default_generator.seed(seed);
+
+    // generate source data
+    meta::distribution_block<source_type>(dist, seed, 0, N, N,
+                                          std::back_inserter(source));
+
+    // generate charge data
+    for (unsigned i = 0; i < N; ++i)
+      charge.push_back(meta::random<charge_type>::get());
+
+    // display metadata
+    std::cout << "N = " << N << std::endl;
+    std::cout << "P = " << P << std::endl;
+    std::cout << "Gridsize = " << q << std::endl;
+  }
+
+
+  ////////////////////////
+  // Actual Computation //
+  ////////////////////////
+
+  Clock timer;
+  Clock compTimer;
+  Clock splitTimer;
+  Clock reduceTimer;
+
+  double totalCompTime = 0;
+  double totalSplitTime = 0;
+  double totalReduceTime = 0;
+  // No ring shifts in the 2D algorithm, reported for comparison
+  double totalShiftTime = 0;
+
+  timer.start();
+
+  // Broadcast the size of the problem to all processes
+  MPI_Bcast(&N, sizeof(N), MPI_CHAR, MASTER, MPI_COMM_WORLD);
+
+  if (q * q != unsigned(P)) {
+    printf("Quitting. The number of processors must be a perfect square.\n");
+    MPI_Abort(MPI_COMM_WORLD, -1);
+    exit(0);
+  }
+
+  if (N % q != 0) {
+    printf("Quitting. The grid size (sqrt(p)) must divide the number of points.\n");
+    MPI_Abort(MPI_COMM_WORLD, -1);
+    exit(0);
+  }
+
+  /***********/
+  /** SETUP **/
+  /***********/
+
+  // Determine coordinates in the processor grid
+  unsigned row = rank / q;
+  unsigned col = rank % q;
+
+  // Split comm into row and column communicators
+  // The rank in row_comm is col and the rank in col_comm is row
+  MPI_Comm row_comm;
+  MPI_Comm_split(MPI_COMM_WORLD, row, rank, &row_comm);
+  MPI_Comm col_comm;
+  MPI_Comm_split(MPI_COMM_WORLD, col, rank, &col_comm);
+
+  /*********************/
+  /** BROADCAST STAGE **/
+  /*********************/
+
+  // Declare data for the block computations
+  std::vector<target_type> xI(idiv_up(N,q));
+  std::vector<source_type> xJ(idiv_up(N,q));
+  std::vector<charge_type> cJ(idiv_up(N,q));
+
+  // Scatter the target blocks from master down the first column
+  comm_phase("scatter");
+  if (col == MASTER) {
+    MPI_Scatter(source.data(), sizeof(target_type) * xI.size(), MPI_CHAR,
+                xI.data(), sizeof(target_type) * xI.size(), MPI_CHAR,
+                MASTER, col_comm);
+  }
+  // Scatter the source blocks from master across the first row
+  if (row == MASTER) {
+    MPI_Scatter(source.data(), sizeof(source_type) * xJ.size(), MPI_CHAR,
+                xJ.data(), sizeof(source_type) * xJ.size(), MPI_CHAR,
+                MASTER, row_comm);
+    MPI_Scatter(charge.data(), sizeof(charge_type) * cJ.size(), MPI_CHAR,
+                cJ.data(), sizeof(charge_type) * cJ.size(), MPI_CHAR,
+                MASTER, row_comm);
+  }
+
+  // Broadcast target block i along row i and source block j down column j
+  comm_phase("split");
+  splitTimer.start();
+  MPI_Bcast(xI.data(), sizeof(target_type) * xI.size(), MPI_CHAR,
+            MASTER, row_comm);
+  MPI_Bcast(xJ.data(), sizeof(source_type) * xJ.size(), MPI_CHAR,
+            MASTER, col_comm);
+  MPI_Bcast(cJ.data(), sizeof(charge_type) * cJ.size(), MPI_CHAR,
+            MASTER, col_comm);
+  totalSplitTime += splitTimer.elapsed();
+
+  /*****************/
+  /** COMPUTATION **/
+  /*****************/
+
+  // Initialize block result rI
+  std::vector<accum_type> rI(idiv_up(N,q));
+
+  compTimer.start();
+  p2p(K,
+      xJ.begin(), xJ.end(), cJ.begin(),
+      xI.begin(), xI.end(), rI.begin());
+  totalCompTime += compTimer.elapsed();
+
+  /********************/
+  /*** REDUCE STAGE ***/
+  /********************/
+
+  // Allocate rowrI on the first column
+  std::vector<result_type> rowrI;
+  if (col == MASTER)
+    rowrI = std::vector<result_type>(idiv_up(N,q));
+
+  // Reduce answers along the rows to the first column
+  comm_phase("reduce");
+  reduceTimer.start();
+  // TODO: Generalize
+  static_assert(std::is_floating_point<result_type>::value,
+                "Need a floating point result_type for now");
+  reduce_results(rI, rowrI, MASTER, row_comm);
+  totalReduceTime += reduceTimer.elapsed();
+
+  // Allocate result on master
+  std::vector<result_type> result;
+  if (rank == MASTER)
+    result = std::vector<result_type>(q*idiv_up(N,q));
+
+  // Gather the first column answers to master
+  if (col == MASTER) {
+    comm_phase("gather");
+    MPI_Gather(rowrI.data(), sizeof(result_type) * rowrI.size(), MPI_CHAR,
+               result.data(), sizeof(result_type) * rowrI.size(), MPI_CHAR,
+               MASTER, col_comm);
+  }
+
+
+  double time = timer.elapsed();
+
+  // Collect times to MASTER
+  comm_phase("timing");
+
+  // Receive buffers for master
+  double avgCompTime = 0;
+  double avgSplitTime = 0;
+  double avgShiftTime = 0;
+  double avgReduceTime = 0;
+
+  MPI_Reduce(&totalCompTime, &avgCompTime, 1, MPI_DOUBLE,
+             MPI_SUM, MASTER, MPI_COMM_WORLD);
+  avgCompTime /= P;
+
+  MPI_Reduce(&totalSplitTime, &avgSplitTime, 1, MPI_DOUBLE,
+             MPI_SUM, MASTER, MPI_COMM_WORLD);
+  avgSplitTime /= P;
+
+  MPI_Reduce(&totalShiftTime, &avgShiftTime, 1, MPI_DOUBLE,
+             MPI_SUM, MASTER, MPI_COMM_WORLD);
+  avgShiftTime /= P;
+
+  MPI_Reduce(&totalReduceTime, &avgReduceTime, 1, MPI_DOUBLE,
+             MPI_SUM, MASTER, MPI_COMM_WORLD);
+  avgReduceTime /= P;
+
+  // format output well
+  if (rank == MASTER) {
+    printf("Label\tComputation\tSplit\tShift\tReduce\n");
+    printf("q=%d\t%e\t%e\t%e\t%e\n", q, avgCompTime, avgSplitTime, avgShiftTime, avgReduceTime);
+    printf("Rank 0 Total Time: %e\n", time);
+    print_checksum(result, idiv_up(N,q));
+  }
+
+  // Check the result
+  if (rank == MASTER && checkErrors) {
+    std::string result_filename = "data/";
+    result_filename += std::string("invsq") + precision_tag(result_type())
+        + "_n" + std::to_string(N)
+        + "_s" + std::to_string(seed) + meta::distribution_tag(dist) + ".txt";
+
+    std::fstream result_file(result_filename);
+
+    if (result_file) {
+      std::cout << "Reading result from " << result_filename << std::endl;
+
+      // Read the previously computed results
+      std::vector<result_type> exact;
+      result_file >> exact;
+      assert(exact.size() == N);
+
+      print_error(exact, result);
+    } else {
+      std::cout << "Computing direct matvec..." << std::endl;
+
+      std::vector<result_type> exact(N);
+
+      // Compute the result with a direct matrix-vector multiplication
+      compTimer.start();
+      p2p(K, source.begin(), source.end(), charge.begin(), exact.begin());
+      double directCompTime = compTimer.elapsed();
+
+      print_error(exact, result);
+      std::cout << "DirectCompTime: " << directCompTime << std::endl;
+
+      // Open and write
+      result_file.open(result_filename, std::fstream::out);
+      result_file << exact << std::endl;
+    }
+  }
+
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,114 @@
+#include "Util.hpp"
+#include "KernelCheck.hpp"
+
+#include "kernel/NormSq.kern"
+#include "kernel/InvSq.kern"
+#include "kernel/Laplace.kern"
+#include "kernel/Yukawa.kern"
+#include "kernel/Gaussian.kern"
+#include "kernel/NonParaBayesian.kern"
+#include "kernel/ExpKernel.kern"
+#include "kernel/Stokes.kern"
+#include "kernel/UnitKernel.kern"
+
+#include <fstream>
+
+// Validation and performance cards of the kernels of kernel/
+//
+// For each kernel, check K.transpose against K on random pairs and the
+// symmetric P2P against the asymmetric P2P, and measure the P2P rates across
+// sizes and tile sizes. The card of each kernel is printed and written to
+// data/card_KERNEL.txt. Exits with 1 if any check fails.
+//
+// To check a new kernel, include its file and add it to the list in main.
+
+/** Write the card of @a K to the console and its file, return whether it passed */
+template <typename Kernel>
+bool card(const Kernel& K, const std::string& name,
+          unsigned n_min, unsigned n_max, unsigned pairs, double tol) {
+  std::ostringstream s;
+  const bool pass = kernel_check::kernel_card(K, name, s, n_min, n_max, pairs, tol);
+  std::cout << s.str() << std::endl;
+  std::ofstream file("data/card_" + name + precision_tag(real_type()) + ".txt");
+  file << s.str();
+  return pass;
+}
+
+int main(int argc, char** argv)
+{
+  std::string kernel = "all";
+  unsigned n_min = 256;
+  unsigned n_max = 4096;
+  unsigned pairs = 100000;
+
+  // Parse optional command line args
+  std::vector<std::string> arg(argv, argv + argc);
+  for (unsigned i = 1; i < arg.size(); ++i) {
+    if (arg[i] == "-kernel" || arg[i] == "-nmin" || arg[i] == "-nmax" ||
+        arg[i] == "-pairs") {
+      if (i+1 < arg.size()) {
+        if (arg[i] == "-kernel")
+          kernel = arg[i+1];
+        else if (arg[i] == "-nmin")
+          n_min = string_to_<unsigned>(arg[i+1]);
+        else if (arg[i] == "-nmax")
+          n_max = string_to_<unsigned>(arg[i+1]);
+        else
+          pairs = string_to_<unsigned>(arg[i+1]);
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << arg[i] << " option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  if (arg.size() > 1) {
+    std::cerr << "Usage: " << arg[0]
+              << " [-kernel all|normsq|invsq|laplace|laplacekernel|yukawa|yukawakernel|gaussian|bayes|exp|stokes|unit] [-nmin NMIN] [-nmax NMAX] [-pairs PAIRS]" << std::endl;
+    exit(1);
+  }
+
+  const int seed = 1337;
+  meta::default_generator.seed(seed);
+
+  // Agreement of differently ordered sums, loose enough for float kernels
+  const double tol = std::sqrt(std::numeric_limits<real_type>::epsilon());
+
+  bool pass = true;
+  bool found = false;
+  auto check = [&](const std::string& name) {
+    const bool run = kernel == "all" || kernel == name;
+    found |= run;
+    return run;
+  };
+  if (check("normsq"))
+    pass &= card(NormSqT<real_type>(), "normsq", n_min, n_max, pairs, tol);
+  if (check("invsq"))
+    pass &= card(InvSqT<real_type>(), "invsq", n_min, n_max, pairs, tol);
+  if (check("laplace"))
+    pass &= card(LaplacePotentialT<real_type>(), "laplace", n_min, n_max, pairs, tol);
+  if (check("laplacekernel"))
+    pass &= card(LaplaceKernelT<real_type>(), "laplacekernel", n_min, n_max, pairs, tol);
+  if (check("yukawa"))
+    pass &= card(YukawaPotentialT<real_type>(), "yukawa", n_min, n_max, pairs, tol);
+  if (check("yukawakernel"))
+    pass &= card(YukawaKernelT<real_type>(), "yukawakernel", n_min, n_max, pairs, tol);
+  if (check("gaussian"))
+    pass &= card(GaussianT<real_type>(), "gaussian", n_min, n_max, pairs, tol);
+  if (check("bayes"))
+    pass &= card(NonParaBayesianT<real_type>(1, 1), "bayes", n_min, n_max, pairs, tol);
+  if (check("exp"))
+    pass &= card(ExpPotentialT<real_type>(), "exp", n_min, n_max, pairs, tol);
+  if (check("stokes"))
+    pass &= card(StokesletT<real_type>(), "stokes", n_min, n_max, pairs, tol);
+  if (check("unit"))
+    pass &= card(UnitPotentialT<real_type>(), "unit", n_min, n_max, pairs, tol);
+
+  if (!found) {
+    std::cerr << "Unknown kernel " << kernel << std::endl;
+    return 1;
+  }
+  return pass ? 0 : 1;
+}
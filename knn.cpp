@@ -0,0 +1,258 @@
+// Exact k nearest neighbors by a top-k reduction on a team ring
+
+#include "Util.hpp"
+#include "CommProfile.hpp"
+#include "MemTrack.hpp"
+
+#include "kernel/NormSq.kern"
+#include "meta/random.hpp"
+#include "meta/distribution.hpp"
+
+// The number of neighbors of each point, the point itself included
+#if !defined(KNN_K)
+#  define KNN_K 8
+#endif
+
+int main(int argc, char** argv)
+{
+  bool checkErrors = true;
+  std::string dist = "uniform";
+  unsigned teamsize = 1;
+
+  // Parse optional command line args
+  std::vector<std::string> arg(argv, argv + argc);
+  for (unsigned i = 1; i < arg.size(); ++i) {
+    if (arg[i] == "-c") {
+      if (i+1 < arg.size()) {
+        teamsize = string_to_<unsigned>(arg[i+1]);
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-c option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+    if (arg[i] == "-nocheck") {
+      checkErrors = false;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+    }
+    if (arg[i] == "-dist") {
+      if (i+1 < arg.size()) {
+        dist = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-dist option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  if (arg.size() < 2) {
+    std::cerr << "Usage: " << arg[0] << " NUMPOINTS [-c TEAMSIZE] [-nocheck] [-dist DIST]" << std::endl;
+    exit(1);
+  }
+
+  if (!meta::is_distribution(dist)) {
+    std::cerr << "Unknown distribution " << dist << std::endl;
+    exit(1);
+  }
+
+  unsigned N = string_to_<int>(arg[1]);
+
+  MPI_Init(&argc, &argv);
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  int P;
+  MPI_Comm_size(MPI_COMM_WORLD, &P);
+
+  typedef NormSqT<real_type> kernel_type;
+  kernel_type K;
+
+  typedef kernel_type::source_type source_type;
+  typedef kernel_type::charge_type charge_type;
+  // The KNN_K smallest squared distances and their source indices
+  typedef TopK<real_type, KNN_K> result_type;
+  TopKReduction R;
+
+  typedef mem_track::tracked_allocator<source_type> source_alloc;
+  typedef mem_track::tracked_allocator<charge_type> charge_alloc;
+  typedef mem_track::tracked_allocator<result_type> result_alloc;
+
+  if (P % teamsize != 0) {
+    if (rank == MASTER)
+      printf("Quitting. The teamsize (c) must divide the total number of processors (p).\n");
+    MPI_Abort(MPI_COMM_WORLD, -1);
+    exit(0);
+  }
+
+  // Process data
+  const unsigned num_teams = P / teamsize;
+  const unsigned team  = rank / teamsize;
+  const unsigned trank = rank % teamsize;
+
+  if (N % num_teams != 0) {
+    if (rank == MASTER)
+      printf("Quitting. The number of teams must divide the number of points\n");
+    MPI_Abort(MPI_COMM_WORLD, -1);
+    exit(0);
+  }
+
+  if (rank == MASTER) {
+    // display metadata
+    std::cout << "N = " << N << std::endl;
+    std::cout << "P = " << P << std::endl;
+    std::cout << "Teamsize = " << teamsize << std::endl;
+    std::cout << "K = " << KNN_K << std::endl;
+  }
+
+  ////////////////////////
+  // Actual Computation //
+  ////////////////////////
+
+  Clock timer;
+  Clock compTimer;
+  Clock shiftTimer;
+  Clock reduceTimer;
+
+  double totalCompTime = 0;
+  double totalShiftTime = 0;
+  double totalReduceTime = 0;
+
+  timer.start();
+
+  /***********/
+  /** SETUP **/
+  /***********/
+
+  // Split comm into team and row communicators, the row rank is the team
+  MPI_Comm team_comm;
+  MPI_Comm_split(MPI_COMM_WORLD, team, rank, &team_comm);
+  MPI_Comm row_comm;
+  MPI_Comm_split(MPI_COMM_WORLD, trank, rank, &row_comm);
+
+  const int seed = 1337;
+  const unsigned n = N / num_teams;
+
+  // Every member generates the block of its team and the first block it
+  // visits, offset by its team rank, so no initial communication is needed
+  tracked_vector<source_type> xI(source_alloc("xI"));
+  tracked_vector<source_type> xJ(source_alloc("xJ"));
+  xI.reserve(n);
+  xJ.reserve(n);
+  meta::default_generator.seed(seed);
+  meta::distribution_block<source_type>(dist, seed, team*n, (team+1)*n, N,
+                                        std::back_inserter(xI));
+  const unsigned first_block = (team + trank) % num_teams;
+  meta::default_generator.seed(seed);
+  meta::distribution_block<source_type>(dist, seed, first_block*n,
+                                        (first_block+1)*n, N,
+                                        std::back_inserter(xJ));
+
+  // Unit charges: the values are the squared distances
+  tracked_vector<charge_type> cJ(n, charge_type(1), charge_alloc("cJ"));
+  tracked_vector<result_type> rI(n, R.identity<result_type>(),
+                                 result_alloc("rI"));
+
+  /********************/
+  /** ALL ITERATIONS **/
+  /********************/
+
+  // Member trank visits the blocks team + trank + k*teamsize
+  const unsigned num_iter = idiv_up(num_teams, teamsize);
+  const int src = (team + teamsize) % num_teams;
+  const int dst = (team - teamsize + num_teams) % num_teams;
+
+  for (unsigned k = 0; k < num_iter; ++k) {
+    if (trank + k*teamsize < num_teams) {
+      const unsigned block = (team + trank + k*teamsize) % num_teams;
+      compTimer.start();
+      p2p(K, R,
+          xJ.begin(), xJ.end(), cJ.begin(),
+          xI.begin(), xI.end(), rI.begin(),
+          (long long) block * n);
+      totalCompTime += compTimer.elapsed();
+    }
+
+    if (k+1 < num_iter) {
+      comm_phase("shift");
+      shiftTimer.start();
+      MPI_Sendrecv_replace(xJ.data(), sizeof(source_type) * xJ.size(), MPI_CHAR,
+                           dst, 0, src, 0, row_comm, MPI_STATUS_IGNORE);
+      totalShiftTime += shiftTimer.elapsed();
+    }
+  }
+
+  /********************/
+  /*** REDUCE STAGE ***/
+  /********************/
+
+  // Merge the neighbors found by the team members on the team leader
+  comm_phase("reduce");
+  reduceTimer.start();
+  reduce_results(rI, MASTER, team_comm, R);
+  totalReduceTime += reduceTimer.elapsed();
+
+  // Gather team leader answers to master
+  tracked_vector<result_type> result(result_alloc("result"));
+  if (rank == MASTER)
+    result.resize(N);
+  if (trank == MASTER) {
+    comm_phase("gather");
+    MPI_Gather(rI.data(), sizeof(result_type) * n, MPI_CHAR,
+               result.data(), sizeof(result_type) * n, MPI_CHAR,
+               MASTER, row_comm);
+  }
+
+  double time = timer.elapsed();
+
+  // Collect times to MASTER
+  comm_phase("timing");
+  double local[] = {totalCompTime, totalShiftTime, totalReduceTime};
+  double global[3];
+  MPI_Reduce(local, global, 3, MPI_DOUBLE, MPI_SUM, MASTER, MPI_COMM_WORLD);
+
+  // format output well
+  if (rank == MASTER) {
+    double kth = 0;
+    for (const result_type& r : result)
+      kth += std::sqrt(double(r.value[r.size-1]));
+
+    printf("Label\tComputation\tShift\tReduce\n");
+    printf("C=%d\t%e\t%e\t%e\n", teamsize, global[0] / P, global[1] / P, global[2] / P);
+    printf("Rank 0 Total Time: %e\n", time);
+    printf("Mean distance to neighbor %d: %e\n", KNN_K, kth / N);
+  }
+
+  // Check the result against a direct search on the master
+  if (rank == MASTER && checkErrors) {
+    std::cout << "Computing direct search..." << std::endl;
+
+    std::vector<source_type> x;
+    x.reserve(N);
+    meta::default_generator.seed(seed);
+    meta::distribution_block<source_type>(dist, seed, 0, N, N,
+                                          std::back_inserter(x));
+    std::vector<charge_type> c(N, charge_type(1));
+    std::vector<result_type> exact(N, R.identity<result_type>());
+
+    compTimer.start();
+    p2p(K, R, x.begin(), x.end(), c.begin(), x.begin(), x.end(), exact.begin());
+    double directCompTime = compTimer.elapsed();
+
+    unsigned mismatches = 0;
+    for (unsigned i = 0; i < N; ++i) {
+      bool same = exact[i].size == result[i].size;
+      for (unsigned k = 0; same && k < exact[i].size; ++k)
+        same = exact[i].value[k] == result[i].value[k]
+            && exact[i].index[k] == result[i].index[k];
+      mismatches += !same;
+    }
+    std::cout << "Mismatched neighbor lists: " << mismatches << std::endl;
+    std::cout << "DirectCompTime: " << directCompTime << std::endl;
+  }
+
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,174 @@
+#pragma once
+/** @file distribution.hpp
+ * @brief Seeded 3D particle distributions for benchmarking
+ *
+ * Except for "uniform", point i of a distribution is a function of the seed
+ * and i only. It is drawn from a counter-based generator keyed on (seed, i), so
+ * a process can generate any index range of the points in time proportional to
+ * the range.
+ *
+ * "uniform" is the unit cube sequence of meta::random on the default_generator,
+ * so results computed before the distributions were added stay comparable. It
+ * ignores the seed argument: seed the default_generator with it first. Its
+ * points are sequential, so a block of them costs O(total) draws.
+ * The others are centered on (0.5, 0.5, 0.5) and truncated to a few tenths:
+ *   plummer    Plummer sphere, scale radius 0.05, 99% of the mass
+ *   hernquist  Hernquist profile, scale radius 0.02, 95% of the mass
+ *   gaussian   8 Gaussian clusters of deviation 0.04 at random centers
+ *   shell      Thin spherical shell of radius 0.4 and thickness 0.005
+ *   powerlaw   Soneira-Peebles hierarchy of fractal dimension ln4/ln1.8 = 2.36
+ */
+
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <iterator>
+
+#include "meta/random.hpp"
+#include "numeric/Vec.hpp"
+
+namespace meta {
+
+/** The splitmix64 finalizer, a bijective mix of the bits of @a z */
+inline uint64_t hash64(uint64_t z) {
+  z += 0x9E3779B97F4A7C15ull;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+/** The key of element @a i of the sequence @a seed */
+inline uint64_t counter_key(uint64_t seed, uint64_t i) {
+  return hash64(hash64(seed) ^ i);
+}
+
+/** The uniform double in [0,1) number @a k of the key @a key */
+inline double counter_uniform(uint64_t key, uint64_t k) {
+  return (hash64(key ^ hash64(k)) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+namespace detail {
+
+typedef Vec<3,double> point3;
+
+/** A point uniform on the unit sphere from the draws @a u, @a v */
+inline point3 on_sphere(double u, double v) {
+  const double z = 2 * u - 1;
+  const double s = std::sqrt(1 - z * z);
+  const double phi = 2 * M_PI * v;
+  return point3(s * std::cos(phi), s * std::sin(phi), z);
+}
+
+/** A point uniform in the unit ball from the draws numbered k, k+1, k+2 */
+inline point3 in_ball(uint64_t key, uint64_t k) {
+  return on_sphere(counter_uniform(key, k), counter_uniform(key, k+1))
+      * std::cbrt(counter_uniform(key, k+2));
+}
+
+/** Three independent standard normal draws by Box-Muller from draws k..k+3 */
+inline point3 normal3(uint64_t key, uint64_t k) {
+  const double r0 = std::sqrt(-2 * std::log(1 - counter_uniform(key, k)));
+  const double t0 = 2 * M_PI * counter_uniform(key, k+1);
+  const double r1 = std::sqrt(-2 * std::log(1 - counter_uniform(key, k+2)));
+  const double t1 = 2 * M_PI * counter_uniform(key, k+3);
+  return point3(r0 * std::cos(t0), r0 * std::sin(t0), r1 * std::cos(t1));
+}
+
+/** Point @a i of distribution @a name, see the file comment */
+inline point3 distribution_point(const std::string& name,
+                                 uint64_t seed, uint64_t i) {
+  const point3 center(0.5, 0.5, 0.5);
+  const uint64_t key = counter_key(seed, i);
+
+  if (name == "plummer") {
+    // Invert the enclosed mass M(r) = r^3 / (r^2 + a^2)^(3/2)
+    const double a = 0.05;
+    const double m = 0.99 * counter_uniform(key, 0);
+    const double r = a / std::sqrt(std::pow(m, -2.0/3.0) - 1);
+    return center + r * on_sphere(counter_uniform(key, 1),
+                                  counter_uniform(key, 2));
+  }
+  if (name == "hernquist") {
+    // Invert the enclosed mass M(r) = r^2 / (r + a)^2
+    const double a = 0.02;
+    const double s = std::sqrt(0.95 * counter_uniform(key, 0));
+    const double r = a * s / (1 - s);
+    return center + r * on_sphere(counter_uniform(key, 1),
+                                  counter_uniform(key, 2));
+  }
+  if (name == "gaussian") {
+    const unsigned clusters = 8;
+    const double sigma = 0.04;
+    const unsigned c = unsigned(clusters * counter_uniform(key, 0));
+    // The cluster centers are keyed on the seed alone
+    const uint64_t ckey = counter_key(~seed, c);
+    const point3 cc(0.15 + 0.7 * counter_uniform(ckey, 0),
+                    0.15 + 0.7 * counter_uniform(ckey, 1),
+                    0.15 + 0.7 * counter_uniform(ckey, 2));
+    return cc + sigma * normal3(key, 1);
+  }
+  if (name == "shell") {
+    const double r = 0.4 + 0.005 * (counter_uniform(key, 0) - 0.5);
+    return center + r * on_sphere(counter_uniform(key, 1),
+                                  counter_uniform(key, 2));
+  }
+  if (name == "powerlaw") {
+    // Each level places eta subclusters in a ball of radius R around the
+    // center of their parent and shrinks R by lambda. The subcluster centers
+    // are keyed on the path from the root, so points sharing a path share
+    // the centers and cluster with a power-law correlation function.
+    const unsigned levels = 10;
+    const unsigned eta = 4;
+    const double lambda = 1.8;
+    double R = 0.35;
+    point3 p = center;
+    uint64_t path = hash64(seed);
+    for (unsigned l = 0; l < levels; ++l) {
+      const unsigned b = unsigned(eta * counter_uniform(key, l));
+      path = hash64(path * eta + b + 1);
+      p += R * in_ball(path, 0);
+      R /= lambda;
+    }
+    return p + R * in_ball(key, levels);
+  }
+  return center;
+}
+
+} // end namespace detail
+
+/** Whether @a name is a distribution of this file */
+inline bool is_distribution(const std::string& name) {
+  return name == "uniform" || name == "plummer" || name == "hernquist"
+      || name == "gaussian" || name == "shell" || name == "powerlaw";
+}
+
+/** The file name tag of @a name: empty for the uniform default */
+inline std::string distribution_tag(const std::string& name) {
+  return name == "uniform" ? std::string() : "_" + name;
+}
+
+/** Write the points with index in [first, last) of the @a total points of the
+ * distribution @a name and @a seed to @a out.
+ *
+ * "uniform" draws all @a total points from the default_generator, as
+ * random_block does, and ignores @a seed. The other distributions do not
+ * touch the default_generator.
+ */
+template <typename Point, typename OutIter>
+void distribution_block(const std::string& name, uint64_t seed,
+                        std::size_t first, std::size_t last, std::size_t total,
+                        OutIter out) {
+  if (name == "uniform") {
+    random_block<Point>(first, last, total, out);
+    return;
+  }
+  for (std::size_t i = first; i < last; ++i) {
+    const detail::point3 p = detail::distribution_point(name, seed, i);
+    Point q;
+    for (std::size_t d = 0; d != 3; ++d)
+      q[d] = p[d];
+    *out++ = q;
+  }
+}
+
+} // end namespace meta
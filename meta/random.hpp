@@ -21,11 +21,12 @@ struct random<double> {
   }
 };
 
+/** Floats are rounded doubles, so single precision data is the double
+ * precision data of the same seed rounded to float. */
 template <>
 struct random<float> {
   static float get(float a, float b) {
-    std::uniform_real_distribution<float> dist(a, b);
-    return dist(default_generator);
+    return float(random<double>::get(a, b));
   }
   static float get() {
     return get(0,1);
@@ -89,3 +90,20 @@ struct random<Vec<N,T> > {
   }
 };
 } // end namespace fmmtl
+
+
+namespace meta {
+/** Draw @a total random<T> values from the default generator and write those
+ * with index in [first, last) to @a out. A process can generate its block of
+ * a sequence without holding the rest of it.
+ */
+template <typename T, typename OutIter>
+void random_block(std::size_t first, std::size_t last, std::size_t total,
+                  OutIter out) {
+  for (std::size_t i = 0; i < total; ++i) {
+    T value = random<T>::get();
+    if (first <= i && i < last)
+      *out++ = value;
+  }
+}
+} // end namespace meta
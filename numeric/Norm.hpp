@@ -115,51 +115,56 @@ struct norm_type<Vec<N,T> > {
   typedef typename norm_type<T>::type type;
 };
 
-/** Compute the inner product of two Vecs */
-template <std::size_t N, typename T>
-inline typename norm_type<Vec<N,T> >::type inner_prod(const Vec<N,T>& a,
-                                                      const Vec<N,T>& b) {
+/** Compute the inner product of two Vec expressions */
+template <typename E1, typename E2, std::size_t N, typename T>
+inline typename norm_type<Vec<N,T> >::type inner_prod(const VecExpr<E1,N,T>& ea,
+                                                      const VecExpr<E2,N,T>& eb) {
+  const E1& a = ea.self();
+  const E2& b = eb.self();
   typename norm_type<Vec<N,T> >::type v = inner_prod(a[0],b[0]);
   for (std::size_t i = 1; i != N; ++i)
     v += inner_prod(a[i],b[i]);
   return v;
 }
-template <std::size_t N, typename T>
-inline typename norm_type<Vec<N,T> >::type dot(const Vec<N,T>& a,
-                                               const Vec<N,T>& b) {
+template <typename E1, typename E2, std::size_t N, typename T>
+inline typename norm_type<Vec<N,T> >::type dot(const VecExpr<E1,N,T>& a,
+                                               const VecExpr<E2,N,T>& b) {
   return inner_prod(a,b);
 }
 
-/** Compute the squared L2 norm of a Vec */
-template <std::size_t N, typename T>
-inline typename norm_type<Vec<N,T> >::type normSq(const Vec<N,T>& a) {
+/** Compute the squared L2 norm of a Vec expression */
+template <typename E, std::size_t N, typename T>
+inline typename norm_type<Vec<N,T> >::type normSq(const VecExpr<E,N,T>& ea) {
+  const E& a = ea.self();
   typename norm_type<Vec<N,T> >::type v = normSq(a[0]);
   for (std::size_t i = 1; i != N; ++i)
     v += normSq(a[i]);
   return v;
 }
-/** Compute the L2 norm of a Vec */
-template <std::size_t N, typename T>
-inline typename norm_type<Vec<N,T> >::type norm(const Vec<N,T>& a) {
+/** Compute the L2 norm of a Vec expression */
+template <typename E, std::size_t N, typename T>
+inline typename norm_type<Vec<N,T> >::type norm(const VecExpr<E,N,T>& a) {
   using std::sqrt;
   return sqrt(normSq(a));
 }
-template <std::size_t N, typename T>
-inline typename norm_type<Vec<N,T> >::type norm_2(const Vec<N,T>& a) {
+template <typename E, std::size_t N, typename T>
+inline typename norm_type<Vec<N,T> >::type norm_2(const VecExpr<E,N,T>& a) {
   return norm(a);
 }
-/** Compute the L1 norm of a Vec */
-template <std::size_t N, typename T>
-inline typename norm_type<Vec<N,T> >::type norm_1(const Vec<N,T>& a) {
+/** Compute the L1 norm of a Vec expression */
+template <typename E, std::size_t N, typename T>
+inline typename norm_type<Vec<N,T> >::type norm_1(const VecExpr<E,N,T>& ea) {
+  const E& a = ea.self();
   typename norm_type<Vec<N,T> >::type v = norm_1(a[0]);
   for (std::size_t i = 1; i != N; ++i)
     v += norm_1(a[i]);
   return v;
 }
-/** Compute the L-infinity norm of a Vec */
-template <std::size_t N, typename T>
-inline typename norm_type<Vec<N,T> >::type norm_inf(const Vec<N,T>& a) {
+/** Compute the L-infinity norm of a Vec expression */
+template <typename E, std::size_t N, typename T>
+inline typename norm_type<Vec<N,T> >::type norm_inf(const VecExpr<E,N,T>& ea) {
   using std::max;
+  const E& a = ea.self();
   typename norm_type<Vec<N,T> >::type v = norm_inf(a[0]);
   for (std::size_t i = 1; i != N; ++i)
     v = max(v, norm_inf(a[i]));
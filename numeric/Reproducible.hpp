@@ -0,0 +1,108 @@
+#pragma once
+/** @file Reproducible.hpp
+ * @brief Order-independent accumulators for bitwise reproducible sums
+ *
+ * Every term is rounded to a fixed-point integer with a fixed resolution
+ * (2^-62) and summed exactly in 128-bit integer arithmetic. The rounding of a
+ * term does not depend on the other terms and integer addition is
+ * associative, so the sum is the same for any order or grouping of the terms,
+ * i.e. for any P, teamsize, or thread count. The sum is rounded to the
+ * nearest floating point value only when it is read.
+ *
+ * Terms must satisfy |x| < 2^62 and the sum must satisfy |s| < 2^65.
+ */
+
+#include <cstdint>
+
+#include "numeric/Vec.hpp"
+
+/** Exact fixed-point accumulator of floating point values T */
+template <typename T>
+struct Reproducible {
+  typedef T              value_type;
+  typedef __int128       fixed_type;
+
+  static constexpr int frac_bits = 62;
+  /** 2^frac_bits, exact in double */
+  static constexpr double scale = 4611686018427387904.0;
+  /** The number of int64_t limbs used to communicate an accumulator */
+  static constexpr int limbs = 3;
+
+  fixed_type value;
+
+  Reproducible() : value(0) {}
+  explicit Reproducible(double x) : value(to_fixed(x)) {}
+
+  /** Round @a x towards zero to the fixed-point resolution */
+  static fixed_type to_fixed(double x) {
+    const int64_t i = int64_t(x);        // Integer part
+    const double  f = x - double(i);     // Exact fraction
+    return fixed_type(i) * (fixed_type(1) << frac_bits) + int64_t(f * scale);
+  }
+
+  Reproducible& operator+=(double x) {
+    value += to_fixed(x);
+    return *this;
+  }
+  Reproducible& operator+=(const Reproducible& b) {
+    value += b.value;
+    return *this;
+  }
+
+  /** The sum, rounded to the nearest T */
+  T get() const {
+    return T(double(value) * (1.0 / scale));
+  }
+
+  /** Split into limbs of 43 bits that can be summed as int64_t by up to
+   * 2^20 processes without overflow */
+  void to_limbs(int64_t* l) const {
+    const fixed_type mask = (fixed_type(1) << 43) - 1;
+    l[0] = int64_t(value & mask);
+    l[1] = int64_t((value >> 43) & mask);
+    l[2] = int64_t(value >> 86);
+  }
+  void from_limbs(const int64_t* l) {
+    value = fixed_type(l[0])
+        + fixed_type(l[1]) * (fixed_type(1) << 43)
+        + fixed_type(l[2]) * (fixed_type(1) << 86);
+  }
+};
+
+/** Exact fixed-point accumulator of Vecs, element-wise */
+template <std::size_t N, typename T>
+struct Reproducible<Vec<N,T>> {
+  typedef Vec<N,T>        value_type;
+  typedef Reproducible<T> elem_type;
+
+  static constexpr int limbs = N * elem_type::limbs;
+
+  elem_type elem[N];
+
+  Reproducible() {}
+  explicit Reproducible(const value_type& x) {
+    for (std::size_t i = 0; i != N; ++i) elem[i] = elem_type(x[i]);
+  }
+
+  Reproducible& operator+=(const value_type& x) {
+    for (std::size_t i = 0; i != N; ++i) elem[i] += x[i];
+    return *this;
+  }
+  Reproducible& operator+=(const Reproducible& b) {
+    for (std::size_t i = 0; i != N; ++i) elem[i] += b.elem[i];
+    return *this;
+  }
+
+  value_type get() const {
+    value_type v;
+    for (std::size_t i = 0; i != N; ++i) v[i] = elem[i].get();
+    return v;
+  }
+
+  void to_limbs(int64_t* l) const {
+    for (std::size_t i = 0; i != N; ++i) elem[i].to_limbs(l + i * elem_type::limbs);
+  }
+  void from_limbs(const int64_t* l) {
+    for (std::size_t i = 0; i != N; ++i) elem[i].from_limbs(l + i * elem_type::limbs);
+  }
+};
@@ -1,18 +1,55 @@
 #pragma once
 /** @file Vec.hpp
  * @brief A small N-dimensional numerical vector type that works on CPU and GPU.
+ *
+ * Arithmetic on Vecs builds lazy expressions (VecExpr) that are evaluated
+ * element by element, with the loop unrolled over an index_sequence, only
+ * when they are assigned to a Vec. Every element of an expression is rounded
+ * to T at every operation, so the results are the same as evaluating each
+ * operation into a temporary Vec.
+ *
+ * Expressions hold references to the Vecs they are built from: assign them to
+ * a Vec rather than keeping them in an auto variable.
  */
 
 #include <iostream>
 #include <cmath>
+#include <cstddef>
+#include <type_traits>
 
 #define for_i for(std::size_t i = 0; i != N; ++i)
 
+namespace vec_detail {
+
+/** C++11 std::index_sequence */
+template <std::size_t... I>
+struct index_sequence {};
+template <std::size_t N, std::size_t... I>
+struct make_index_sequence : make_index_sequence<N-1, N-1, I...> {};
+template <std::size_t... I>
+struct make_index_sequence<0, I...> : index_sequence<I...> {};
+
+} // end namespace vec_detail
+
+/** @class VecExpr
+ * @brief Base of the expressions of N elements of type T, with E the
+ * expression (CRTP)
+ */
+template <typename E, std::size_t N, typename T>
+struct VecExpr {
+  inline const E& self() const {
+    return static_cast<const E&>(*this);
+  }
+  inline T operator[](std::size_t i) const {
+    return self()[i];
+  }
+};
+
 /** @class Vec
  * @brief Class representing ND points and vectors.
  */
 template <std::size_t N, typename T = double>
-struct Vec {
+struct Vec : public VecExpr<Vec<N,T>, N, T> {
   T elem[N];
 
   typedef T               value_type;
@@ -25,11 +62,8 @@ struct Vec {
 
   // CONSTRUCTORS
 
-  inline Vec() {
-    for_i elem[i] = value_type();
-  }
-  // TODO: Force 0-initialization to get POD and trivial semantics?
-  //inline Vec() = default;
+  /** Uninitialized, Vec() value-initializes to zero */
+  inline Vec() = default;
   inline explicit Vec(value_type b) {
     for_i elem[i] = b;
   }
@@ -48,8 +82,18 @@ struct Vec {
     elem[0] = b0; elem[1] = b1; elem[2] = b2; elem[3] = b3;
     for(std::size_t i = 4; i != N; ++i) elem[i] = value_type();
   }
+  /** Evaluate the expression @a e */
+  template <typename E>
+  inline Vec(const VecExpr<E,N,T>& e) {
+    assign(e.self(), vec_detail::make_index_sequence<N>());
+  }
+  template <typename E>
+  inline Vec& operator=(const VecExpr<E,N,T>& e) {
+    assign(e.self(), vec_detail::make_index_sequence<N>());
+    return *this;
+  }
 
-  // COMPARATORS
+// COMPARATORS
 
   inline bool operator==(const Vec& b) const {
     for_i if (elem[i] != b[i]) return false;
@@ -63,46 +107,58 @@ struct Vec {
 
   /** Add scalar @a b to this Vec */
   template <typename D>
-  inline Vec& operator+=(const D& b) {
+  inline typename std::enable_if<std::is_arithmetic<D>::value, Vec&>::type
+  operator+=(const D& b) {
     for_i elem[i] += b;
     return *this;
   }
   /** Subtract scalar @a b from this Vec */
   template <typename D>
-  inline Vec& operator-=(const D& b) {
+  inline typename std::enable_if<std::is_arithmetic<D>::value, Vec&>::type
+  operator-=(const D& b) {
     for_i elem[i] -= b;
     return *this;
   }
   /** Scale this Vec up by scalar @a b */
   template <typename D>
-  inline Vec& operator*=(const D& b) {
+  inline typename std::enable_if<std::is_arithmetic<D>::value, Vec&>::type
+  operator*=(const D& b) {
     for_i elem[i] *= b;
     return *this;
   }
   /** Scale this Vec down by scalar @a b */
   template <typename D>
-  inline Vec& operator/=(const D& b) {
+  inline typename std::enable_if<std::is_arithmetic<D>::value, Vec&>::type
+  operator/=(const D& b) {
     for_i elem[i] /= b;
     return *this;
   }
-  /** Add Vec @a b to this Vec */
-  inline Vec& operator+=(const Vec& b) {
-    for_i elem[i] += b[i];
+  /** Add Vec expression @a b to this Vec */
+  template <typename E>
+  inline Vec& operator+=(const VecExpr<E,N,T>& b) {
+    const E& e = b.self();
+    for_i elem[i] += e[i];
     return *this;
   }
-  /** Subtract Vec @a b from this Vec */
-  inline Vec& operator-=(const Vec& b) {
-    for_i elem[i] -= b[i];
+  /** Subtract Vec expression @a b from this Vec */
+  template <typename E>
+  inline Vec& operator-=(const VecExpr<E,N,T>& b) {
+    const E& e = b.self();
+    for_i elem[i] -= e[i];
     return *this;
   }
   /** Scale this Vec up by factors in @a b */
-  inline Vec& operator*=(const Vec& b) {
-    for_i elem[i] *= b[i];
+  template <typename E>
+  inline Vec& operator*=(const VecExpr<E,N,T>& b) {
+    const E& e = b.self();
+    for_i elem[i] *= e[i];
     return *this;
   }
   /** Scale this Vec down by factors in @a b */
-  inline Vec& operator/=(const Vec& b) {
-    for_i elem[i] /= b[i];
+  template <typename E>
+  inline Vec& operator/=(const VecExpr<E,N,T>& b) {
+    const E& e = b.self();
+    for_i elem[i] /= e[i];
     return *this;
   }
 
@@ -132,6 +188,13 @@ struct Vec {
   inline iterator          end()       { return elem+N; }
   inline const_iterator    end() const { return elem+N; }
   inline const_iterator   cend() const { return elem+N; }
+
+ private:
+  template <typename E, std::size_t... I>
+  inline void assign(const E& e, vec_detail::index_sequence<I...>) {
+    const int unrolled[] = {(elem[I] = e[I], 0)...};
+    (void) unrolled;
+  }
 };
 
 // OPERATORS
@@ -157,75 +220,128 @@ inline Vec<3,T> cross(const Vec<3,T>& a, const Vec<3,T>& b) {
                   a[0]*b[1] - a[1]*b[0]);
 }
 
+// EXPRESSIONS
+
+namespace vec_detail {
+
+/** Vecs are held by reference in expressions, expressions by value */
+template <typename E>
+struct operand {
+  typedef E type;
+};
+template <std::size_t N, typename T>
+struct operand<Vec<N,T> > {
+  typedef const Vec<N,T>& type;
+};
+
+struct add { template <typename A, typename B>
+  static inline auto apply(const A& a, const B& b) -> decltype(a+b) { return a+b; } };
+struct sub { template <typename A, typename B>
+  static inline auto apply(const A& a, const B& b) -> decltype(a-b) { return a-b; } };
+struct mul { template <typename A, typename B>
+  static inline auto apply(const A& a, const B& b) -> decltype(a*b) { return a*b; } };
+struct div { template <typename A, typename B>
+  static inline auto apply(const A& a, const B& b) -> decltype(a/b) { return a/b; } };
+
+} // end namespace vec_detail
+
+/** A scalar broadcast to all N elements of an expression */
+template <typename D>
+struct VecScalar {
+  D value;
+  explicit VecScalar(const D& v) : value(v) {}
+  inline const D& operator[](std::size_t) const { return value; }
+};
+
+/** The element-wise Op of two expressions or an expression and a scalar */
+template <typename Op, typename E1, typename E2, std::size_t N, typename T>
+struct VecBinary : public VecExpr<VecBinary<Op,E1,E2,N,T>, N, T> {
+  typename vec_detail::operand<E1>::type a;
+  typename vec_detail::operand<E2>::type b;
+
+  VecBinary(const E1& _a, const E2& _b) : a(_a), b(_b) {}
+  inline T operator[](std::size_t i) const {
+    return T(Op::apply(a[i], b[i]));
+  }
+};
+
+/** The element-wise negation of an expression */
+template <typename E, std::size_t N, typename T>
+struct VecNegate : public VecExpr<VecNegate<E,N,T>, N, T> {
+  typename vec_detail::operand<E>::type a;
+
+  explicit VecNegate(const E& _a) : a(_a) {}
+  inline T operator[](std::size_t i) const {
+    return -a[i];
+  }
+};
+
+/** The return type of scalar operators, for arithmetic D only */
+template <typename D, typename R>
+using if_scalar = typename std::enable_if<std::is_arithmetic<D>::value, R>::type;
+
 // ARITHMETIC OPERATORS
 
 /** Unary negation: Return -@a a */
-template <std::size_t N, typename T>
-inline Vec<N,T> operator-(Vec<N,T> a) {
-  for_i a[i] = -a[i];
-  return a;
+template <typename E, std::size_t N, typename T>
+inline VecNegate<E,N,T> operator-(const VecExpr<E,N,T>& a) {
+  return VecNegate<E,N,T>(a.self());
 }
 /** Unary plus: Return @a a. ("+a" should work if "-a" works.) */
-template <std::size_t N, typename T>
-inline Vec<N,T> operator+(const Vec<N,T>& a) {
-  return a;
-}
-template <std::size_t N, typename T>
-inline Vec<N,T> operator+(Vec<N,T> a, const Vec<N,T>& b) {
-  return a += b;
-}
-template <std::size_t N, typename T, typename D>
-inline Vec<N,T> operator+(Vec<N,T> a, const D& b) {
-  return a += b;
-}
-template <std::size_t N, typename T, typename D>
-inline Vec<N,T> operator+(const D& b, Vec<N,T> a) {
-  return a += b;
+template <typename E, std::size_t N, typename T>
+inline const E& operator+(const VecExpr<E,N,T>& a) {
+  return a.self();
 }
-template <std::size_t N, typename T>
-inline Vec<N,T> operator-(Vec<N,T> a, const Vec<N,T>& b) {
-  return a -= b;
-}
-template <std::size_t N, typename T, typename D>
-inline Vec<N,T> operator-(Vec<N,T> a, const D& b) {
-  return a -= b;
-}
-template <std::size_t N, typename T, typename D>
-inline Vec<N,T> operator-(const D& b, const Vec<N,T>& a) {
-  return (-a) += b;
-}
-template <std::size_t N, typename T>
-inline Vec<N,T> operator*(Vec<N,T> a, const Vec<N,T>& b) {
-  return a *= b;
-}
-template <std::size_t N, typename T, typename D>
-inline Vec<N,T> operator*(Vec<N,T> a, const D& b) {
-  return a *= b;
+
+#define VEC_BINARY_OPERATOR(OP, NAME)                                         \
+template <typename E1, typename E2, std::size_t N, typename T>                \
+inline VecBinary<vec_detail::NAME,E1,E2,N,T>                                  \
+operator OP(const VecExpr<E1,N,T>& a, const VecExpr<E2,N,T>& b) {             \
+  return VecBinary<vec_detail::NAME,E1,E2,N,T>(a.self(), b.self());           \
+}                                                                             \
+template <typename E, std::size_t N, typename T, typename D>                  \
+inline if_scalar<D, VecBinary<vec_detail::NAME,E,VecScalar<D>,N,T> >          \
+operator OP(const VecExpr<E,N,T>& a, const D& b) {                            \
+  return VecBinary<vec_detail::NAME,E,VecScalar<D>,N,T>(a.self(),             \
+                                                         VecScalar<D>(b));    \
 }
-template <std::size_t N, typename T, typename D>
-inline Vec<N,T> operator*(const D& b, Vec<N,T> a) {
-  return a *= b;
+
+VEC_BINARY_OPERATOR(+, add)
+VEC_BINARY_OPERATOR(-, sub)
+VEC_BINARY_OPERATOR(*, mul)
+VEC_BINARY_OPERATOR(/, div)
+
+#undef VEC_BINARY_OPERATOR
+
+template <typename E, std::size_t N, typename T, typename D>
+inline if_scalar<D, VecBinary<vec_detail::add,E,VecScalar<D>,N,T> >
+operator+(const D& b, const VecExpr<E,N,T>& a) {
+  return a + b;
 }
-template <std::size_t N, typename T>
-inline Vec<N,T> operator/(Vec<N,T> a, const Vec<N,T>& b) {
-  return a /= b;
+template <typename E, std::size_t N, typename T, typename D>
+inline if_scalar<D, VecBinary<vec_detail::add,VecNegate<E,N,T>,VecScalar<D>,N,T> >
+operator-(const D& b, const VecExpr<E,N,T>& a) {
+  return (-a) + b;
 }
-template <std::size_t N, typename T, typename D>
-inline Vec<N,T> operator/(Vec<N,T> a, const D& b) {
-  return a /= b;
+template <typename E, std::size_t N, typename T, typename D>
+inline if_scalar<D, VecBinary<vec_detail::mul,E,VecScalar<D>,N,T> >
+operator*(const D& b, const VecExpr<E,N,T>& a) {
+  return a * b;
 }
 
 // ELEMENTWISE OPERATORS
 
-template <std::size_t N, typename T>
-inline Vec<N,T> abs(Vec<N,T> a) {
+template <typename E, std::size_t N, typename T>
+inline Vec<N,T> abs(const VecExpr<E,N,T>& e) {
   using std::abs;
+  Vec<N,T> a = e;
   for_i a[i] = abs(a[i]);
   return a;
 }
-template <std::size_t N, typename T>
-inline Vec<N,T> sqrt(Vec<N,T> a) {
+template <typename E, std::size_t N, typename T>
+inline Vec<N,T> sqrt(const VecExpr<E,N,T>& e) {
   using std::sqrt;
+  Vec<N,T> a = e;
   for_i a[i] = sqrt(a[i]);
   return a;
 }
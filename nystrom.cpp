@@ -0,0 +1,227 @@
+#include "Util.hpp"
+#include "CommProfile.hpp"
+#include "Nystrom.hpp"
+
+#include "kernel/Gaussian.kern"
+#include "kernel/NonParaBayesian.kern"
+#include "meta/random.hpp"
+#include "meta/distribution.hpp"
+
+// Nystrom low-rank matvec of a smooth kernel
+//
+// The master generates the points and charges and scatters equal blocks. The
+// processes select the landmarks together, factor K(l,l), and apply the
+// factored approximation ITERS times, the setup shared by all matvecs. The
+// master checks the last matvec against the direct sum.
+
+/** The source of a kernel from a point of a distribution */
+inline void from_point(const Vec<3,double>& p, double& s) {
+  s = p[0];
+}
+template <typename T>
+inline void from_point(const Vec<3,double>& p, Vec<3,T>& s) {
+  for (unsigned d = 0; d != 3; ++d)
+    s[d] = p[d];
+}
+
+template <typename Kernel>
+void run(const Kernel& K, unsigned N, const std::string& dist, unsigned m,
+         Landmarks how, unsigned iters, bool checkErrors) {
+  typedef typename Kernel::source_type source_type;
+  typedef typename Kernel::charge_type charge_type;
+  typedef typename Kernel::result_type result_type;
+
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  int P;
+  MPI_Comm_size(MPI_COMM_WORLD, &P);
+
+  const int seed = 1337;
+
+  std::vector<source_type> source;
+  std::vector<charge_type> charge;
+  if (rank == MASTER) {
+    // generate source data
+    std::vector<Vec<3,double>> point;
+    meta::default_generator.seed(seed);
+    meta::distribution_block<Vec<3,double>>(dist, seed, 0, N, N,
+                                            std::back_inserter(point));
+    source.resize(N);
+    for (unsigned i = 0; i < N; ++i)
+      from_point(point[i], source[i]);
+
+    // generate charge data
+    for (unsigned i = 0; i < N; ++i)
+      charge.push_back(meta::random<charge_type>::get());
+  }
+
+  Clock timer;
+  Clock commTimer;
+  Clock selectTimer;
+  Clock applyTimer;
+
+  timer.start();
+
+  // Scatter the data to all processes
+  const unsigned n = N / P;
+  std::vector<source_type> xI(n);
+  std::vector<charge_type> cI(n);
+  comm_phase("scatter");
+  commTimer.start();
+  MPI_Scatter(source.data(), sizeof(source_type) * n, MPI_CHAR,
+              xI.data(), sizeof(source_type) * n, MPI_CHAR,
+              MASTER, MPI_COMM_WORLD);
+  MPI_Scatter(charge.data(), sizeof(charge_type) * n, MPI_CHAR,
+              cI.data(), sizeof(charge_type) * n, MPI_CHAR,
+              MASTER, MPI_COMM_WORLD);
+  double totalCommTime = commTimer.elapsed();
+
+  // Select the landmarks and factor their block
+  comm_phase("setup");
+  selectTimer.start();
+  Nystrom<Kernel> A(K, xI.begin(), xI.end(), m, how, seed, MPI_COMM_WORLD);
+  const double setupTime = selectTimer.elapsed();
+
+  // Apply the cached factors
+  comm_phase("apply");
+  std::vector<result_type> rI(n);
+  applyTimer.start();
+  for (unsigned k = 0; k < iters; ++k) {
+    std::fill(rI.begin(), rI.end(), result_type());
+    A.apply(xI.begin(), xI.end(), cI.begin(), rI.begin());
+  }
+  const double applyTime = applyTimer.elapsed() / iters;
+
+  std::vector<result_type> result;
+  if (rank == MASTER)
+    result.resize(N);
+  comm_phase("gather");
+  commTimer.start();
+  MPI_Gather(rI.data(), sizeof(result_type) * n, MPI_CHAR,
+             result.data(), sizeof(result_type) * n, MPI_CHAR,
+             MASTER, MPI_COMM_WORLD);
+  totalCommTime += commTimer.elapsed();
+
+  double time = timer.elapsed();
+
+  if (rank == MASTER) {
+    std::cout << "Rank = " << A.rank() << std::endl;
+    printf("Label\tSetup\tApply\tComm\n");
+    printf("P=%d\t%e\t%e\t%e\n", P, setupTime, applyTime, totalCommTime);
+    printf("Rank 0 Total Time: %e\n", time);
+  }
+
+  // Check the result
+  if (rank == MASTER && checkErrors) {
+    std::cout << "Computing direct matvec..." << std::endl;
+
+    std::vector<result_type> exact(N);
+
+    // Compute the result with a direct matrix-vector multiplication
+    Clock compTimer;
+    compTimer.start();
+    p2p(K, source.begin(), source.end(), charge.begin(),
+        source.begin(), source.end(), exact.begin());
+    double directCompTime = compTimer.elapsed();
+
+    print_error(exact, result);
+    std::cout << "DirectCompTime: " << directCompTime << std::endl;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  bool checkErrors = true;
+  std::string dist = "uniform";
+  std::string kernel = "gaussian";
+  std::string landmarks = "kmeans++";
+  unsigned m = 128;
+  unsigned iters = 5;
+  double h = 0.5;
+
+  // Parse optional command line args
+  std::vector<std::string> arg(argv, argv + argc);
+  for (unsigned i = 1; i < arg.size(); ++i) {
+    if (arg[i] == "-nocheck") {
+      checkErrors = false;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+      continue;
+    }
+    if (arg[i] == "-m" || arg[i] == "-landmarks" || arg[i] == "-kernel" ||
+        arg[i] == "-iters" || arg[i] == "-h" || arg[i] == "-dist") {
+      if (i+1 < arg.size()) {
+        if (arg[i] == "-m")
+          m = string_to_<unsigned>(arg[i+1]);
+        else if (arg[i] == "-landmarks")
+          landmarks = arg[i+1];
+        else if (arg[i] == "-kernel")
+          kernel = arg[i+1];
+        else if (arg[i] == "-iters")
+          iters = string_to_<unsigned>(arg[i+1]);
+        else if (arg[i] == "-h")
+          h = string_to_<double>(arg[i+1]);
+        else
+          dist = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << arg[i] << " option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  if (arg.size() < 2) {
+    std::cerr << "Usage: " << arg[0] << " NUMPOINTS [-m LANDMARKS] [-landmarks random|kmeans++] [-kernel gaussian|bayes] [-h BANDWIDTH] [-iters ITERS] [-nocheck] [-dist DIST]" << std::endl;
+    exit(1);
+  }
+
+  if (!meta::is_distribution(dist)) {
+    std::cerr << "Unknown distribution " << dist << std::endl;
+    exit(1);
+  }
+
+  if (landmarks != "random" && landmarks != "kmeans++") {
+    std::cerr << "Unknown landmark selection " << landmarks << std::endl;
+    exit(1);
+  }
+  const Landmarks how = landmarks == "random" ? Landmarks::random : Landmarks::kmeanspp;
+
+  if (kernel != "gaussian" && kernel != "bayes") {
+    std::cerr << "Unknown kernel " << kernel << std::endl;
+    exit(1);
+  }
+
+  unsigned N = string_to_<int>(arg[1]);
+  iters = std::max(1u, iters);
+
+  MPI_Init(&argc, &argv);
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  int P;
+  MPI_Comm_size(MPI_COMM_WORLD, &P);
+
+  if (N % P != 0) {
+    if (rank == MASTER)
+      printf("Quitting. The number of processors must divide the number of points.\n");
+    MPI_Abort(MPI_COMM_WORLD, -1);
+    exit(0);
+  }
+
+  if (rank == MASTER) {
+    // display metadata
+    std::cout << "N = " << N << std::endl;
+    std::cout << "P = " << P << std::endl;
+    std::cout << "Kernel = " << kernel << std::endl;
+    std::cout << "Landmarks = " << m << " " << landmarks << std::endl;
+  }
+
+  if (kernel == "gaussian")
+    run(GaussianT<real_type>(h), N, dist, m, how, iters, checkErrors);
+  else
+    run(NonParaBayesian(1, 1), N, dist, m, how, iters, checkErrors);
+
+  MPI_Finalize();
+  return 0;
+}
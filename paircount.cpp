@@ -0,0 +1,334 @@
+// Pair-distance histograms and two-point correlation on a symmetric ring
+
+#include "Util.hpp"
+#include "CommProfile.hpp"
+#include "MemTrack.hpp"
+#include "PairCount.hpp"
+
+#include "meta/random.hpp"
+#include "meta/distribution.hpp"
+
+typedef Vec<3,real_type> point_type;
+typedef tracked_vector<point_type> point_vector;
+
+/** Timers of the ring, summed over the calls of ring_count */
+struct RingTimes {
+  double comp = 0;
+  double shift = 0;
+  double reduce = 0;
+};
+
+/** Count the pairs of the blocks of all ranks of @a comm into @a hist on
+ * @a root. Each rank owns the block @a xI, and @a xJ starts as the block the
+ * pairs are counted with on this rank, which it circulates around the ring.
+ *
+ * If @a symmetric, xJ starts as a copy of xI and each unordered pair of
+ * points of the blocks is counted once: the diagonal of the own block and
+ * the blocks of the next P/2 ranks. Otherwise xJ is a second set of points
+ * and all pairs of xI with all blocks of xJ are counted in P steps.
+ */
+void ring_count(const PairBins& bins, const point_vector& xI, point_vector& xJ,
+                bool symmetric, PairHistogram& hist, int root, MPI_Comm comm,
+                RingTimes& t) {
+  int rank, P;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &P);
+  const int dst = (rank - 1 + P) % P;
+  const int src = (rank + 1) % P;
+
+  PairHistogram local(bins.size());
+  Clock timer;
+
+  // Zeroth iteration
+  timer.start();
+  if (symmetric)
+    pair_count(bins, xI.data(), xI.data() + xI.size(), local.data());
+  else
+    pair_count(bins, xI.data(), xI.data() + xI.size(),
+                     xJ.data(), xJ.data() + xJ.size(), local.data());
+  t.comp += timer.elapsed();
+
+  const int last_iter = symmetric ? P/2 : P-1;
+  for (int k = 1; k <= last_iter; ++k) {
+    // Shift xJ, after k shifts it is the block of rank + k
+    comm_phase("shift");
+    timer.start();
+    MPI_Sendrecv_replace(xJ.data(), sizeof(point_type) * xJ.size(), MPI_CHAR,
+                         dst, 0, src, 0, comm, MPI_STATUS_IGNORE);
+    t.shift += timer.elapsed();
+
+    // With P even, the blocks P/2 apart meet twice: only the lower rank counts
+    if (symmetric && 2*k == P && rank >= P/2)
+      continue;
+
+    timer.start();
+    pair_count(bins, xI.data(), xI.data() + xI.size(),
+                     xJ.data(), xJ.data() + xJ.size(), local.data());
+    t.comp += timer.elapsed();
+  }
+
+  // Reduce the histograms to the root
+  comm_phase("reduce");
+  timer.start();
+  hist.assign(bins.size(), 0);
+  MPI_Reduce(local.data(), hist.data(), local.size(), MPI_UNSIGNED_LONG_LONG,
+             MPI_SUM, root, comm);
+  t.reduce += timer.elapsed();
+}
+
+/** Points [first, last) of the random catalog of @a seed, uniform in the box
+ * [lo, hi)
+ */
+template <typename OutIter>
+void random_catalog(uint64_t seed, const double* lo, const double* hi,
+                    std::size_t first, std::size_t last, OutIter out) {
+  for (std::size_t i = first; i < last; ++i) {
+    const uint64_t key = meta::counter_key(seed, i);
+    point_type p;
+    for (unsigned d = 0; d != 3; ++d)
+      p[d] = lo[d] + (hi[d] - lo[d]) * meta::counter_uniform(key, d);
+    *out++ = p;
+  }
+}
+
+/** The number of bins where @a exact and @a result differ */
+unsigned count_mismatches(const PairHistogram& exact, const PairHistogram& result) {
+  unsigned m = 0;
+  for (unsigned k = 0; k < exact.size(); ++k)
+    m += exact[k] != result[k];
+  return m;
+}
+
+int main(int argc, char** argv)
+{
+  bool checkErrors = true;
+  std::string dist = "uniform";
+  unsigned nbins = 20;
+  double rmin = 0.001;
+  double rmax = 0.5;
+  bool linear = false;
+  bool xi = false;
+
+  // Parse optional command line args
+  std::vector<std::string> arg(argv, argv + argc);
+  for (unsigned i = 1; i < arg.size(); ++i) {
+    if (arg[i] == "-bins") {
+      if (i+1 < arg.size()) {
+        nbins = string_to_<unsigned>(arg[i+1]);
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-bins option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+    if (arg[i] == "-rmin") {
+      if (i+1 < arg.size()) {
+        rmin = string_to_<double>(arg[i+1]);
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-rmin option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+    if (arg[i] == "-rmax") {
+      if (i+1 < arg.size()) {
+        rmax = string_to_<double>(arg[i+1]);
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-rmax option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+    if (arg[i] == "-linear") {
+      linear = true;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+    }
+    if (arg[i] == "-xi") {
+      xi = true;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+    }
+    if (arg[i] == "-nocheck") {
+      checkErrors = false;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+    }
+    if (arg[i] == "-dist") {
+      if (i+1 < arg.size()) {
+        dist = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-dist option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  if (arg.size() < 2) {
+    std::cerr << "Usage: " << arg[0] << " NUMPOINTS [-bins NBINS] [-rmin R] [-rmax R] [-linear] [-xi] [-nocheck] [-dist DIST]" << std::endl;
+    exit(1);
+  }
+
+  if (!meta::is_distribution(dist)) {
+    std::cerr << "Unknown distribution " << dist << std::endl;
+    exit(1);
+  }
+
+  if (nbins == 0 || !(rmin < rmax) || rmin < 0 || (!linear && rmin == 0)) {
+    std::cerr << "Need NBINS > 0 and 0 <= rmin < rmax, rmin > 0 for logarithmic bins" << std::endl;
+    exit(1);
+  }
+
+  unsigned N = string_to_<int>(arg[1]);
+
+  MPI_Init(&argc, &argv);
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  int P;
+  MPI_Comm_size(MPI_COMM_WORLD, &P);
+
+  if (N % P != 0) {
+    if (rank == MASTER)
+      printf("Quitting. The number of processors must divide the number of points\n");
+    MPI_Abort(MPI_COMM_WORLD, -1);
+    exit(0);
+  }
+
+  const PairBins bins(rmin, rmax, nbins, !linear);
+  typedef mem_track::tracked_allocator<point_type> point_alloc;
+
+  const int seed = 1337;
+  const unsigned n = N / P;
+
+  if (rank == MASTER) {
+    // display metadata
+    std::cout << "N = " << N << std::endl;
+    std::cout << "P = " << P << std::endl;
+    std::cout << "Bins = " << nbins << (linear ? " linear" : " logarithmic")
+              << " in [" << rmin << ", " << rmax << ")" << std::endl;
+  }
+
+  ////////////////////////
+  // Actual Computation //
+  ////////////////////////
+
+  Clock timer;
+  RingTimes times;
+  timer.start();
+
+  // Every rank generates its block of the sequence of the master, and sorts
+  // it along a Morton curve for the bounding box pruning
+  point_vector xI(point_alloc("xI"));
+  xI.reserve(n);
+  meta::default_generator.seed(seed);
+  meta::distribution_block<point_type>(dist, seed, rank*n, (rank+1)*n, N,
+                                       std::back_inserter(xI));
+  morton_sort(xI.data(), xI.data() + n);
+
+  // DD: the data pairs
+  PairHistogram DD, DR, RR;
+  point_vector xJ(xI.begin(), xI.end(), point_alloc("xJ"));
+  ring_count(bins, xI, xJ, true, DD, MASTER, MPI_COMM_WORLD, times);
+
+  // The random catalog is uniform in the bounding box of the data
+  double lo[3], hi[3];
+  if (xi) {
+    double box[6];
+    for (unsigned d = 0; d != 3; ++d) {
+      box[d]   = -double(xI[0][d]);
+      box[d+3] = double(xI[0][d]);
+      for (const point_type& p : xI) {
+        box[d]   = std::max(box[d],   -double(p[d]));
+        box[d+3] = std::max(box[d+3],  double(p[d]));
+      }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, box, 6, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    for (unsigned d = 0; d != 3; ++d) {
+      lo[d] = -box[d];
+      hi[d] = box[d+3];
+    }
+
+    point_vector rI(point_alloc("rI"));
+    rI.reserve(n);
+    random_catalog(seed + 1, lo, hi, rank*n, (rank+1)*n, std::back_inserter(rI));
+    morton_sort(rI.data(), rI.data() + n);
+
+    // DR: the data with all blocks of the random catalog
+    xJ.assign(rI.begin(), rI.end());
+    ring_count(bins, xI, xJ, false, DR, MASTER, MPI_COMM_WORLD, times);
+
+    // RR: the random pairs
+    xJ.assign(rI.begin(), rI.end());
+    ring_count(bins, rI, xJ, true, RR, MASTER, MPI_COMM_WORLD, times);
+  }
+
+  double time = timer.elapsed();
+
+  // Collect times to MASTER
+  comm_phase("timing");
+  double local[] = {times.comp, times.shift, times.reduce};
+  double global[3];
+  MPI_Reduce(local, global, 3, MPI_DOUBLE, MPI_SUM, MASTER, MPI_COMM_WORLD);
+
+  // format output well
+  if (rank == MASTER) {
+    const double nDD = 0.5 * N * (N - 1.0);
+    const double nDR = double(N) * N;
+
+    printf("Bin\tLower\tUpper\tDD%s\n", xi ? "\tDR\tRR\tXi" : "");
+    for (unsigned k = 1; k <= nbins; ++k) {
+      printf("%u\t%e\t%e\t%llu", k, bins.edge(k), bins.edge(k+1), DD[k]);
+      if (xi) {
+        // Landy-Szalay estimator of the normalized counts
+        const double dd = DD[k] / nDD, dr = DR[k] / nDR, rr = RR[k] / nDD;
+        printf("\t%llu\t%llu\t%e", DR[k], RR[k],
+               rr > 0 ? (dd - 2*dr + rr) / rr : 0.0);
+      }
+      printf("\n");
+    }
+    printf("Below rmin: %llu\tBeyond rmax: %llu\n", DD[0], DD[nbins+1]);
+
+    printf("Label\tComputation\tShift\tReduce\n");
+    printf("P=%d\t%e\t%e\t%e\n", P, global[0] / P, global[1] / P, global[2] / P);
+    printf("Rank 0 Total Time: %e\n", time);
+  }
+
+  // Check the result against a direct count of all pairs
+  if (rank == MASTER && checkErrors) {
+    std::cout << "Computing direct pair count..." << std::endl;
+
+    Clock directTimer;
+    point_vector x(point_alloc("x"));
+    x.reserve(N);
+    meta::default_generator.seed(seed);
+    meta::distribution_block<point_type>(dist, seed, 0, N, N,
+                                         std::back_inserter(x));
+    PairHistogram exact(bins.size());
+    detail::block_count(bins, x.data(), x.data() + N, exact.data());
+    unsigned mismatches = count_mismatches(exact, DD);
+
+    if (xi) {
+      point_vector r(point_alloc("r"));
+      r.reserve(N);
+      random_catalog(seed + 1, lo, hi, 0, N, std::back_inserter(r));
+      exact.assign(bins.size(), 0);
+      detail::block_count(bins, x.data(), x.data() + N,
+                                r.data(), r.data() + N, exact.data());
+      mismatches += count_mismatches(exact, DR);
+      exact.assign(bins.size(), 0);
+      detail::block_count(bins, r.data(), r.data() + N, exact.data());
+      mismatches += count_mismatches(exact, RR);
+    }
+
+    std::cout << "Mismatched bins: " << mismatches << std::endl;
+    std::cout << "DirectCompTime: " << directTimer.elapsed() << std::endl;
+  }
+
+  MPI_Finalize();
+  return 0;
+}
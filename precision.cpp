@@ -0,0 +1,154 @@
+#include "Util.hpp"
+
+#include "meta/kernel_traits.hpp"
+#include "meta/random.hpp"
+#include "meta/distribution.hpp"
+
+#include "kernel/InvSq.kern"
+#include "kernel/Laplace.kern"
+#include "kernel/Yukawa.kern"
+
+#include <iomanip>
+
+// Single vs double precision throughput and error of the P2P evaluation
+
+/** Widen a result to double precision */
+inline double to_double(double r) {
+  return r;
+}
+template <std::size_t N, typename T>
+inline Vec<N,double> to_double(const Vec<N,T>& r) {
+  Vec<N,double> v;
+  for (std::size_t i = 0; i != N; ++i)
+    v[i] = r[i];
+  return v;
+}
+
+/** Evaluate KernelT<T> on the @a N points of @a dist and @a seed with the
+ * symmetric diagonal P2P, returning the widened results and the time in @a time.
+ */
+template <template <typename> class KernelT, typename T>
+std::vector<typename KernelT<double>::result_type>
+run(unsigned N, const std::string& dist, int seed, double& time) {
+  typedef KernelT<T> kernel_type;
+  kernel_type K;
+
+  typedef typename kernel_type::source_type source_type;
+  typedef typename kernel_type::charge_type charge_type;
+  typedef typename kernel_type::result_type result_type;
+
+  // Single precision data is the double precision data rounded, see random.hpp
+  meta::default_generator.seed(seed);
+  std::vector<source_type> source;
+  meta::distribution_block<source_type>(dist, seed, 0, N, N,
+                                        std::back_inserter(source));
+  std::vector<charge_type> charge;
+  for (unsigned i = 0; i < N; ++i)
+    charge.push_back(meta::random<charge_type>::get());
+
+  std::vector<result_type> result(N);
+  Clock timer;
+  timer.start();
+  p2p(K, source.begin(), source.end(), charge.begin(), result.begin());
+  time = timer.elapsed();
+
+  std::vector<typename KernelT<double>::result_type> wide;
+  wide.reserve(N);
+  for (auto& r : result)
+    wide.push_back(to_double(r));
+  return wide;
+}
+
+template <template <typename> class KernelT>
+void bench(unsigned N_min, unsigned N_max, const std::string& dist, int seed) {
+  std::cout << std::setw(8)  << "N"
+            << std::setw(12) << "DoubleTime" << std::setw(12) << "DoubleGI/s"
+            << std::setw(12) << "FloatTime"  << std::setw(12) << "FloatGI/s"
+            << std::setw(10) << "Speedup"
+            << std::setw(14) << "VecRelError" << std::setw(14) << "MaxRelError"
+            << std::endl;
+
+  for (unsigned N = N_min; N <= N_max; N *= 2) {
+    double double_time, float_time;
+    auto exact  = run<KernelT,double>(N, dist, seed, double_time);
+    auto single = run<KernelT,float>(N, dist, seed, float_time);
+
+    double error_sq = 0, norm_sq = 0, max_rel_err = 0;
+    for (unsigned k = 0; k < N; ++k) {
+      error_sq += normSq(exact[k] - single[k]);
+      norm_sq  += normSq(exact[k]);
+      max_rel_err = std::max(max_rel_err,
+                             norm(exact[k] - single[k]) / norm(exact[k]));
+    }
+
+    // Interactions per second, counting both directions of every pair
+    const double interactions = double(N) * N * 1e-9;
+    std::cout << std::setw(8) << N << std::scientific << std::setprecision(3)
+              << std::setw(12) << double_time
+              << std::setw(12) << interactions / double_time
+              << std::setw(12) << float_time
+              << std::setw(12) << interactions / float_time
+              << std::fixed << std::setprecision(2)
+              << std::setw(10) << double_time / float_time
+              << std::scientific << std::setprecision(3)
+              << std::setw(14) << std::sqrt(error_sq / norm_sq)
+              << std::setw(14) << max_rel_err
+              << std::defaultfloat << std::endl;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  std::string kernel = "invsq";
+  std::string dist = "uniform";
+  unsigned N_min = 1024;
+
+  // Parse optional command line args
+  std::vector<std::string> arg(argv, argv + argc);
+  for (unsigned i = 1; i < arg.size(); ++i) {
+    if (arg[i] == "-kernel" || arg[i] == "-nmin" || arg[i] == "-dist") {
+      if (i+1 < arg.size()) {
+        if (arg[i] == "-kernel")
+          kernel = arg[i+1];
+        else if (arg[i] == "-dist")
+          dist = arg[i+1];
+        else
+          N_min = string_to_<unsigned>(arg[i+1]);
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << arg[i] << " option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  if (arg.size() < 2) {
+    std::cerr << "Usage: " << arg[0]
+              << " NMAX [-nmin NMIN] [-kernel invsq|laplace|yukawa] [-dist DIST]" << std::endl;
+    exit(1);
+  }
+
+  unsigned N_max = string_to_<unsigned>(arg[1]);
+  const int seed = 1337;
+
+  if (!meta::is_distribution(dist)) {
+    std::cerr << "Unknown distribution " << dist << std::endl;
+    return 1;
+  }
+
+  std::cout << "Kernel = " << kernel << std::endl;
+  std::cout << "Distribution = " << dist << std::endl;
+  if (kernel == "invsq")
+    bench<InvSqT>(N_min, N_max, dist, seed);
+  else if (kernel == "laplace")
+    bench<LaplaceKernelT>(N_min, N_max, dist, seed);
+  else if (kernel == "yukawa")
+    bench<YukawaKernelT>(N_min, N_max, dist, seed);
+  else {
+    std::cerr << "Unknown kernel " << kernel << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
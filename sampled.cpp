@@ -0,0 +1,131 @@
+#include "Util.hpp"
+#include "Sampled.hpp"
+
+#include "meta/random.hpp"
+#include "meta/distribution.hpp"
+
+#include "kernel/Gaussian.kern"
+
+#include <iomanip>
+
+// Throughput and error of the importance-sampled P2P of the Gaussian kernel
+//
+// The exact asymmetric P2P is timed once, then p2p_sampled with m = 16, 32,
+// ... MMAX sources per tile of targets. For each m the measured relative
+// error of the estimate is printed beside the error the variance estimates
+// predict, sqrt(sum v_i / sum |r_i|^2).
+
+int main(int argc, char** argv)
+{
+  std::string dist = "uniform";
+  std::string by = "uniform";
+  unsigned m_max = 1024;
+  double h = 0.2;
+
+  // Parse optional command line args
+  std::vector<std::string> arg(argv, argv + argc);
+  for (unsigned i = 1; i < arg.size(); ++i) {
+    if (arg[i] == "-mmax" || arg[i] == "-by" || arg[i] == "-h" || arg[i] == "-dist") {
+      if (i+1 < arg.size()) {
+        if (arg[i] == "-mmax")
+          m_max = string_to_<unsigned>(arg[i+1]);
+        else if (arg[i] == "-by")
+          by = arg[i+1];
+        else if (arg[i] == "-h")
+          h = string_to_<double>(arg[i+1]);
+        else
+          dist = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << arg[i] << " option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  if (arg.size() < 2) {
+    std::cerr << "Usage: " << arg[0]
+              << " NUMPOINTS [-mmax MMAX] [-by uniform|charge] [-h BANDWIDTH] [-dist DIST]" << std::endl;
+    exit(1);
+  }
+
+  if (!meta::is_distribution(dist)) {
+    std::cerr << "Unknown distribution " << dist << std::endl;
+    return 1;
+  }
+
+  if (by != "uniform" && by != "charge") {
+    std::cerr << "Unknown sampling " << by << std::endl;
+    return 1;
+  }
+  const SampleBy sample_by = by == "charge" ? SampleBy::charge : SampleBy::uniform;
+
+  unsigned N = string_to_<unsigned>(arg[1]);
+  const int seed = 1337;
+
+  typedef GaussianT<real_type> kernel_type;
+  kernel_type K(h);
+
+  typedef kernel_type::source_type source_type;
+  typedef kernel_type::charge_type charge_type;
+  typedef kernel_type::result_type result_type;
+
+  meta::default_generator.seed(seed);
+  std::vector<source_type> source;
+  meta::distribution_block<source_type>(dist, seed, 0, N, N,
+                                        std::back_inserter(source));
+  std::vector<charge_type> charge;
+  for (unsigned i = 0; i < N; ++i)
+    charge.push_back(meta::random<charge_type>::get());
+
+  std::cout << "N = " << N << std::endl;
+  std::cout << "Kernel = gaussian, h = " << h << std::endl;
+  std::cout << "Distribution = " << dist << std::endl;
+  std::cout << "Sampling = " << by << std::endl;
+
+  std::cout << "Computing direct matvec..." << std::endl;
+  std::vector<result_type> exact(N);
+  Clock timer;
+  timer.start();
+  p2p(K, source.begin(), source.end(), charge.begin(),
+      source.begin(), source.end(), exact.begin());
+  const double exact_time = timer.elapsed();
+  std::cout << "DirectCompTime: " << exact_time << std::endl;
+
+  double norm_sq = 0;
+  for (unsigned i = 0; i < N; ++i)
+    norm_sq += normSq(exact[i]);
+
+  std::cout << std::setw(8)  << "m"
+            << std::setw(12) << "Time" << std::setw(10) << "Speedup"
+            << std::setw(14) << "VecRelError" << std::setw(14) << "PredRelError"
+            << std::endl;
+
+  for (unsigned m = 16; m <= m_max; m *= 2) {
+    std::vector<result_type> result(N);
+    std::vector<double> variance(N);
+    timer.start();
+    p2p_sampled(K, source.begin(), source.end(), charge.begin(),
+                source.begin(), source.end(), result.begin(), variance.begin(),
+                m, sample_by, seed);
+    const double time = timer.elapsed();
+
+    double error_sq = 0, var = 0;
+    for (unsigned i = 0; i < N; ++i) {
+      error_sq += normSq(exact[i] - result[i]);
+      var += variance[i];
+    }
+
+    std::cout << std::setw(8) << m << std::scientific << std::setprecision(3)
+              << std::setw(12) << time
+              << std::fixed << std::setprecision(2)
+              << std::setw(10) << exact_time / time
+              << std::scientific << std::setprecision(3)
+              << std::setw(14) << std::sqrt(error_sq / norm_sq)
+              << std::setw(14) << std::sqrt(var / norm_sq)
+              << std::defaultfloat << std::endl;
+  }
+
+  return 0;
+}
@@ -1,14 +1,21 @@
 #include "Util.hpp"
+#include "CommProfile.hpp"
+#include "Sparse.hpp"
+#include "SoA.hpp"
 
 // Scatter version of the n-body algorithm
 
 #include "kernel/InvSq.kern"
 #include "meta/kernel_traits.hpp"
 #include "meta/random.hpp"
+#include "meta/distribution.hpp"
 
 int main(int argc, char** argv)
 {
   bool checkErrors = true;
+  std::string dist = "uniform";
+  bool sparse = false;
+  double density = 1;
 
   // Parse optional command line args
   std::vector<std::string> arg(argv, argv + argc);
@@ -18,13 +25,43 @@ int main(int argc, char** argv)
       arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
       --i;                                              // Reset index
     }
+    if (arg[i] == "-sparse") {
+      sparse = true;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+    }
+    if (arg[i] == "-density") {
+      if (i+1 < arg.size()) {
+        density = string_to_<double>(arg[i+1]);
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-density option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+    if (arg[i] == "-dist") {
+      if (i+1 < arg.size()) {
+        dist = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-dist option requires one argument." << std::endl;
+        return 1;
+      }
+    }
 
     if (arg.size() < 2) {
-      std::cerr << "Usage: " << arg[0] << " NUMPOINTS [-nocheck]" << std::endl;
+      std::cerr << "Usage: " << arg[0] << " NUMPOINTS [-nocheck] [-sparse] [-density D] [-dist DIST]" << std::endl;
       exit(1);
     }
   }
 
+  if (!meta::is_distribution(dist)) {
+    std::cerr << "Unknown distribution " << dist << std::endl;
+    exit(1);
+  }
+
   srand(time(NULL));
   unsigned N = string_to_<int>(arg[1]);
 
@@ -36,7 +73,7 @@ int main(int argc, char** argv)
   // Scratch status for MPI
   MPI_Status status;
 
-  typedef InvSq kernel_type;
+  typedef InvSqT<real_type> kernel_type;
   kernel_type K;
 
   // Define source_type, target_type, charge_type, result_type
@@ -44,18 +81,26 @@ int main(int argc, char** argv)
   typedef kernel_type::charge_type charge_type;
   typedef kernel_type::target_type target_type;
   typedef kernel_type::result_type result_type;
+  // Type to accumulate results in, exact with NBODY_REPRODUCIBLE
+  typedef accumulator<result_type>::type accum_type;
 
   std::vector<source_type> source;
   std::vector<charge_type> charge;
 
+  const int seed = 1337;
+
   if (rank == MASTER) {
+    meta::default_generator.seed(seed);
+
     // generate source data
-    for (unsigned i = 0; i < N; ++i)
-      source.push_back(meta::random<source_type>::get());
+    meta::distribution_block<source_type>(dist, seed, 0, N, N,
+                                          std::back_inserter(source));
 
     // generate charge data
     for (unsigned i = 0; i < N; ++i)
       charge.push_back(meta::random<charge_type>::get());
+    if (density < 1)
+      mask_charges(charge.begin(), 0, N, density);
 
     // display metadata
     std::cout << "N = " << N << std::endl;
@@ -87,6 +132,7 @@ int main(int argc, char** argv)
   std::vector<charge_type> cJ(idiv_up(N,P));
 
   // Scatter the data to all processes
+  comm_phase("scatter");
   commTimer.start();
   MPI_Scatter(source.data(), sizeof(source_type) * xJ.size(), MPI_CHAR,
               xJ.data(), sizeof(source_type) * xJ.size(), MPI_CHAR,
@@ -99,31 +145,71 @@ int main(int argc, char** argv)
   // Copy xJ -> xI
   std::vector<source_type> xI = xJ;
   // Initialize block results rI
-  std::vector<result_type> rI(idiv_up(N,P));
+  std::vector<accum_type> rI(idiv_up(N,P));
 
   // Calculate the symmetric first block
   compTimer.start();
   p2p(K, xJ.begin(), xJ.end(), cJ.begin(), rI.begin());
   totalCompTime += compTimer.elapsed();
 
+  // With -sparse, circulate only the nonzero-charge sources unless the
+  // global density is too high for the compaction to pay off
+  bool sparse_ring = false;
+  if (sparse) {
+    unsigned total_nnz = count_nonzero(cJ.begin(), cJ.size(), MPI_COMM_WORLD);
+    sparse_ring = total_nnz < sparse_threshold * N;
+    if (rank == MASTER)
+      printf("Nonzero charges: %u (%s)\n", total_nnz,
+             sparse_ring ? "sparse" : "dense fallback");
+  }
+  unsigned nJ = xJ.size();  // The number of sources in xJ, cJ
+  if (sparse_ring) {
+    compTimer.start();
+    nJ = compact_nonzero(xJ.begin(), cJ.begin(), nJ);
+    totalCompTime += compTimer.elapsed();
+  }
+
+  // Pack the circulating block J once, it stays packed through all shifts
+  typedef SoAPack<source_type, charge_type> pack_type;
+  typedef SoABuffer<pack_type> soa_buffer;
+  soa_buffer J(xJ.size(), std::allocator<pack_type>());
+  J.assign(xJ.begin(), xJ.begin() + nJ, cJ.begin());
+  // Receive buffer for blocks of varying size
+  soa_buffer R;
+  if (sparse_ring)
+    R.resize(xJ.size());
+  std::vector<source_type>().swap(xJ);
+  std::vector<charge_type>().swap(cJ);
+
+  const MPI_Datatype pack_mpi = pack_mpi_type<pack_type>();
   for (int shiftCount = 1; shiftCount < P; ++shiftCount) {
+    comm_phase("shift");
     commTimer.start();
 
     int dst = (rank - 1 + P) % P;
     int src = (rank + 1 + P) % P;
-    MPI_Sendrecv_replace(xJ.data(), sizeof(source_type) * xJ.size(), MPI_CHAR,
-                         src, 0, dst, 0,
-                         MPI_COMM_WORLD, &status);
-    MPI_Sendrecv_replace(cJ.data(), sizeof(charge_type) * cJ.size(), MPI_CHAR,
-                         src, 0, dst, 0,
-                         MPI_COMM_WORLD, &status);
+    if (!sparse_ring) {
+      MPI_Sendrecv_replace(J.data(), J.num_packs(), pack_mpi,
+                           src, 0, dst, 0,
+                           MPI_COMM_WORLD, &status);
+    } else {
+      // Only the packs of the nonzero-charge sources travel, after their
+      // number, which masks the padding lanes of the last pack
+      unsigned size = J.size(), recv_size;
+      MPI_Sendrecv(&size, 1, MPI_UNSIGNED, src, 1,
+                   &recv_size, 1, MPI_UNSIGNED, dst, 1,
+                   MPI_COMM_WORLD, &status);
+      MPI_Sendrecv(J.data(), J.num_packs(), pack_mpi, src, 0,
+                   R.data(), R.capacity_packs(), pack_mpi, dst, 0,
+                   MPI_COMM_WORLD, &status);
+      R.resize(recv_size);
+      J.swap(R);
+    }
     totalCommTime += commTimer.elapsed();
 
     // Calculate the current block
     compTimer.start();
-    p2p(K,
-        xJ.begin(), xJ.end(), cJ.begin(),
-        xI.begin(), xI.end(), rI.begin());
+    p2p(K, J, xI.begin(), xI.end(), rI.begin());
     totalCompTime += compTimer.elapsed();
   }
 
@@ -132,8 +218,10 @@ int main(int argc, char** argv)
     result = std::vector<result_type>(P*idiv_up(N,P));
 
   // Collect results and display
+  comm_phase("gather");
   commTimer.start();
-  MPI_Gather(rI.data(), sizeof(result_type) * rI.size(), MPI_CHAR,
+  const std::vector<result_type>& rounded_rI = round_results(rI);
+  MPI_Gather(rounded_rI.data(), sizeof(result_type) * rI.size(), MPI_CHAR,
              result.data(), sizeof(result_type) * rI.size(), MPI_CHAR,
              MASTER, MPI_COMM_WORLD);
   totalCommTime += commTimer.elapsed();
@@ -142,6 +230,8 @@ int main(int argc, char** argv)
   printf("[%d] Timer: %e\n", rank, time);
   printf("[%d] CommTimer: %e\n", rank, totalCommTime);
   printf("[%d] CompTimer: %e\n", rank, totalCompTime);
+  if (rank == MASTER)
+    print_checksum(result, idiv_up(N,P));
 
   // Check the result
   if (rank == MASTER && checkErrors) {
@@ -2,6 +2,7 @@
 
 #include "meta/kernel_traits.hpp"
 #include "meta/random.hpp"
+#include "meta/distribution.hpp"
 
 #include "kernel/InvSq.kern"
 
@@ -9,6 +10,7 @@
 int main(int argc, char** argv)
 {
   bool checkErrors = true;
+  std::string dist = "uniform";
 
   // Parse optional command line args
   std::vector<std::string> arg(argv, argv + argc);
@@ -18,18 +20,33 @@ int main(int argc, char** argv)
       arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
       --i;                                              // Reset index
     }
+    if (arg[i] == "-dist") {
+      if (i+1 < arg.size()) {
+        dist = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-dist option requires one argument." << std::endl;
+        return 1;
+      }
+    }
 
     if (arg.size() < 2) {
-      std::cerr << "Usage: " << arg[0] << " NUMPOINTS [-nocheck]" << std::endl;
+      std::cerr << "Usage: " << arg[0] << " NUMPOINTS [-nocheck] [-dist DIST]" << std::endl;
       exit(1);
     }
   }
 
+  if (!meta::is_distribution(dist)) {
+    std::cerr << "Unknown distribution " << dist << std::endl;
+    exit(1);
+  }
+
   srand(time(NULL));
   unsigned N = string_to_<int>(arg[1]);
 
   // Create a Kernel
-  typedef InvSq kernel_type;
+  typedef InvSqT<real_type> kernel_type;
   kernel_type K;
 
   // Define source_type, target_type, charge_type, result_type
@@ -50,8 +67,8 @@ int main(int argc, char** argv)
   meta::default_generator.seed(seed);
 
   // generate source data
-  for (unsigned i = 0; i < N; ++i)
-    source.push_back(meta::random<source_type>::get());
+  meta::distribution_block<source_type>(dist, seed, 0, N, N,
+                                        std::back_inserter(source));
 
   // generate charge data
   for (unsigned i = 0; i < N; ++i)
@@ -87,9 +104,9 @@ int main(int argc, char** argv)
   }
 
   std::string result_filename = "data/";
-  result_filename += std::string("invsq")
+  result_filename += std::string("invsq") + precision_tag(result_type())
       + "_n" + std::to_string(N)
-      + "_s" + std::to_string(seed) + ".txt";
+      + "_s" + std::to_string(seed) + meta::distribution_tag(dist) + ".txt";
 
   std::ofstream result_file(result_filename);
 }
@@ -0,0 +1,201 @@
+#include "Util.hpp"
+#include "Simulator.hpp"
+
+#include "kernel/InvSq.kern"
+#include "kernel/Laplace.kern"
+#include "kernel/Yukawa.kern"
+#include "meta/kernel_traits.hpp"
+#include "meta/random.hpp"
+
+// Communication-cost simulator for the distributed n-body drivers
+//
+// Replays the message schedule of a driver for N points on P processes and
+// prints the predicted times in the format of that driver. With -validate,
+// replays every run recorded in a driver output file (e.g. data/*.out) and
+// prints the observed and predicted times side by side.
+
+struct Options {
+  std::string alg = "teamscatter";
+  unsigned N = 0;
+  unsigned P = 1;
+  unsigned teamsize = 1;
+  NetworkModel net;
+  ComputeModel cpu;
+  bool measured = true;    // Measure the compute rates on this machine
+  std::string validate;    // Driver output file to validate against
+};
+
+/** Replay one run of @a alg and return the simulator */
+template <typename Kernel>
+Simulator replay(const std::string& alg, unsigned N, unsigned P, unsigned c,
+                 const Options& opt) {
+  if (alg == "broadcast")
+    return simulate_broadcast<Kernel>(N, P, opt.net, opt.cpu);
+  if (alg == "scatter")
+    return simulate_scatter<Kernel>(N, P, opt.net, opt.cpu);
+  if (alg == "symmetric")
+    return simulate_symmetric<Kernel>(N, P, c, opt.net, opt.cpu);
+  if (alg == "checkerboard")
+    return simulate_checkerboard<Kernel>(N, P, opt.net, opt.cpu);
+  return simulate_teamscatter<Kernel>(N, P, c, opt.net, opt.cpu);
+}
+
+/** Print the simulated times in the format of the driver */
+void print_driver(const std::string& alg, const Simulator& sim, unsigned c) {
+  PhaseTimes avg = sim.average();
+  if (alg == "broadcast" || alg == "scatter") {
+    for (unsigned r = 0; r < sim.size(); ++r) {
+      printf("[%d] Timer: %e\n", r, sim.clock(r));
+      printf("[%d] CommTimer: %e\n", r, sim.times(r).comm());
+      printf("[%d] CompTimer: %e\n", r, sim.times(r).comp);
+    }
+  } else if (alg == "symmetric") {
+    printf("Label\tComputation\tSplit\tShift\tSendReceive\tReduce\n");
+    printf("C=%d\t%e\t%e\t%e\t%e\t%e\n", c, avg.comp, avg.split, avg.shift, avg.sendrecv, avg.reduce);
+    printf("Rank 0 Total Time: %e\n", sim.clock(MASTER));
+  } else if (alg == "checkerboard") {
+    printf("Label\tComputation\tSplit\tShift\tReduce\n");
+    printf("q=%d\t%e\t%e\t%e\t%e\n", unsigned(std::sqrt(double(sim.size())) + 0.5), avg.comp, avg.split, avg.shift, avg.reduce);
+    printf("Rank 0 Total Time: %e\n", sim.clock(MASTER));
+  } else {
+    printf("Label\tComputation\tSplit\tShift\tReduce\n");
+    printf("c=%d\t%e\t%e\t%e\t%e\n", c, avg.comp, avg.split, avg.shift, avg.reduce);
+    printf("Rank 0 Total Time: %e\n", sim.clock(MASTER));
+  }
+}
+
+/** Replay every run in a teamscatter or symmetric output file */
+template <typename Kernel>
+void validate(const Options& opt) {
+  std::ifstream file(opt.validate);
+  if (!file) {
+    std::cerr << "Could not open " << opt.validate << std::endl;
+    exit(1);
+  }
+
+  unsigned N = 0, P = 0, c = 1;
+  std::string line;
+  printf("Run\tN\tP\tc\tComputation\tSplit\tShift\tSendReceive\tReduce\tTotal\n");
+  while (std::getline(file, line)) {
+    if (line.compare(0, 4, "N = ") == 0)        N = string_to_<unsigned>(line.substr(4));
+    if (line.compare(0, 4, "P = ") == 0)        P = string_to_<unsigned>(line.substr(4));
+    if (line.compare(0, 11, "Teamsize = ") == 0) c = string_to_<unsigned>(line.substr(11));
+    if (line.compare(0, 5, "Label") != 0)
+      continue;
+
+    // The header determines the driver, the next lines hold the times
+    std::string alg = (line.find("SendReceive") != std::string::npos)
+        ? "symmetric" : "teamscatter";
+    std::string times, total;
+    std::getline(file, times);
+    std::getline(file, total);
+
+    std::istringstream ts(times);
+    std::string label;
+    double comp, split, shift, sendrecv = 0, reduce;
+    ts >> label >> comp >> split >> shift;
+    if (alg == "symmetric") ts >> sendrecv;
+    ts >> reduce;
+    double time = string_to_<double>(total.substr(total.find(':') + 1));
+
+    Simulator sim = replay<Kernel>(alg, N, P, c, opt);
+    PhaseTimes avg = sim.average();
+    printf("Observed\t%d\t%d\t%d\t%e\t%e\t%e\t%e\t%e\t%e\n",
+           N, P, c, comp, split, shift, sendrecv, reduce, time);
+    printf("Predicted\t%d\t%d\t%d\t%e\t%e\t%e\t%e\t%e\t%e\n",
+           N, P, c, avg.comp, avg.split, avg.shift, avg.sendrecv, avg.reduce,
+           sim.clock(MASTER));
+  }
+}
+
+template <typename Kernel>
+void run(const Kernel& K, Options opt) {
+  if (opt.measured) {
+    // Measure the compute rate on a block the size a process would hold,
+    // with the threads the drivers evaluate with
+    unsigned n = std::max(256u, std::min(8192u, idiv_up(opt.N, opt.P)));
+    opt.cpu = measure_compute(K, n, P2P_NUM_THREADS);
+  }
+  printf("Alpha = %e\n", opt.net.alpha);
+  printf("Beta = %e\n", opt.net.beta);
+  printf("Rate = %e\n", opt.cpu.asym_rate);
+  printf("SymmRate = %e\n", opt.cpu.symm_rate);
+
+  if (!opt.validate.empty()) {
+    validate<Kernel>(opt);
+    return;
+  }
+
+  std::cout << "N = " << opt.N << std::endl;
+  std::cout << "P = " << opt.P << std::endl;
+  if (opt.alg == "teamscatter" || opt.alg == "symmetric")
+    std::cout << "Teamsize = " << opt.teamsize << std::endl;
+
+  Simulator sim = replay<Kernel>(opt.alg, opt.N, opt.P, opt.teamsize, opt);
+  print_driver(opt.alg, sim, opt.teamsize);
+}
+
+
+int main(int argc, char** argv)
+{
+  Options opt;
+  std::string kernel = "invsq";
+  bool symm_rate_given = false;
+
+  // Parse optional command line args
+  std::vector<std::string> arg(argv, argv + argc);
+  for (unsigned i = 1; i < arg.size(); ++i) {
+    if (arg[i][0] != '-')
+      continue;
+    if (i+1 >= arg.size()) {
+      std::cerr << arg[i] << " option requires one argument." << std::endl;
+      return 1;
+    }
+    if      (arg[i] == "-c")        opt.teamsize = string_to_<unsigned>(arg[i+1]);
+    else if (arg[i] == "-alg")      opt.alg = arg[i+1];
+    else if (arg[i] == "-kernel")   kernel = arg[i+1];
+    else if (arg[i] == "-alpha")    opt.net.alpha = string_to_<double>(arg[i+1]);
+    else if (arg[i] == "-beta")     opt.net.beta = string_to_<double>(arg[i+1]);
+    else if (arg[i] == "-rate")     { opt.cpu.asym_rate = string_to_<double>(arg[i+1]); opt.measured = false; }
+    else if (arg[i] == "-symmrate") { opt.cpu.symm_rate = string_to_<double>(arg[i+1]); opt.measured = false; symm_rate_given = true; }
+    else if (arg[i] == "-validate") opt.validate = arg[i+1];
+    else {
+      std::cerr << "Unknown option " << arg[i] << std::endl;
+      return 1;
+    }
+    arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+    --i;                                              // Reset index
+  }
+  // A symmetric pair costs about one kernel evaluation, so -rate alone
+  // sets both rates
+  if (!opt.measured && !symm_rate_given)
+    opt.cpu.symm_rate = opt.cpu.asym_rate;
+
+  if (arg.size() < 3 && opt.validate.empty()) {
+    std::cerr << "Usage: " << arg[0] << " NUMPOINTS NUMPROCS [-alg broadcast|scatter|teamscatter|symmetric|checkerboard] [-c TEAMSIZE] [-kernel invsq|laplace|yukawa] [-alpha SEC] [-beta SEC/BYTE] [-rate PAIRS/SEC] [-symmrate PAIRS/SEC]" << std::endl;
+    std::cerr << "       " << arg[0] << " -validate FILE [-alpha SEC] [-beta SEC/BYTE] [-rate PAIRS/SEC] [-symmrate PAIRS/SEC]" << std::endl;
+    exit(1);
+  }
+
+  if (arg.size() >= 3) {
+    opt.N = string_to_<unsigned>(arg[1]);
+    opt.P = string_to_<unsigned>(arg[2]);
+  } else {
+    opt.N = 256000;
+    opt.P = 1;
+  }
+
+  if (opt.P % opt.teamsize != 0 || opt.teamsize * opt.teamsize > opt.P) {
+    std::cerr << "The teamsize (c) must divide p and c^2 <= p." << std::endl;
+    exit(1);
+  }
+
+  if (kernel == "laplace")
+    run(LaplaceKernel(), opt);
+  else if (kernel == "yukawa")
+    run(YukawaKernel(), opt);
+  else
+    run(InvSq(), opt);
+
+  return 0;
+}
@@ -0,0 +1,37 @@
+#!/bin/bash
+#SBATCH --ntasks 1024         #Number of processes
+#SBATCH -t 01:00:00                #Runtime in minutes
+#SBATCH -p normal   	      #Partition to submit to
+#SBATCH -o data/a_stampedeCB256k.out     	      #File to which standard out will be written
+#SBATCH -e data/a_stampedeCB256k.err      	      #File to which standard err will be written
+
+module load intel gcc/4.7.1
+
+make clean
+
+make checkerboard XFLAGS='-DP2P_NUM_THREADS=0 -DP2P_DECAY_ITERATOR=0'
+
+#
+# Execute the run
+#
+ibrun -n 1  -o 0 ./checkerboard 256000 #-nocheck
+
+wait
+
+ibrun -n 4  -o 0 ./checkerboard 256000 #-nocheck
+
+wait
+
+ibrun -n 16  -o 0 ./checkerboard 256000 #-nocheck
+
+wait
+
+ibrun -n 64  -o 0 ./checkerboard 256000 #-nocheck
+
+wait
+
+ibrun -n 256  -o 0 ./checkerboard 256000 #-nocheck
+
+wait
+
+ibrun -n 1024  -o 0 ./checkerboard 256000 #-nocheck
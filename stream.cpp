@@ -0,0 +1,135 @@
+#include "Util.hpp"
+#include "Stream.hpp"
+
+#include "meta/random.hpp"
+#include "meta/distribution.hpp"
+
+#include "kernel/Gaussian.kern"
+
+// Incremental Gaussian kernel sums over a sliding window of streaming sources
+//
+// A window of WINDOW sources is filled from the distribution, then UPDATES
+// batches of BATCH arriving sources slide it along the stream. The latency of
+// every update is recorded, and the sums after the last update are checked
+// against a direct evaluation of the window.
+
+int main(int argc, char** argv)
+{
+  std::string dist = "uniform";
+  unsigned window = 16384;
+  unsigned batch = 256;
+  unsigned updates = 200;
+  unsigned refresh = 64;
+  double h = 0.1;
+
+  // Parse optional command line args
+  std::vector<std::string> arg(argv, argv + argc);
+  for (unsigned i = 1; i < arg.size(); ++i) {
+    if (arg[i] == "-window" || arg[i] == "-batch" || arg[i] == "-updates" ||
+        arg[i] == "-refresh" || arg[i] == "-h" || arg[i] == "-dist") {
+      if (i+1 < arg.size()) {
+        if (arg[i] == "-window")
+          window = string_to_<unsigned>(arg[i+1]);
+        else if (arg[i] == "-batch")
+          batch = string_to_<unsigned>(arg[i+1]);
+        else if (arg[i] == "-updates")
+          updates = string_to_<unsigned>(arg[i+1]);
+        else if (arg[i] == "-refresh")
+          refresh = string_to_<unsigned>(arg[i+1]);
+        else if (arg[i] == "-h")
+          h = string_to_<double>(arg[i+1]);
+        else
+          dist = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << arg[i] << " option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  if (arg.size() < 2) {
+    std::cerr << "Usage: " << arg[0]
+              << " NUMTARGETS [-window WINDOW] [-batch BATCH] [-updates UPDATES] [-refresh REFRESH] [-h BANDWIDTH] [-dist DIST]" << std::endl;
+    exit(1);
+  }
+
+  if (!meta::is_distribution(dist)) {
+    std::cerr << "Unknown distribution " << dist << std::endl;
+    return 1;
+  }
+
+  if (window == 0 || updates == 0) {
+    std::cerr << "The window and the number of updates must be positive" << std::endl;
+    return 1;
+  }
+
+  unsigned N = string_to_<unsigned>(arg[1]);
+  const int seed = 1337;
+
+  typedef GaussianT<real_type> kernel_type;
+  kernel_type K(h);
+
+  typedef kernel_type::source_type source_type;
+  typedef kernel_type::charge_type charge_type;
+  typedef kernel_type::result_type result_type;
+
+  // The targets, then the stream
+  const std::size_t total = N + window + std::size_t(updates) * batch;
+  meta::default_generator.seed(seed);
+  std::vector<source_type> point;
+  meta::distribution_block<source_type>(dist, seed, 0, total, total,
+                                        std::back_inserter(point));
+  std::vector<charge_type> charge;
+  for (std::size_t i = 0; i < total; ++i)
+    charge.push_back(meta::random<charge_type>::get());
+
+  std::cout << "N = " << N << std::endl;
+  std::cout << "Window = " << window << std::endl;
+  std::cout << "Batch = " << batch << std::endl;
+  std::cout << "Refresh = " << refresh << std::endl;
+
+  SlidingWindow<kernel_type> W(K, window, refresh);
+  W.push(point.begin() + N, point.begin() + N + window, charge.begin() + N);
+  W.set_targets(point.begin(), point.begin() + N);
+
+  // Slide the window
+  Clock timer;
+  std::vector<double> latency;
+  std::size_t next = N + window;
+  for (unsigned u = 0; u < updates; ++u, next += batch) {
+    timer.start();
+    W.push(point.begin() + next, point.begin() + next + batch,
+           charge.begin() + next);
+    latency.push_back(timer.elapsed());
+  }
+
+  const double total_time = std::accumulate(latency.begin(), latency.end(), 0.0);
+  std::vector<double> sorted = latency;
+  std::sort(sorted.begin(), sorted.end());
+  auto percentile = [&](double q) {
+    return sorted[std::min<std::size_t>(sorted.size() - 1, q * sorted.size())];
+  };
+
+  printf("Label\tMeanLatency\tP50Latency\tP99Latency\tMaxLatency\tPoints/s\n");
+  printf("B=%d\t%e\t%e\t%e\t%e\t%e\n", batch,
+         total_time / updates, percentile(0.5), percentile(0.99), sorted.back(),
+         double(updates) * batch / total_time);
+
+  // Check the sums against a direct evaluation of the window
+  std::cout << "Computing direct matvec..." << std::endl;
+  const std::vector<source_type> s = W.sources();
+  const std::vector<charge_type> c = W.charges();
+  std::vector<result_type> exact(N);
+  timer.start();
+  p2p(K, s.begin(), s.end(), c.begin(),
+      point.begin(), point.begin() + N, exact.begin());
+  const double directCompTime = timer.elapsed();
+
+  print_error(exact, W.results());
+  std::cout << "DirectCompTime: " << directCompTime << std::endl;
+  std::cout << "Speedup per update: " << directCompTime * updates / total_time << std::endl;
+
+  return 0;
+}
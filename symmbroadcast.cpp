@@ -0,0 +1,250 @@
+#include "Util.hpp"
+#include "CommProfile.hpp"
+
+#include "kernel/InvSq.kern"
+#include "meta/kernel_traits.hpp"
+#include "meta/random.hpp"
+#include "meta/distribution.hpp"
+
+#include <type_traits>
+
+// Symmetric broadcast version of n-body algorithm
+//
+// All ranks hold all N points and the upper triangle of the P x P block
+// matrix is split evenly across them: rank r evaluates its diagonal block and
+// the off-diagonal blocks (r, r+d) for d = 1..(P-1)/2 with the symmetric p2p
+// into a full-length accumulator. For even P the blocks P/2 apart are left:
+// with -pairing cyclic the lower rank of each such pair evaluates it, with
+// -pairing balanced (default) the two ranks split its rows in halves. The
+// accumulators are summed and scattered with MPI_Reduce_scatter_block.
+
+inline unsigned calcStart(unsigned r, unsigned P, unsigned N) {
+  return std::min(N, r * idiv_up(N,P));
+}
+
+inline unsigned calcEnd(unsigned r, unsigned P, unsigned N) {
+  return calcStart(r+1, P, N);
+}
+
+
+int main(int argc, char** argv)
+{
+  bool checkErrors = true;
+  std::string dist = "uniform";
+  std::string pairing = "balanced";
+
+  // Parse optional command line args
+  std::vector<std::string> arg(argv, argv + argc);
+  for (unsigned i = 1; i < arg.size(); ++i) {
+    if (arg[i] == "-nocheck") {
+      checkErrors = false;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+    }
+    if (arg[i] == "-dist") {
+      if (i+1 < arg.size()) {
+        dist = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-dist option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+    if (arg[i] == "-pairing") {
+      if (i+1 < arg.size()) {
+        pairing = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-pairing option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  if (arg.size() < 2) {
+    std::cerr << "Usage: " << arg[0] << " NUMPOINTS [-nocheck] [-dist DIST] [-pairing cyclic|balanced]" << std::endl;
+    exit(1);
+  }
+
+  if (!meta::is_distribution(dist)) {
+    std::cerr << "Unknown distribution " << dist << std::endl;
+    exit(1);
+  }
+
+  if (pairing != "cyclic" && pairing != "balanced") {
+    std::cerr << "Unknown pairing " << pairing << std::endl;
+    exit(1);
+  }
+
+  unsigned N = string_to_<int>(arg[1]);
+
+  MPI_Init(&argc, &argv);
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  int P;
+  MPI_Comm_size(MPI_COMM_WORLD, &P);
+
+  // Define the kernel
+  typedef InvSqT<real_type> kernel_type;
+  kernel_type K;
+
+  // Define source_type, target_type, charge_type, result_type
+  typedef kernel_type::source_type source_type;
+  typedef kernel_type::charge_type charge_type;
+  typedef kernel_type::target_type target_type;
+  typedef kernel_type::result_type result_type;
+  // Type to accumulate results in, exact with NBODY_REPRODUCIBLE
+  typedef accumulator<result_type>::type accum_type;
+
+  // We are testing symmetric kernels
+  static_assert(std::is_same<source_type, target_type>::value,
+                "Testing symmetric kernels, need source_type == target_type");
+
+  std::vector<source_type> source;
+  std::vector<charge_type> charge;
+
+  const int seed = 1337;
+
+  if (rank == MASTER) {
+    // generate source data
+    meta::default_generator.seed(seed);
+    meta::distribution_block<source_type>(dist, seed, 0, N, N,
+                                          std::back_inserter(source));
+
+    // generate charge data
+    for (unsigned i = 0; i < N; ++i)
+      charge.push_back(meta::random<charge_type>::get());
+
+    // display metadata
+    std::cout << "N = " << N << std::endl;
+    std::cout << "P = " << P << std::endl;
+    std::cout << "Pairing = " << pairing << std::endl;
+  }
+
+  Clock timer;
+  Clock commTimer;
+  Clock compTimer;
+
+  double totalCommTime = 0;
+  double totalCompTime = 0;
+
+  // Broadcast the size of the problem to all processes
+  timer.start();
+  commTimer.start();
+  MPI_Bcast(&N, sizeof(N), MPI_CHAR, MASTER, MPI_COMM_WORLD);
+  totalCommTime += commTimer.elapsed();
+
+  // Allocate memory on all other processes
+  if (rank != MASTER) {
+    source = std::vector<source_type>(N);
+    charge = std::vector<charge_type>(N);
+  }
+
+  // Broadcast the data to all processes
+  comm_phase("split");
+  commTimer.start();
+  MPI_Bcast(source.data(), sizeof(source_type) * source.size(), MPI_CHAR,
+            MASTER, MPI_COMM_WORLD);
+  MPI_Bcast(charge.data(), sizeof(charge_type) * charge.size(), MPI_CHAR,
+            MASTER, MPI_COMM_WORLD);
+  totalCommTime += commTimer.elapsed();
+
+  // All processors accumulate into all P blocks, padded to equal sizes
+  const unsigned n = idiv_up(N,P);
+  std::vector<accum_type> r(P*n);
+
+  auto x = source.begin();
+  auto c = charge.begin();
+  auto rr = r.begin();
+  const unsigned i0 = calcStart(rank,P,N), i1 = calcEnd(rank,P,N);
+
+  // Evaluate computation
+  compTimer.start();
+
+  // The diagonal block
+  p2p(K, x + i0, x + i1, c + i0, rr + i0);
+
+  // The off-diagonal blocks of the next (P-1)/2 ranks
+  for (int d = 1; 2*d < P; ++d) {
+    const unsigned b = (rank + d) % P;
+    const unsigned j0 = calcStart(b,P,N), j1 = calcEnd(b,P,N);
+    p2p(K,
+        x + i0, x + i1, c + i0, rr + i0,
+        x + j0, x + j1, c + j0, rr + j0);
+  }
+
+  // The blocks P/2 apart, met by both of their ranks
+  if (P % 2 == 0 && P > 1) {
+    const unsigned b = (rank + P/2) % P;
+    if (pairing == "cyclic") {
+      if (unsigned(rank) < b) {
+        const unsigned j0 = calcStart(b,P,N), j1 = calcEnd(b,P,N);
+        p2p(K,
+            x + i0, x + i1, c + i0, rr + i0,
+            x + j0, x + j1, c + j0, rr + j0);
+      }
+    } else {
+      // Split the rows of the lower block at a tile boundary
+      const unsigned lo = std::min(unsigned(rank), b), hi = std::max(unsigned(rank), b);
+      const unsigned a0 = calcStart(lo,P,N), a1 = calcEnd(lo,P,N);
+      const unsigned align = detail::tile_align(r.data());
+      const unsigned mid = std::min(a1, a0 + (a1 - a0) / 2 / align * align);
+      const unsigned k0 = unsigned(rank) == lo ? a0 : mid;
+      const unsigned k1 = unsigned(rank) == lo ? mid : a1;
+      const unsigned j0 = calcStart(hi,P,N), j1 = calcEnd(hi,P,N);
+      p2p(K,
+          x + k0, x + k1, c + k0, rr + k0,
+          x + j0, x + j1, c + j0, rr + j0);
+    }
+  }
+  totalCompTime += compTimer.elapsed();
+
+  // Sum the accumulators and scatter block rank of the sum to rank
+  comm_phase("reduce");
+  commTimer.start();
+  std::vector<accum_type> rI(n);
+  reduce_scatter_results(r, rI, MPI_COMM_WORLD);
+  totalCommTime += commTimer.elapsed();
+
+  // Collect results and display
+  std::vector<result_type> result;
+  if (rank == MASTER)
+    result = std::vector<result_type>(P*n);
+
+  comm_phase("gather");
+  commTimer.start();
+  const std::vector<result_type>& rounded_rI = round_results(rI);
+  MPI_Gather(rounded_rI.data(), sizeof(result_type) * rI.size(), MPI_CHAR,
+             result.data(), sizeof(result_type) * rI.size(), MPI_CHAR,
+             MASTER, MPI_COMM_WORLD);
+  totalCommTime += commTimer.elapsed();
+  if (rank == MASTER)
+    result.resize(N);
+
+  double time = timer.elapsed();
+  printf("[%d] Timer: %e\n", rank, time);
+  printf("[%d] CommTimer: %e\n", rank, totalCommTime);
+  printf("[%d] CompTimer: %e\n", rank, totalCompTime);
+  if (rank == MASTER)
+    print_checksum(result, n);
+
+  // Check the result
+  if (rank == MASTER && checkErrors) {
+    std::cout << "Computing direct matvec..." << std::endl;
+
+    std::vector<result_type> exact(N);
+
+    // Compute the result with a direct matrix-vector multiplication
+    compTimer.start();
+    p2p(K, source.begin(), source.end(), charge.begin(), exact.begin());
+    double directCompTime = compTimer.elapsed();
+
+    print_error(exact, result);
+    std::cout << "DirectCompTime: " << directCompTime << std::endl;
+  }
+
+  MPI_Finalize();
+  return 0;
+}
@@ -8,39 +8,26 @@
 //#define P2P_NUM_THREADS 0
 
 #include "Util.hpp"
+#include "CommProfile.hpp"
+#include "Observables.hpp"
+#include "MemTrack.hpp"
+#include "ProgressMonitor.hpp"
 
 #include "kernel/InvSq.kern"
 #include "meta/kernel_traits.hpp"
 #include "meta/random.hpp"
+#include "meta/distribution.hpp"
 
-typedef std::tuple<int,int>      xy_pair;
-typedef std::tuple<int,int,int>  itc_tuple;
-typedef std::tuple<int,int>      ir_pair;
-
-struct IndexTransformer {
-  IndexTransformer(int num_teams, int team_size)
-      : T(num_teams), C(team_size) {
-  }
-
-  /** Take an (iteration, team, team_rank) tuple
-   * and return the (iteration, rank) pair of the transpose block
-   */
-  ir_pair operator()(int i, int t, int c) const {
-    int Y = (t + c + i * C) % T;  //< Column number
-    int D = (t - Y + T) % T;      //< Positive distance from diag
-    return ir_pair{(D/C), (Y*C) + (D%C)};
-  }
-
- private:
-  int T;   // The number of process teams in the computation
-  int C;   // The size of the process teams in the computation
-};
-
-
+#include "IndexTransformer.hpp"
 
 int main(int argc, char** argv)
 {
   bool checkErrors = true;
+  std::string dist = "uniform";
+  bool observables = false;
+  bool lean = false;
+  bool memreport = false;
+  std::string progress_file;
   unsigned teamsize = 1;
 
   // Parse optional command line args
@@ -61,10 +48,54 @@ int main(int argc, char** argv)
       arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
       --i;                                              // Reset index
     }
+    if (arg[i] == "-dist") {
+      if (i+1 < arg.size()) {
+        dist = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-dist option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+    if (arg[i] == "-observables") {
+      observables = true;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+    }
+    if (arg[i] == "-lean") {
+      lean = true;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+    }
+    if (arg[i] == "-memreport") {
+      memreport = true;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+    }
+    if (arg[i] == "-progress") {
+      if (i+1 < arg.size()) {
+        progress_file = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-progress option requires one argument." << std::endl;
+        return 1;
+      }
+    }
   }
 
+  // The lean mode never holds all N results, so they can't be checked
+  if (lean)
+    checkErrors = false;
+
   if (arg.size() < 2) {
-    std::cerr << "Usage: " << arg[0] << " NUMPOINTS [-c TEAMSIZE] [-nocheck]" << std::endl;
+    std::cerr << "Usage: " << arg[0] << " NUMPOINTS [-c TEAMSIZE] [-nocheck] [-observables] [-lean] [-memreport] [-progress FILE] [-dist DIST]" << std::endl;
+    exit(1);
+  }
+
+  if (!meta::is_distribution(dist)) {
+    std::cerr << "Unknown distribution " << dist << std::endl;
     exit(1);
   }
 
@@ -80,7 +111,7 @@ int main(int argc, char** argv)
   // Scratch status for MPI
   MPI_Status status;
 
-  typedef InvSq kernel_type;
+  typedef InvSqT<real_type> kernel_type;
   kernel_type K;
 
   // Define source_type, target_type, charge_type, result_type
@@ -88,27 +119,37 @@ int main(int argc, char** argv)
   typedef kernel_type::charge_type charge_type;
   typedef kernel_type::target_type target_type;
   typedef kernel_type::result_type result_type;
+  // Type to accumulate results in, exact with NBODY_REPRODUCIBLE
+  typedef accumulator<result_type>::type accum_type;
 
   // We are testing symmetric kernels
   static_assert(std::is_same<source_type, target_type>::value,
                 "Testing symmetric kernels, need source_type == target_type");
 
-  std::vector<source_type> source;
-  std::vector<charge_type> charge;
+  typedef mem_track::tracked_allocator<source_type> source_alloc;
+  typedef mem_track::tracked_allocator<charge_type> charge_alloc;
+  typedef mem_track::tracked_allocator<result_type> result_alloc;
+  typedef mem_track::tracked_allocator<accum_type>  accum_alloc;
+
+  tracked_vector<source_type> source(source_alloc("source"));
+  tracked_vector<charge_type> charge(charge_alloc("charge"));
 
   const int seed = 1337;
 
-  if (rank == MASTER) {
+  // With -lean the team leaders generate their own blocks after the setup
+  if (rank == MASTER && !lean) {
     meta::default_generator.seed(seed);
 
     // generate source data
-    for (unsigned i = 0; i < N; ++i)
-      source.push_back(meta::random<source_type>::get());
+    meta::distribution_block<source_type>(dist, seed, 0, N, N,
+                                          std::back_inserter(source));
 
     // generate charge data
     for (unsigned i = 0; i < N; ++i)
       charge.push_back(meta::random<charge_type>::get());
+  }
 
+  if (rank == MASTER) {
     // display metadata
     std::cout << "N = " << N << std::endl;
     std::cout << "P = " << P << std::endl;
@@ -193,12 +234,20 @@ int main(int argc, char** argv)
   /*********************/
 
   // Declare data for the block computations
-  std::vector<source_type> xJ(idiv_up(N,num_teams));
-  std::vector<charge_type> cJ(idiv_up(N,num_teams));
-  std::vector<result_type> rJ(idiv_up(N,num_teams));
+  const unsigned n = idiv_up(N,num_teams);
+  tracked_vector<source_type> xJ(n, source_type(), source_alloc("xJ"));
+  tracked_vector<charge_type> cJ(n, charge_type(), charge_alloc("cJ"));
+  tracked_vector<accum_type>  rJ(n, accum_type(),  accum_alloc("rJ"));
 
-  // Scatter data from master to team leaders
-  if (trank == MASTER) {
+  if (lean && trank == MASTER) {
+    // Team leaders generate their block of the sequence of the master
+    meta::default_generator.seed(seed);
+    meta::distribution_block<source_type>(dist, seed, team*n, (team+1)*n, N,
+                                          xJ.begin());
+    meta::random_block<charge_type>(team*n, (team+1)*n, N, cJ.begin());
+  } else if (trank == MASTER) {
+    // Scatter data from master to team leaders
+    comm_phase("scatter");
     //splitTimer.start();
     MPI_Scatter(source.data(), sizeof(source_type) * xJ.size(), MPI_CHAR,
                 xJ.data(), sizeof(source_type) * xJ.size(), MPI_CHAR,
@@ -210,6 +259,7 @@ int main(int argc, char** argv)
   }
 
   // Team leaders broadcast to team
+  comm_phase("split");
   splitTimer.start();
   MPI_Bcast(xJ.data(), sizeof(source_type) * xJ.size(), MPI_CHAR,
             MASTER, team_comm);
@@ -218,15 +268,18 @@ int main(int argc, char** argv)
   totalSplitTime += splitTimer.elapsed();
 
   // Copy xJ -> xI
-  std::vector<source_type> xI = xJ;
+  tracked_vector<source_type> xI(xJ.begin(), xJ.end(), source_alloc("xI"));
   // Copy cJ -> cI
-  std::vector<charge_type> cI = cJ;
+  tracked_vector<charge_type> cI(cJ.begin(), cJ.end(), charge_alloc("cI"));
   // Initialize block result rI
-  std::vector<result_type> rI(idiv_up(N,num_teams));
-  // Declare space for receiving
-  std::vector<result_type> temp_rI(idiv_up(N,num_teams));
+  tracked_vector<accum_type> rI(n, accum_type(), accum_alloc("rI"));
+  // Declare space for receiving, the lean mode receives into rJ in place
+  tracked_vector<accum_type> temp_rI(accum_alloc("temp_rI"));
+  if (!lean)
+    temp_rI.resize(n);
 
   // Perform initial offset by teamrank
+  comm_phase("shift");
   shiftTimer.start();
   int src = (team + trank + num_teams) % num_teams;
   int dst = (team - trank + num_teams) % num_teams;
@@ -238,6 +291,10 @@ int main(int argc, char** argv)
                        row_comm, &status);
   totalShiftTime += shiftTimer.elapsed();
 
+  // With -progress, MASTER keeps FILE updated with the progress of all ranks
+  ProgressMonitor progress(progress_file, MASTER, MPI_COMM_WORLD);
+  double interactions = 0;
+
   /**********************/
   /** ZEROTH ITERATION **/
   /**********************/
@@ -253,6 +310,7 @@ int main(int argc, char** argv)
     compTimer.start();
     p2p(K, xJ.begin(), xJ.end(), cJ.begin(), rI.begin());
     totalCompTime += compTimer.elapsed();
+    interactions += double(n) * n;
   } else {
     // Compute the symmetric iteration and rank
     std::tie(i_dst,r_dst) = transposer(curr_iter, team, trank);
@@ -265,6 +323,7 @@ int main(int argc, char** argv)
           xJ.begin(), xJ.end(), cJ.begin(), rJ.begin(),
           xI.begin(), xI.end(), cI.begin(), rI.begin());
       totalCompTime += compTimer.elapsed();
+      interactions += 2.0 * n * n;
     } else {
       // No destination for the symmetric send
       r_dst = MPI_PROC_NULL;
@@ -275,9 +334,14 @@ int main(int argc, char** argv)
           xJ.begin(), xJ.end(), cJ.begin(),
           xI.begin(), xI.end(), rI.begin());
       totalCompTime += compTimer.elapsed();
+      interactions += double(n) * n;
     }
   }
 
+  progress.update(curr_iter, totalCompTime,
+                  totalSplitTime + totalShiftTime + totalSendRecvTime,
+                  interactions);
+
   /********************/
   /** ALL ITERATIONS **/
   /********************/
@@ -296,21 +360,31 @@ int main(int argc, char** argv)
       r_src = MPI_PROC_NULL;
 
     // Send/Recv the symmetric data from the last iteration
+    comm_phase("sendrecv");
     sendRecvTimer.start();
-    MPI_Sendrecv(rJ.data(), sizeof(result_type) * rJ.size(), MPI_CHAR,
-                 r_dst, 0,
-                 temp_rI.data(), sizeof(result_type) * temp_rI.size(), MPI_CHAR,
-                 r_src, 0,
-                 MPI_COMM_WORLD, &status);
+    if (lean)
+      MPI_Sendrecv_replace(rJ.data(), sizeof(accum_type) * rJ.size(), MPI_CHAR,
+                           r_dst, 0, r_src, 0,
+                           MPI_COMM_WORLD, &status);
+    else
+      MPI_Sendrecv(rJ.data(), sizeof(accum_type) * rJ.size(), MPI_CHAR,
+                   r_dst, 0,
+                   temp_rI.data(), sizeof(accum_type) * temp_rI.size(), MPI_CHAR,
+                   r_src, 0,
+                   MPI_COMM_WORLD, &status);
     totalSendRecvTime += sendRecvTimer.elapsed();
 
-    // Accumulate temp_rI to current answer
-    if (r_src != MPI_PROC_NULL)
-      for (auto r = rI.begin(), tr = temp_rI.begin(); r != rI.end(); ++r, ++tr)
+    // Accumulate the received contributions to current answer
+    if (r_src != MPI_PROC_NULL) {
+      const tracked_vector<accum_type>& recv_rI = lean ? rJ : temp_rI;
+      auto tr = recv_rI.begin();
+      for (auto r = rI.begin(); r != rI.end(); ++r, ++tr)
         *r += *tr;
+    }
 
 
     // Shift data to the next process to compute the next block
+    comm_phase("shift");
     shiftTimer.start();
     int src = (team + teamsize + num_teams) % num_teams;
     int dst = (team - teamsize + num_teams) % num_teams;
@@ -330,7 +404,7 @@ int main(int argc, char** argv)
     //assert(i_dst > curr_iter || curr_iter == last_iter-1);
     if (i_dst != last_iter) {
       // Set rJ to zero
-      std::fill(rJ.begin(), rJ.end(), result_type());
+      std::fill(rJ.begin(), rJ.end(), accum_type());
 
       // Compute symmetric off-diagonal
       compTimer.start();
@@ -338,6 +412,7 @@ int main(int argc, char** argv)
           xJ.begin(), xJ.end(), cJ.begin(), rJ.begin(),
           xI.begin(), xI.end(), cI.begin(), rI.begin());
       totalCompTime += compTimer.elapsed();
+      interactions += 2.0 * n * n;
     } else {
       // No destination for the symmetric send
       r_dst = MPI_PROC_NULL;
@@ -348,35 +423,56 @@ int main(int argc, char** argv)
           xJ.begin(), xJ.end(), cJ.begin(),
           xI.begin(), xI.end(), rI.begin());
       totalCompTime += compTimer.elapsed();
+      interactions += double(n) * n;
 
       r_dst = MPI_PROC_NULL;
     }
 
+    progress.update(curr_iter, totalCompTime,
+                    totalSplitTime + totalShiftTime + totalSendRecvTime,
+                    interactions);
   }  //  end for iteration
 
   /********************/
   /*** REDUCE STAGE ***/
   /********************/
 
+  // Sweep the partial results for the global observables
+  Observables obs;
+  if (observables) {
+    compTimer.start();
+    obs.sweep(xI.begin(), xI.end(), cI.begin(), rI.begin());
+    totalCompTime += compTimer.elapsed();
+  }
+
+  // Allocate teamrI on team leaders, the lean mode reduces into rI in place
+  tracked_vector<result_type> teamrI(result_alloc("teamrI"));
+  if (trank == MASTER && !lean)
+    teamrI.resize(n);
+
   // Reduce answers to the team leader
+  comm_phase("reduce");
   reduceTimer.start();
   // TODO: Generalize
-  static_assert(std::is_same<result_type, double>::value,
-                "Need result_type == double for now");
-  MPI_Reduce(rI.data(), temp_rI.data(), rI.size(), MPI_DOUBLE,
-             MPI_SUM, MASTER, team_comm);
+  static_assert(std::is_floating_point<result_type>::value,
+                "Need a floating point result_type for now");
+  if (lean)
+    reduce_results(rI, MASTER, team_comm);
+  else
+    reduce_results(rI, teamrI, MASTER, team_comm);
   totalReduceTime += reduceTimer.elapsed();
 
   // Allocate result on master
-  std::vector<result_type> result;
-  if (rank == MASTER)
-    result = std::vector<result_type>(P*idiv_up(N,P));
+  tracked_vector<result_type> result(result_alloc("result"));
+  if (rank == MASTER && !lean)
+    result.resize(P*idiv_up(N,P));
 
-  // Gather team leader answers to master
-  if (trank == MASTER) {
+  // Gather team leader answers to master, the lean mode leaves them there
+  if (trank == MASTER && !lean) {
+    comm_phase("gather");
     //reduceTimer.start();
-    MPI_Gather(temp_rI.data(), sizeof(result_type) * temp_rI.size(), MPI_CHAR,
-               result.data(), sizeof(result_type) * temp_rI.size(), MPI_CHAR,
+    MPI_Gather(teamrI.data(), sizeof(result_type) * teamrI.size(), MPI_CHAR,
+               result.data(), sizeof(result_type) * teamrI.size(), MPI_CHAR,
                MASTER, row_comm);
     //totalReduceTime += reduceTimer.elapsed();
   }
@@ -393,23 +489,23 @@ int main(int argc, char** argv)
   double avgReduceTime = 0;
   double avgSendRecvTime = 0;
 
+  // Reduce the times and observables together
   // Could use all reduce here to get the averaged data to all the processors
-  MPI_Reduce(&totalCompTime, &avgCompTime, 1, MPI_DOUBLE,
-             MPI_SUM, MASTER, MPI_COMM_WORLD);
-  MPI_Reduce(&totalSplitTime, &avgSplitTime, 1, MPI_DOUBLE,
-             MPI_SUM, MASTER, MPI_COMM_WORLD);
-  MPI_Reduce(&totalShiftTime, &avgShiftTime, 1, MPI_DOUBLE,
-             MPI_SUM, MASTER, MPI_COMM_WORLD);
-  MPI_Reduce(&totalSendRecvTime, &avgSendRecvTime, 1, MPI_DOUBLE,
-             MPI_SUM, MASTER, MPI_COMM_WORLD);
-  MPI_Reduce(&totalReduceTime, &avgReduceTime, 1, MPI_DOUBLE,
+  comm_phase("timing");
+  double local[] = {totalCompTime, totalSplitTime, totalShiftTime,
+                    totalSendRecvTime, totalReduceTime,
+                    obs.charge_sum, obs.virial};
+  double global[7];
+  MPI_Reduce(local, global, 7, MPI_DOUBLE,
              MPI_SUM, MASTER, MPI_COMM_WORLD);
 
-  avgCompTime     /= P;
-  avgSplitTime    /= P;
-  avgShiftTime    /= P;
-  avgSendRecvTime /= P;
-  avgReduceTime   /= P;
+  avgCompTime     = global[0] / P;
+  avgSplitTime    = global[1] / P;
+  avgShiftTime    = global[2] / P;
+  avgSendRecvTime = global[3] / P;
+  avgReduceTime   = global[4] / P;
+  obs.charge_sum  = global[5];
+  obs.virial      = global[6];
 
 
   // format output well
@@ -417,14 +513,24 @@ int main(int argc, char** argv)
     printf("Label\tComputation\tSplit\tShift\tSendReceive\tReduce\n");
     printf("C=%d\t%e\t%e\t%e\t%e\t%e\n", teamsize, avgCompTime, avgSplitTime, avgShiftTime, avgSendRecvTime, avgReduceTime);
     printf("Rank 0 Total Time: %e\n", time);
+    if (!lean)
+      print_checksum(result, n);
+    if (observables)
+      print_observables(obs);
   }
 
+  // Peak memory per buffer, collective
+  if (memreport)
+    mem_track::report(MASTER, MPI_COMM_WORLD);
+
+  progress.finish();
+
   // Check the result
   if (rank == MASTER && checkErrors) {
     std::string result_filename = "data/";
-    result_filename += std::string("invsq")
+    result_filename += std::string("invsq") + precision_tag(result_type())
         + "_n" + std::to_string(N)
-        + "_s" + std::to_string(seed) + ".txt";
+        + "_s" + std::to_string(seed) + meta::distribution_tag(dist) + ".txt";
 
     std::fstream result_file(result_filename);
 
@@ -437,6 +543,8 @@ int main(int argc, char** argv)
       assert(exact.size() == N);
 
       print_error(exact, result);
+      if (observables)
+        print_observables_error(obs, source, charge, exact);
     } else {
       std::cout << "Computing direct matvec..." << std::endl;
 
@@ -448,6 +556,8 @@ int main(int argc, char** argv)
       double directCompTime = compTimer.elapsed();
 
       print_error(exact, result);
+      if (observables)
+        print_observables_error(obs, source, charge, exact);
       std::cout << "DirectCompTime: " << directCompTime << std::endl;
 
       // Open and write
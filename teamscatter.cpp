@@ -1,14 +1,28 @@
 #include "Util.hpp"
+#include "CommProfile.hpp"
+#include "Observables.hpp"
+#include "MemTrack.hpp"
+#include "ProgressMonitor.hpp"
+#include "SoA.hpp"
+#include "Sparse.hpp"
 
 #include "kernel/InvSq.kern"
 #include "meta/kernel_traits.hpp"
 #include "meta/random.hpp"
+#include "meta/distribution.hpp"
 
 // Team Scatter version of the n-body algorithm
 
 int main(int argc, char** argv)
 {
   bool checkErrors = true;
+  std::string dist = "uniform";
+  bool observables = false;
+  bool lean = false;
+  bool memreport = false;
+  std::string progress_file;
+  bool sparse = false;
+  double density = 1;
   unsigned teamsize = 1;
 
   // Parse optional command line args
@@ -29,10 +43,69 @@ int main(int argc, char** argv)
       arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
       --i;                                              // Reset index
     }
+    if (arg[i] == "-dist") {
+      if (i+1 < arg.size()) {
+        dist = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-dist option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+    if (arg[i] == "-observables") {
+      observables = true;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+    }
+    if (arg[i] == "-lean") {
+      lean = true;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+    }
+    if (arg[i] == "-memreport") {
+      memreport = true;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+    }
+    if (arg[i] == "-progress") {
+      if (i+1 < arg.size()) {
+        progress_file = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-progress option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+    if (arg[i] == "-sparse") {
+      sparse = true;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+    }
+    if (arg[i] == "-density") {
+      if (i+1 < arg.size()) {
+        density = string_to_<double>(arg[i+1]);
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-density option requires one argument." << std::endl;
+        return 1;
+      }
+    }
   }
 
+  // The lean mode never holds all N results, so they can't be checked
+  if (lean)
+    checkErrors = false;
+
   if (arg.size() < 2) {
-    std::cerr << "Usage: " << arg[0] << " NUMPOINTS [-c TEAMSIZE] [-nocheck]" << std::endl;
+    std::cerr << "Usage: " << arg[0] << " NUMPOINTS [-c TEAMSIZE] [-nocheck] [-observables] [-lean] [-memreport] [-progress FILE] [-sparse] [-density D] [-dist DIST]" << std::endl;
+    exit(1);
+  }
+
+  if (!meta::is_distribution(dist)) {
+    std::cerr << "Unknown distribution " << dist << std::endl;
     exit(1);
   }
 
@@ -47,7 +120,7 @@ int main(int argc, char** argv)
   // Scratch status for MPI
   MPI_Status status;
 
-  typedef InvSq kernel_type;
+  typedef InvSqT<real_type> kernel_type;
   kernel_type K;
 
   // Define source_type, target_type, charge_type, result_type
@@ -55,27 +128,43 @@ int main(int argc, char** argv)
   typedef kernel_type::charge_type charge_type;
   typedef kernel_type::target_type target_type;
   typedef kernel_type::result_type result_type;
+  // Type to accumulate results in, exact with NBODY_REPRODUCIBLE
+  typedef accumulator<result_type>::type accum_type;
 
   // We are testing symmetric kernels
   static_assert(std::is_same<source_type, target_type>::value,
                 "Testing symmetric kernels, need source_type == target_type");
 
-  std::vector<source_type> source;
-  std::vector<charge_type> charge;
+  typedef mem_track::tracked_allocator<source_type> source_alloc;
+  typedef mem_track::tracked_allocator<charge_type> charge_alloc;
+  typedef mem_track::tracked_allocator<result_type> result_alloc;
+  typedef mem_track::tracked_allocator<accum_type>  accum_alloc;
+  // The circulating blocks are in packs of sources and charges, see SoA.hpp
+  typedef SoAPack<source_type, charge_type> pack_type;
+  typedef SoABuffer<pack_type, mem_track::tracked_allocator<pack_type>> soa_buffer;
+  typedef mem_track::tracked_allocator<pack_type> pack_alloc;
+
+  tracked_vector<source_type> source(source_alloc("source"));
+  tracked_vector<charge_type> charge(charge_alloc("charge"));
 
   const int seed = 1337;
 
-  if (rank == MASTER) {
+  // With -lean the team leaders generate their own blocks after the setup
+  if (rank == MASTER && !lean) {
     meta::default_generator.seed(seed);
 
     // generate source data
-    for (unsigned i = 0; i < N; ++i)
-      source.push_back(meta::random<source_type>::get());
+    meta::distribution_block<source_type>(dist, seed, 0, N, N,
+                                          std::back_inserter(source));
 
     // generate charge data
     for (unsigned i = 0; i < N; ++i)
       charge.push_back(meta::random<charge_type>::get());
+    if (density < 1)
+      mask_charges(charge.begin(), 0, N, density);
+  }
 
+  if (rank == MASTER) {
     // display metadata
     std::cout << "N = " << N << std::endl;
     std::cout << "P = " << P << std::endl;
@@ -150,11 +239,21 @@ int main(int argc, char** argv)
   /*********************/
 
   // Declare data for the block computations
-  std::vector<source_type> xJ(idiv_up(N,num_teams));
-  std::vector<charge_type> cJ(idiv_up(N,num_teams));
+  const unsigned n = idiv_up(N,num_teams);
+  tracked_vector<source_type> xJ(n, source_type(), source_alloc("xJ"));
+  tracked_vector<charge_type> cJ(n, charge_type(), charge_alloc("cJ"));
 
-  // Scatter data from master to team leaders
-  if (trank == MASTER) {
+  if (lean && trank == MASTER) {
+    // Team leaders generate their block of the sequence of the master
+    meta::default_generator.seed(seed);
+    meta::distribution_block<source_type>(dist, seed, team*n, (team+1)*n, N,
+                                          xJ.begin());
+    meta::random_block<charge_type>(team*n, (team+1)*n, N, cJ.begin());
+    if (density < 1)
+      mask_charges(cJ.begin(), team*n, n, density);
+  } else if (trank == MASTER) {
+    // Scatter data from master to team leaders
+    comm_phase("scatter");
     //splitTimer.start();
     MPI_Scatter(source.data(), sizeof(source_type) * xJ.size(), MPI_CHAR,
                 xJ.data(), sizeof(source_type) * xJ.size(), MPI_CHAR,
@@ -166,6 +265,7 @@ int main(int argc, char** argv)
   }
 
   // Team leaders broadcast to team
+  comm_phase("split");
   splitTimer.start();
   MPI_Bcast(xJ.data(), sizeof(source_type) * xJ.size(), MPI_CHAR,
             MASTER, team_comm);
@@ -174,21 +274,42 @@ int main(int argc, char** argv)
   totalSplitTime += splitTimer.elapsed();
 
   // Copy xJ -> xI
-  std::vector<source_type> xI = xJ;
+  tracked_vector<source_type> xI(xJ.begin(), xJ.end(), source_alloc("xI"));
+  // Copy cJ -> cI for the observables
+  tracked_vector<charge_type> cI(charge_alloc("cI"));
+  if (observables)
+    cI.assign(cJ.begin(), cJ.end());
   // Initialize block result rI
-  std::vector<result_type> rI(idiv_up(N,num_teams));
+  tracked_vector<accum_type> rI(n, accum_type(), accum_alloc("rI"));
+
+  // With -sparse, compact the blocks to their nonzero-charge sources unless
+  // the global density is too high for the compaction to pay off
+  bool sparse_ring = false;
+  unsigned nJ = n;          // The number of sources in xJ, cJ
+  if (sparse) {
+    unsigned total_nnz = count_nonzero(cJ.begin(), n, row_comm);
+    sparse_ring = total_nnz < sparse_threshold * N;
+    if (rank == MASTER)
+      printf("Nonzero charges: %u (%s)\n", total_nnz,
+             sparse_ring ? "sparse" : "dense fallback");
+  }
+  if (sparse_ring) {
+    compTimer.start();
+    nJ = compact_nonzero(xJ.begin(), cJ.begin(), n);
+    totalCompTime += compTimer.elapsed();
+  }
 
-  // Perform initial offset by teamrank
-  shiftTimer.start();
-  int dst = (team + trank + num_teams) % num_teams;
-  int src = (team - trank + num_teams) % num_teams;
-  MPI_Sendrecv_replace(xJ.data(), sizeof(source_type) * xJ.size(), MPI_CHAR,
-                       src, 0, dst, 0,
-                       row_comm, &status);
-  MPI_Sendrecv_replace(cJ.data(), sizeof(charge_type) * cJ.size(), MPI_CHAR,
-                       src, 0, dst, 0,
-                       row_comm, &status);
-  totalShiftTime += shiftTimer.elapsed();
+  // Pack the circulating block J once, it stays packed through all shifts
+  soa_buffer J(n, pack_alloc("J"));
+  J.assign(xJ.begin(), xJ.begin() + nJ, cJ.begin());
+  // Receive buffer for blocks of varying size
+  soa_buffer R(pack_alloc("R"));
+  if (sparse_ring)
+    R.resize(n);
+
+  // With -progress, MASTER keeps FILE updated with the progress of all ranks
+  ProgressMonitor progress(progress_file, MASTER, MPI_COMM_WORLD);
+  double interactions = 0;
 
   /**********************/
   /** ZEROTH ITERATION **/
@@ -197,19 +318,58 @@ int main(int argc, char** argv)
   int last_iter = idiv_up(P, teamsize*teamsize) - 1;
   int curr_iter = 0;   // Ranges from [0,last_iter]
 
-  if (trank == MASTER) {
-    // If this is the team leader, compute the symmetric diagonal block
+  // The team leader keeps its block after the initial offset, so it computes
+  // the symmetric diagonal block on its unpacked block
+  const bool diagonal = (trank == MASTER && !sparse_ring);
+  if (diagonal) {
     compTimer.start();
     p2p(K, xJ.begin(), xJ.end(), cJ.begin(), rI.begin());
     totalCompTime += compTimer.elapsed();
-  } else {
-    // Else, compute the off-diagonal block
+    interactions += double(n) * n;
+  }
+  tracked_vector<source_type>(source_alloc("xJ")).swap(xJ);
+  tracked_vector<charge_type>(charge_alloc("cJ")).swap(cJ);
+
+  // Send the block to @a to and receive the next from @a from
+  const MPI_Datatype pack_mpi = pack_mpi_type<pack_type>();
+  auto shift = [&](int to, int from) {
+    if (!sparse_ring) {
+      MPI_Sendrecv_replace(J.data(), J.num_packs(), pack_mpi,
+                           to, 0, from, 0,
+                           row_comm, &status);
+    } else {
+      // Only the packs of the nonzero-charge sources travel, after their
+      // number, which masks the padding lanes of the last pack
+      unsigned size = J.size(), recv_size;
+      MPI_Sendrecv(&size, 1, MPI_UNSIGNED, to, 1,
+                   &recv_size, 1, MPI_UNSIGNED, from, 1,
+                   row_comm, &status);
+      MPI_Sendrecv(J.data(), J.num_packs(), pack_mpi, to, 0,
+                   R.data(), R.capacity_packs(), pack_mpi, from, 0,
+                   row_comm, &status);
+      R.resize(recv_size);
+      J.swap(R);
+    }
+  };
+
+  // Perform initial offset by teamrank
+  comm_phase("shift");
+  shiftTimer.start();
+  int dst = (team + trank + num_teams) % num_teams;
+  int src = (team - trank + num_teams) % num_teams;
+  shift(src, dst);
+  totalShiftTime += shiftTimer.elapsed();
+
+  if (!diagonal) {
+    // Compute the off-diagonal block. A sparse diagonal block is cheaper
+    // asymmetrically from its nonzero sources.
     compTimer.start();
-    p2p(K,
-        xJ.begin(), xJ.end(), cJ.begin(),
-        xI.begin(), xI.end(), rI.begin());
+    p2p(K, J, xI.begin(), xI.end(), rI.begin());
     totalCompTime += compTimer.elapsed();
+    interactions += double(n) * J.size();
   }
+  progress.update(curr_iter, totalCompTime, totalSplitTime + totalShiftTime,
+                  interactions);
 
   /********************/
   /** ALL ITERATIONS **/
@@ -219,15 +379,11 @@ int main(int argc, char** argv)
   for (++curr_iter; curr_iter <= last_iter; ++curr_iter) {
 
     // Shift data to the next process to compute the next block
+    comm_phase("shift");
     shiftTimer.start();
     int src = (team + teamsize + num_teams) % num_teams;
     int dst = (team - teamsize + num_teams) % num_teams;
-    MPI_Sendrecv_replace(xJ.data(), sizeof(source_type) * xJ.size(), MPI_CHAR,
-                         dst, 0, src, 0,
-                         row_comm, &status);
-    MPI_Sendrecv_replace(cJ.data(), sizeof(charge_type) * cJ.size(), MPI_CHAR,
-                         dst, 0, src, 0,
-                         row_comm, &status);
+    shift(dst, src);
     totalShiftTime += shiftTimer.elapsed();
 
     // Compute on the last iteration only if
@@ -236,38 +392,51 @@ int main(int argc, char** argv)
     if (curr_iter < last_iter
         || (num_teams % teamsize == 0 || trank < num_teams % teamsize)) {
       compTimer.start();
-      p2p(K,
-          xJ.begin(), xJ.end(), cJ.begin(),
-          xI.begin(), xI.end(), rI.begin());
+      p2p(K, J, xI.begin(), xI.end(), rI.begin());
       totalCompTime += compTimer.elapsed();
+      interactions += double(n) * J.size();
     }
+    progress.update(curr_iter, totalCompTime, totalSplitTime + totalShiftTime,
+                    interactions);
   }
 
   /********************/
   /*** REDUCE STAGE ***/
   /********************/
 
-  // Allocate teamrI on team leaders
-  std::vector<result_type> teamrI;
-  if (trank == MASTER)
-    teamrI = std::vector<result_type>(idiv_up(N,num_teams));
+  // Sweep the partial results for the global observables
+  Observables obs;
+  if (observables) {
+    compTimer.start();
+    obs.sweep(xI.begin(), xI.end(), cI.begin(), rI.begin());
+    totalCompTime += compTimer.elapsed();
+  }
+
+  // Allocate teamrI on team leaders, the lean mode reduces into rI in place
+  tracked_vector<result_type> teamrI(result_alloc("teamrI"));
+  if (trank == MASTER && !lean)
+    teamrI.resize(n);
 
   // Reduce answers to the team leader
+  comm_phase("reduce");
   reduceTimer.start();
   // TODO: Generalize
-  static_assert(std::is_same<result_type, double>::value,
-                "Need result_type == double for now");
-  MPI_Reduce(rI.data(), teamrI.data(), rI.size(), MPI_DOUBLE,
-             MPI_SUM, MASTER, team_comm);
+  static_assert(std::is_floating_point<result_type>::value,
+                "Need a floating point result_type for now");
+  if (lean)
+    reduce_results(rI, MASTER, team_comm);
+  else
+    reduce_results(rI, teamrI, MASTER, team_comm);
   totalReduceTime += reduceTimer.elapsed();
 
   // Allocate result on master
-  std::vector<result_type> result;
-  if (rank == MASTER)
-    result = std::vector<result_type>(P*idiv_up(N,P));
+  tracked_vector<result_type> result(result_alloc("result"));
+  if (rank == MASTER && !lean)
+    result.resize(P*idiv_up(N,P));
 
-  // Gather team leader answers to master
-  if (trank == MASTER) {
+  // Gather team leader answers to master, the lean mode leaves them there
+  if (trank == MASTER && !lean) {
+    comm_phase("gather");
     //reduceTimer.start();
     MPI_Gather(teamrI.data(), sizeof(result_type) * teamrI.size(), MPI_CHAR,
                result.data(), sizeof(result_type) * teamrI.size(), MPI_CHAR,
@@ -286,36 +455,46 @@ int main(int argc, char** argv)
   double avgShiftTime = 0;
   double avgReduceTime = 0;
 
+  // Reduce the times and observables together
   // Could use all reduce here to get the averaged data to all the processors
-  MPI_Reduce(&totalCompTime, &avgCompTime, 1, MPI_DOUBLE,
-             MPI_SUM, MASTER, MPI_COMM_WORLD);
-  avgCompTime /= P;
-
-  MPI_Reduce(&totalSplitTime, &avgSplitTime, 1, MPI_DOUBLE,
-             MPI_SUM, MASTER, MPI_COMM_WORLD);
-  avgSplitTime /= P;
-
-  MPI_Reduce(&totalShiftTime, &avgShiftTime, 1, MPI_DOUBLE,
+  comm_phase("timing");
+  double local[] = {totalCompTime, totalSplitTime, totalShiftTime,
+                    totalReduceTime, obs.charge_sum, obs.virial};
+  double global[6];
+  MPI_Reduce(local, global, 6, MPI_DOUBLE,
              MPI_SUM, MASTER, MPI_COMM_WORLD);
-  avgShiftTime /= P;
-
-  MPI_Reduce(&totalReduceTime, &avgReduceTime, 1, MPI_DOUBLE,
-             MPI_SUM, MASTER, MPI_COMM_WORLD);
-  avgReduceTime /= P;
+  avgCompTime   = global[0] / P;
+  avgSplitTime  = global[1] / P;
+  avgShiftTime  = global[2] / P;
+  avgReduceTime = global[3] / P;
+  obs.charge_sum = global[4];
+  obs.virial     = global[5];
 
   // format output well
   if (rank == MASTER) {
     printf("Label\tComputation\tSplit\tShift\tReduce\n");
     printf("c=%d\t%e\t%e\t%e\t%e\n", teamsize, avgCompTime, avgSplitTime, avgShiftTime, avgReduceTime);
     printf("Rank 0 Total Time: %e\n", time);
+    if (!lean)
+      print_checksum(result, n);
+    if (observables)
+      print_observables(obs);
   }
 
+  // Peak memory per buffer, collective
+  if (memreport)
+    mem_track::report(MASTER, MPI_COMM_WORLD);
+
+  progress.finish();
+
   // Check the result
   if (rank == MASTER && checkErrors) {
     std::string result_filename = "data/";
-    result_filename += std::string("invsq")
+    result_filename += std::string("invsq") + precision_tag(result_type())
         + "_n" + std::to_string(N)
-        + "_s" + std::to_string(seed) + ".txt";
+        + "_s" + std::to_string(seed) + meta::distribution_tag(dist)
+        + (density < 1 ? "_d" + std::to_string(density) : std::string())
+        + ".txt";
 
     std::fstream result_file(result_filename);
 
@@ -328,6 +507,8 @@ int main(int argc, char** argv)
       assert(exact.size() == N);
 
       print_error(exact, result);
+      if (observables)
+        print_observables_error(obs, source, charge, exact);
     } else {
       std::cout << "Computing direct matvec..." << std::endl;
 
@@ -339,6 +520,8 @@ int main(int argc, char** argv)
       double directCompTime = compTimer.elapsed();
 
       print_error(exact, result);
+      if (observables)
+        print_observables_error(obs, source, charge, exact);
       std::cout << "DirectCompTime: " << directCompTime << std::endl;
 
       // Open and write
@@ -0,0 +1,389 @@
+// Shared memory Team Scatter version of the n-body algorithm
+//
+// Every process of teamscatter.cpp and symmetric.cpp becomes a thread.
+// The source blocks are never copied: a thread reads the block it would have
+// received by pointer, so the ring shift is a rotation of the block index
+// synchronized with a barrier. In the symmetric schedule the partial results
+// of the transpose block are read directly from the producing thread.
+
+#include <thread>
+
+#include "Util.hpp"
+
+#include "kernel/InvSq.kern"
+#include "meta/kernel_traits.hpp"
+#include "meta/random.hpp"
+#include "meta/distribution.hpp"
+
+#include "IndexTransformer.hpp"
+
+int main(int argc, char** argv)
+{
+  bool checkErrors = true;
+  std::string dist = "uniform";
+  bool symmetric = false;
+  unsigned teamsize = 1;
+  unsigned P = std::thread::hardware_concurrency();
+
+  // Parse optional command line args
+  std::vector<std::string> arg(argv, argv + argc);
+  for (unsigned i = 1; i < arg.size(); ++i) {
+    if (arg[i] == "-c" || arg[i] == "-p") {
+      if (i+1 < arg.size()) {
+        (arg[i] == "-c" ? teamsize : P) = string_to_<unsigned>(arg[i+1]);
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+        continue;
+      } else {
+        std::cerr << arg[i] << " option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+    if (arg[i] == "-symm") {
+      symmetric = true;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+      continue;
+    }
+    if (arg[i] == "-nocheck") {
+      checkErrors = false;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+    }
+    if (arg[i] == "-dist") {
+      if (i+1 < arg.size()) {
+        dist = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-dist option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  if (arg.size() < 2) {
+    std::cerr << "Usage: " << arg[0] << " NUMPOINTS [-p NUMTHREADS] [-c TEAMSIZE] [-symm] [-nocheck] [-dist DIST]" << std::endl;
+    exit(1);
+  }
+
+  if (!meta::is_distribution(dist)) {
+    std::cerr << "Unknown distribution " << dist << std::endl;
+    exit(1);
+  }
+
+  unsigned N = string_to_<int>(arg[1]);
+
+  typedef InvSqT<real_type> kernel_type;
+  kernel_type K;
+
+  // Define source_type, target_type, charge_type, result_type
+  typedef kernel_type::source_type source_type;
+  typedef kernel_type::charge_type charge_type;
+  typedef kernel_type::target_type target_type;
+  typedef kernel_type::result_type result_type;
+  // Type to accumulate results in, exact with NBODY_REPRODUCIBLE
+  typedef accumulator<result_type>::type accum_type;
+
+  // We are testing symmetric kernels
+  static_assert(std::is_same<source_type, target_type>::value,
+                "Testing symmetric kernels, need source_type == target_type");
+
+  if (P == 0 || P % teamsize != 0) {
+    printf("Quitting. The teamsize (c) must divide the total number of threads (p).\n");
+    exit(0);
+  }
+
+  if (teamsize * teamsize > P) {
+    printf("Quitting. The teamsize ^ 2 (c^2) must be less than or equal to the number of threads (p).\n");
+    exit(0);
+  }
+
+  if (N % P != 0) {
+    printf("Quitting. The number of threads must divide the number of points\n");
+    exit(0);
+  }
+
+  std::vector<source_type> source;
+  std::vector<charge_type> charge;
+
+  const int seed = 1337;
+
+  meta::default_generator.seed(seed);
+
+  // generate source data
+  meta::distribution_block<source_type>(dist, seed, 0, N, N,
+                                        std::back_inserter(source));
+
+  // generate charge data
+  for (unsigned i = 0; i < N; ++i)
+    charge.push_back(meta::random<charge_type>::get());
+
+  // display metadata
+  std::cout << "N = " << N << std::endl;
+  std::cout << "P = " << P << std::endl;
+  std::cout << "Teamsize = " << teamsize << std::endl;
+  std::cout << "Schedule = " << (symmetric ? "symmetric" : "teamscatter") << std::endl;
+
+
+  ////////////////////////
+  // Actual Computation //
+  ////////////////////////
+
+  const unsigned num_teams = P / teamsize;
+  const unsigned n = idiv_up(N,num_teams);
+
+  // Create transformer to help us convert between block idx and thread index
+  IndexTransformer transposer(num_teams, teamsize);
+
+  // Per-thread block results, allocated by the owning thread
+  std::vector<std::vector<accum_type> > rI(P);
+  std::vector<std::vector<accum_type> > rJ(P);
+  // The destination thread of each thread's rJ, for checking the schedule
+  std::vector<int> r_dst(P, -1);
+
+  // Per-thread times
+  std::vector<double> totalCompTime(P);
+  std::vector<double> totalShiftTime(P);
+  std::vector<double> totalSendRecvTime(P);
+  std::vector<double> totalReduceTime(P);
+
+  // The final result
+  std::vector<result_type> result(num_teams * n);
+
+  Barrier barrier(P);
+
+  auto team_scatter = [&](unsigned tid) {
+    Clock compTimer;
+    Clock shiftTimer;
+    Clock sendRecvTimer;
+    Clock reduceTimer;
+
+    const unsigned team  = tid / teamsize;
+    const unsigned trank = tid % teamsize;
+
+    // The target block of this team
+    const target_type* xI = source.data() + team * n;
+    const charge_type* cI = charge.data() + team * n;
+
+    // The source block this thread computes at iteration i
+    auto block = [&](int i) { return (team + trank + i * teamsize) % num_teams; };
+
+    // Initialize block results, first touch by the owning thread
+    rI[tid] = std::vector<accum_type>(n);
+    if (symmetric)
+      rJ[tid] = std::vector<accum_type>(n);
+
+    int last_iter = symmetric
+        ? idiv_up(num_teams + 1, 2*teamsize) - 1
+        : idiv_up(P, teamsize*teamsize) - 1;
+    int curr_iter = 0;   // Ranges from [0,last_iter]
+
+    /**********************/
+    /** ZEROTH ITERATION **/
+    /**********************/
+
+    const source_type* xJ = source.data() + block(curr_iter) * n;
+    const charge_type* cJ = charge.data() + block(curr_iter) * n;
+
+    int i_dst = -1;
+
+    if (trank == MASTER) {
+      // Team leaders compute the symmetric diagonal
+      compTimer.start();
+      p2p(K, xJ, xJ + n, cJ, rI[tid].data(), 0);
+      totalCompTime[tid] += compTimer.elapsed();
+    } else {
+      // Compute the symmetric iteration and thread
+      if (symmetric)
+        std::tie(i_dst, r_dst[tid]) = transposer(curr_iter, team, trank);
+
+      // If the block is the destination's last iteration, don't compute symm
+      if (symmetric && i_dst != last_iter) {
+        // Compute symmetric off-diagonal
+        compTimer.start();
+        p2p(K,
+            xJ, xJ + n, cJ, rJ[tid].data(),
+            xI, xI + n, cI, rI[tid].data(), 0);
+        totalCompTime[tid] += compTimer.elapsed();
+      } else {
+        // No destination for the symmetric result
+        r_dst[tid] = -1;
+
+        // Compute asymmetric off-diagonal
+        compTimer.start();
+        p2p(K,
+            xJ, xJ + n, cJ,
+            xI, xI + n, rI[tid].data(), 0);
+        totalCompTime[tid] += compTimer.elapsed();
+      }
+    }
+
+    /********************/
+    /** ALL ITERATIONS **/
+    /********************/
+
+    int iPrimeOffset = (trank == 0) ? 0 : 1;
+
+    for (++curr_iter; curr_iter <= last_iter; ++curr_iter) {
+
+      // Wait for all blocks of the last iteration
+      shiftTimer.start();
+      barrier.wait();
+      totalShiftTime[tid] += shiftTimer.elapsed();
+
+      if (symmetric) {
+        // The iteration of the block we would read
+        int i_src = num_teams/teamsize - (curr_iter-1) - iPrimeOffset;
+        // Compute the thread to read from
+        int r_src;
+        std::tie(std::ignore, r_src) = transposer(i_src, team, trank);
+
+        // Accumulate the symmetric result of the last iteration
+        sendRecvTimer.start();
+        if (i_src != last_iter && r_src != int(tid)) {
+          assert(r_dst[r_src] == int(tid));
+          const accum_type* tr = rJ[r_src].data();
+          for (auto r = rI[tid].begin(); r != rI[tid].end(); ++r, ++tr)
+            *r += *tr;
+        }
+        totalSendRecvTime[tid] += sendRecvTimer.elapsed();
+
+        // Wait until every rJ has been read before it is overwritten
+        shiftTimer.start();
+        barrier.wait();
+        totalShiftTime[tid] += shiftTimer.elapsed();
+      }
+
+      // Rotate to the next source block
+      xJ = source.data() + block(curr_iter) * n;
+      cJ = charge.data() + block(curr_iter) * n;
+
+      if (symmetric) {
+        // Compute the destination iteration and thread
+        std::tie(i_dst, r_dst[tid]) = transposer(curr_iter, team, trank);
+
+        // If the block is the destination's last iteration, don't compute symm
+        if (i_dst != last_iter) {
+          // Set rJ to zero
+          std::fill(rJ[tid].begin(), rJ[tid].end(), accum_type());
+
+          // Compute symmetric off-diagonal
+          compTimer.start();
+          p2p(K,
+              xJ, xJ + n, cJ, rJ[tid].data(),
+              xI, xI + n, cI, rI[tid].data(), 0);
+          totalCompTime[tid] += compTimer.elapsed();
+        } else {
+          // No destination for the symmetric result
+          r_dst[tid] = -1;
+
+          // Compute asymmetric off-diagonal
+          compTimer.start();
+          p2p(K,
+              xJ, xJ + n, cJ,
+              xI, xI + n, rI[tid].data(), 0);
+          totalCompTime[tid] += compTimer.elapsed();
+        }
+      } else {
+        // Compute on the last iteration only if
+        // 1) The teamsize divides the number of teams (everyone computes)
+        // 2) Your team rank is one of the remainders
+        if (curr_iter < last_iter
+            || (num_teams % teamsize == 0 || trank < num_teams % teamsize)) {
+          compTimer.start();
+          p2p(K,
+              xJ, xJ + n, cJ,
+              xI, xI + n, rI[tid].data(), 0);
+          totalCompTime[tid] += compTimer.elapsed();
+        }
+      }
+    }  //  end for iteration
+
+    /********************/
+    /*** REDUCE STAGE ***/
+    /********************/
+
+    // Wait for all team members to finish
+    shiftTimer.start();
+    barrier.wait();
+    totalShiftTime[tid] += shiftTimer.elapsed();
+
+    // Each team member reduces a slice of the team's block into the result
+    reduceTimer.start();
+    unsigned first = std::min(n, trank * idiv_up(n,teamsize));
+    unsigned last  = std::min(n, (trank+1) * idiv_up(n,teamsize));
+    result_type* r = result.data() + team * n;
+    for (unsigned i = first; i < last; ++i) {
+      accum_type sum = accum_type();
+      for (unsigned k = 0; k < teamsize; ++k)
+        sum += rI[team * teamsize + k][i];
+      r[i] = round_result(sum);
+    }
+    totalReduceTime[tid] += reduceTimer.elapsed();
+  };
+
+  Clock timer;
+  timer.start();
+
+  std::vector<std::thread> threads;
+  for (unsigned tid = 1; tid < P; ++tid)
+    threads.emplace_back(team_scatter, tid);
+  team_scatter(MASTER);
+  for (auto& thr : threads)
+    thr.join();
+
+  double time = timer.elapsed();
+
+  // Average the thread times
+  double avgCompTime     = std::accumulate(totalCompTime.begin(), totalCompTime.end(), 0.0) / P;
+  double avgSplitTime    = 0;   // No data is distributed
+  double avgShiftTime    = std::accumulate(totalShiftTime.begin(), totalShiftTime.end(), 0.0) / P;
+  double avgSendRecvTime = std::accumulate(totalSendRecvTime.begin(), totalSendRecvTime.end(), 0.0) / P;
+  double avgReduceTime   = std::accumulate(totalReduceTime.begin(), totalReduceTime.end(), 0.0) / P;
+
+  // format output well
+  printf("Label\tComputation\tSplit\tShift\tSendReceive\tReduce\n");
+  printf("C=%d\t%e\t%e\t%e\t%e\t%e\n", teamsize, avgCompTime, avgSplitTime, avgShiftTime, avgSendRecvTime, avgReduceTime);
+  printf("Thread 0 Total Time: %e\n", time);
+  print_checksum(result, n);
+
+  // Check the result
+  if (checkErrors) {
+    std::string result_filename = "data/";
+    result_filename += std::string("invsq") + precision_tag(result_type())
+        + "_n" + std::to_string(N)
+        + "_s" + std::to_string(seed) + meta::distribution_tag(dist) + ".txt";
+
+    std::fstream result_file(result_filename);
+
+    if (result_file) {
+      std::cout << "Reading result from " << result_filename << std::endl;
+
+      // Read the previously computed results
+      std::vector<result_type> exact;
+      result_file >> exact;
+      assert(exact.size() == N);
+
+      print_error(exact, result);
+    } else {
+      std::cout << "Computing direct matvec..." << std::endl;
+
+      std::vector<result_type> exact(N);
+
+      // Compute the result with a direct matrix-vector multiplication
+      Clock compTimer;
+      p2p(K, source.begin(), source.end(), charge.begin(), exact.begin());
+      double directCompTime = compTimer.elapsed();
+
+      print_error(exact, result);
+      std::cout << "DirectCompTime: " << directCompTime << std::endl;
+
+      // Open and write
+      result_file.open(result_filename, std::fstream::out);
+      result_file << exact << std::endl;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,396 @@
+// Distributed Barnes-Hut treecode with locally essential trees
+
+#include "Util.hpp"
+#include "CommProfile.hpp"
+#include "Treecode.hpp"
+
+#include "kernel/Laplace.kern"
+#include "meta/random.hpp"
+#include "meta/distribution.hpp"
+
+/** A point with its charge, Morton key and index in the distribution */
+template <typename T>
+struct Particle {
+  Vec<3,T> x;
+  T c;
+  unsigned index;
+  uint64_t key;
+};
+
+int main(int argc, char** argv)
+{
+  bool checkErrors = true;
+  std::string dist = "uniform";
+  double theta = 0.5;
+  int ncrit = 64;
+
+  // Parse optional command line args
+  std::vector<std::string> arg(argv, argv + argc);
+  for (unsigned i = 1; i < arg.size(); ++i) {
+    if (arg[i] == "-theta") {
+      if (i+1 < arg.size()) {
+        theta = string_to_<double>(arg[i+1]);
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-theta option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+    if (arg[i] == "-ncrit") {
+      if (i+1 < arg.size()) {
+        ncrit = string_to_<int>(arg[i+1]);
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-ncrit option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+    if (arg[i] == "-nocheck") {
+      checkErrors = false;
+      arg.erase(arg.begin() + i, arg.begin() + i + 1);  // Erase this arg
+      --i;                                              // Reset index
+    }
+    if (arg[i] == "-dist") {
+      if (i+1 < arg.size()) {
+        dist = arg[i+1];
+        arg.erase(arg.begin() + i, arg.begin() + i + 2);  // Erase these two
+        --i;                                              // Reset index
+      } else {
+        std::cerr << "-dist option requires one argument." << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  if (arg.size() < 2) {
+    std::cerr << "Usage: " << arg[0] << " NUMPOINTS [-theta THETA] [-ncrit NCRIT] [-nocheck] [-dist DIST]" << std::endl;
+    exit(1);
+  }
+
+  if (!meta::is_distribution(dist)) {
+    std::cerr << "Unknown distribution " << dist << std::endl;
+    exit(1);
+  }
+
+  if (!(theta > 0 && theta < 1) || ncrit < 1) {
+    std::cerr << "Need 0 < THETA < 1 and NCRIT >= 1" << std::endl;
+    exit(1);
+  }
+
+  unsigned N = string_to_<int>(arg[1]);
+
+  MPI_Init(&argc, &argv);
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  int P;
+  MPI_Comm_size(MPI_COMM_WORLD, &P);
+
+  typedef LaplacePotentialT<real_type> kernel_type;
+  kernel_type K;
+
+  typedef kernel_type::source_type source_type;
+  typedef kernel_type::charge_type charge_type;
+  typedef kernel_type::result_type result_type;
+  typedef Particle<real_type> particle_type;
+  typedef treecode::Cell<real_type> cell_type;
+
+  if (rank == MASTER) {
+    // display metadata
+    std::cout << "N = " << N << std::endl;
+    std::cout << "P = " << P << std::endl;
+    std::cout << "Theta = " << theta << std::endl;
+    std::cout << "Ncrit = " << ncrit << std::endl;
+  }
+
+  ////////////////////////
+  // Actual Computation //
+  ////////////////////////
+
+  Clock timer;
+  Clock phaseTimer;
+
+  double totalSortTime = 0;
+  double totalBuildTime = 0;
+  double totalLETTime = 0;
+  double totalEvalTime = 0;
+
+  // Every rank generates its block of the sequence of the master
+  const int seed = 1337;
+  const unsigned first = std::min(N, rank * idiv_up(N,P));
+  const unsigned last  = std::min(N, (rank+1) * idiv_up(N,P));
+  std::vector<source_type> x0;
+  std::vector<charge_type> c0;
+  meta::default_generator.seed(seed);
+  meta::distribution_block<source_type>(dist, seed, first, last, N,
+                                        std::back_inserter(x0));
+  meta::random_block<charge_type>(first, last, N, std::back_inserter(c0));
+
+  timer.start();
+
+  /**********/
+  /** SORT **/
+  /**********/
+
+  // Sort the points along the Morton curve of the global bounding cube and
+  // split the curve into P ranges of equal size by sampling
+  comm_phase("sort");
+  phaseTimer.start();
+  double box[6];
+  for (unsigned d = 0; d != 3; ++d) {
+    box[d] = box[d+3] = -std::numeric_limits<double>::max();
+    for (const source_type& p : x0) {
+      box[d]   = std::max(box[d],   -double(p[d]));
+      box[d+3] = std::max(box[d+3],  double(p[d]));
+    }
+  }
+  MPI_Allreduce(MPI_IN_PLACE, box, 6, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+  const Vec<3,double> lo(-box[0], -box[1], -box[2]);
+  double side = 0;
+  for (unsigned d = 0; d != 3; ++d)
+    side = std::max(side, box[d+3] + box[d]);
+  side *= 1 + 1e-6;
+
+  std::vector<particle_type> part(x0.size());
+  for (unsigned i = 0; i < x0.size(); ++i) {
+    part[i].x = x0[i];
+    part[i].c = c0[i];
+    part[i].index = first + i;
+    part[i].key = treecode::morton_key(x0[i], lo, side);
+  }
+  auto by_key = [](const particle_type& a, const particle_type& b) {
+    return a.key < b.key;
+  };
+  std::sort(part.begin(), part.end(), by_key);
+
+  // Regular samples of the local keys, and P-1 splitters from all of them
+  const unsigned S = 4 * P;
+  std::vector<uint64_t> sample(S, std::numeric_limits<uint64_t>::max());
+  for (unsigned k = 0; k < S && !part.empty(); ++k)
+    sample[k] = part[(std::size_t) part.size() * k / S].key;
+  std::vector<uint64_t> all_samples(S * P);
+  MPI_Allgather(sample.data(), S, MPI_UINT64_T,
+                all_samples.data(), S, MPI_UINT64_T, MPI_COMM_WORLD);
+  std::sort(all_samples.begin(), all_samples.end());
+  std::vector<uint64_t> splitter(P-1);
+  for (int k = 1; k < P; ++k)
+    splitter[k-1] = all_samples[(std::size_t) S * k];
+
+  // Send every particle to the rank of its key range
+  std::vector<int> send_count(P, 0), send_disp(P, 0);
+  std::vector<int> recv_count(P, 0), recv_disp(P, 0);
+  for (int k = 0, i = 0; k < P; ++k) {
+    int j = k+1 < P
+        ? std::lower_bound(part.begin() + i, part.end(), splitter[k],
+                           [](const particle_type& a, uint64_t z) { return a.key < z; })
+          - part.begin()
+        : int(part.size());
+    send_count[k] = (j - i) * sizeof(particle_type);
+    send_disp[k] = i * sizeof(particle_type);
+    i = j;
+  }
+  MPI_Alltoall(send_count.data(), 1, MPI_INT,
+               recv_count.data(), 1, MPI_INT, MPI_COMM_WORLD);
+  for (int k = 1; k < P; ++k)
+    recv_disp[k] = recv_disp[k-1] + recv_count[k-1];
+  std::vector<particle_type> mine((recv_disp[P-1] + recv_count[P-1])
+                                  / sizeof(particle_type));
+  MPI_Alltoallv(part.data(), send_count.data(), send_disp.data(), MPI_BYTE,
+                mine.data(), recv_count.data(), recv_disp.data(), MPI_BYTE,
+                MPI_COMM_WORLD);
+  std::sort(mine.begin(), mine.end(), by_key);
+  part.clear();
+
+  const int n = mine.size();
+  std::vector<source_type> x(n);
+  std::vector<charge_type> c(n);
+  std::vector<uint64_t> key(n);
+  for (int i = 0; i < n; ++i) {
+    x[i] = mine[i].x;
+    c[i] = mine[i].c;
+    key[i] = mine[i].key;
+  }
+  totalSortTime += phaseTimer.elapsed();
+
+  /***********/
+  /** BUILD **/
+  /***********/
+
+  phaseTimer.start();
+  const std::vector<cell_type> tree =
+      treecode::build(x.data(), c.data(), key.data(), n, lo, side, ncrit);
+  totalBuildTime += phaseTimer.elapsed();
+
+  /******************/
+  /** LET EXCHANGE **/
+  /******************/
+
+  // The bounding boxes of the domains
+  comm_phase("let");
+  phaseTimer.start();
+  source_type dlo, dhi;
+  treecode::bounding_box(x.data(), x.data() + n, dlo, dhi);
+  std::vector<source_type> domain(2*P);
+  source_type my_box[] = {dlo, dhi};
+  MPI_Allgather(my_box, 2 * sizeof(source_type), MPI_BYTE,
+                domain.data(), 2 * sizeof(source_type), MPI_BYTE, MPI_COMM_WORLD);
+
+  // The LET of the local tree for every other domain, by destination
+  std::vector<cell_type> let_cells;
+  std::vector<source_type> let_x;
+  std::vector<charge_type> let_c;
+  std::vector<int> cell_count(P, 0), cell_disp(P, 0);
+  std::vector<int> point_count(P, 0), point_disp(P, 0);
+  for (int k = 0; k < P; ++k) {
+    cell_disp[k] = let_cells.size();
+    point_disp[k] = let_x.size();
+    if (k != rank && domain[2*k][0] <= domain[2*k+1][0]) {
+      // Cells of the LET index its points from the start of its block
+      std::vector<source_type> lx;
+      std::vector<charge_type> lc;
+      std::vector<cell_type> lcell;
+      treecode::extract_let(tree, x.data(), c.data(),
+                            domain[2*k], domain[2*k+1], theta, lcell, lx, lc);
+      let_cells.insert(let_cells.end(), lcell.begin(), lcell.end());
+      let_x.insert(let_x.end(), lx.begin(), lx.end());
+      let_c.insert(let_c.end(), lc.begin(), lc.end());
+    }
+    cell_count[k] = let_cells.size() - cell_disp[k];
+    point_count[k] = let_x.size() - point_disp[k];
+  }
+
+  // Exchange the sizes, then the cells, points and charges
+  std::vector<int> counts(2*P), recv_counts(2*P);
+  for (int k = 0; k < P; ++k) {
+    counts[2*k] = cell_count[k];
+    counts[2*k+1] = point_count[k];
+  }
+  MPI_Alltoall(counts.data(), 2, MPI_INT, recv_counts.data(), 2, MPI_INT,
+               MPI_COMM_WORLD);
+  std::vector<int> rcell_count(P), rcell_disp(P, 0);
+  std::vector<int> rpoint_count(P), rpoint_disp(P, 0);
+  for (int k = 0; k < P; ++k) {
+    rcell_count[k] = recv_counts[2*k];
+    rpoint_count[k] = recv_counts[2*k+1];
+    if (k > 0) {
+      rcell_disp[k] = rcell_disp[k-1] + rcell_count[k-1];
+      rpoint_disp[k] = rpoint_disp[k-1] + rpoint_count[k-1];
+    }
+  }
+  std::vector<cell_type> rcells(rcell_disp[P-1] + rcell_count[P-1]);
+  std::vector<source_type> rx(rpoint_disp[P-1] + rpoint_count[P-1]);
+  std::vector<charge_type> rc(rx.size());
+
+  MPI_Datatype cell_mpi = bytes_mpi_type<cell_type>();
+  MPI_Datatype point_mpi = bytes_mpi_type<source_type>();
+  MPI_Alltoallv(let_cells.data(), cell_count.data(), cell_disp.data(), cell_mpi,
+                rcells.data(), rcell_count.data(), rcell_disp.data(), cell_mpi,
+                MPI_COMM_WORLD);
+  MPI_Alltoallv(let_x.data(), point_count.data(), point_disp.data(), point_mpi,
+                rx.data(), rpoint_count.data(), rpoint_disp.data(), point_mpi,
+                MPI_COMM_WORLD);
+  MPI_Alltoallv(let_c.data(), point_count.data(), point_disp.data(),
+                mpi_type<charge_type>::value(),
+                rc.data(), rpoint_count.data(), rpoint_disp.data(),
+                mpi_type<charge_type>::value(),
+                MPI_COMM_WORLD);
+  totalLETTime += phaseTimer.elapsed();
+
+  /**************/
+  /** EVALUATE **/
+  /**************/
+
+  // Every leaf of the local tree is a group of targets, evaluated against
+  // the local tree and the LETs of all other domains
+  phaseTimer.start();
+  std::vector<int> leaves;
+  for (unsigned k = 0; k < tree.size(); ++k)
+    if (tree[k].is_leaf())
+      leaves.push_back(k);
+
+  std::vector<result_type> r(n, result_type(0));
+  const unsigned workers = detail::num_workers(n, P2P_NUM_THREADS);
+  detail::run_workers(workers, [&](unsigned w) {
+      for (unsigned l = w; l < leaves.size(); l += workers) {
+        const cell_type& L = tree[leaves[l]];
+        const int nt = L.last - L.first;
+        source_type tlo, thi;
+        treecode::bounding_box(&x[L.first], &x[L.first] + nt, tlo, thi);
+        treecode::evaluate(K, tree.data(), x.data(), c.data(),
+                           &x[L.first], nt, tlo, thi, &r[L.first], theta);
+        for (int k = 0; k < P; ++k)
+          if (rcell_count[k] > 0)
+            treecode::evaluate(K, &rcells[rcell_disp[k]],
+                               &rx[rpoint_disp[k]], &rc[rpoint_disp[k]],
+                               &x[L.first], nt, tlo, thi, &r[L.first], theta);
+      }
+    });
+  totalEvalTime += phaseTimer.elapsed();
+
+  double time = timer.elapsed();
+
+  // Collect times and LET sizes to MASTER
+  comm_phase("timing");
+  double local[] = {totalSortTime, totalBuildTime, totalLETTime, totalEvalTime,
+                    double(rcells.size()), double(rx.size())};
+  double global[6];
+  MPI_Reduce(local, global, 6, MPI_DOUBLE, MPI_SUM, MASTER, MPI_COMM_WORLD);
+
+  // format output well
+  if (rank == MASTER) {
+    printf("Label\tSort\tBuild\tLET\tEvaluate\n");
+    printf("P=%d\t%e\t%e\t%e\t%e\n", P, global[0] / P, global[1] / P,
+           global[2] / P, global[3] / P);
+    printf("Rank 0 Total Time: %e\n", time);
+    printf("LET cells/rank: %e\tLET points/rank: %e\n",
+           global[4] / P, global[5] / P);
+  }
+
+  // Gather the results in the order of the distribution to MASTER
+  comm_phase("gather");
+  std::vector<int> all_n(P), all_disp(P, 0);
+  MPI_Gather(&n, 1, MPI_INT, all_n.data(), 1, MPI_INT, MASTER, MPI_COMM_WORLD);
+  for (int k = 1; k < P; ++k)
+    all_disp[k] = all_disp[k-1] + all_n[k-1];
+  std::vector<unsigned> index(n);
+  for (int i = 0; i < n; ++i)
+    index[i] = mine[i].index;
+  std::vector<unsigned> all_index(rank == MASTER ? N : 0);
+  std::vector<result_type> all_r(rank == MASTER ? N : 0);
+  MPI_Gatherv(index.data(), n, MPI_UNSIGNED,
+              all_index.data(), all_n.data(), all_disp.data(), MPI_UNSIGNED,
+              MASTER, MPI_COMM_WORLD);
+  MPI_Gatherv(r.data(), n, mpi_type<result_type>::value(),
+              all_r.data(), all_n.data(), all_disp.data(),
+              mpi_type<result_type>::value(), MASTER, MPI_COMM_WORLD);
+
+  // Check the result against the direct sum
+  if (rank == MASTER && checkErrors) {
+    std::vector<result_type> result(N);
+    for (unsigned i = 0; i < N; ++i)
+      result[all_index[i]] = all_r[i];
+
+    std::vector<source_type> source;
+    std::vector<charge_type> charge;
+    meta::default_generator.seed(seed);
+    meta::distribution_block<source_type>(dist, seed, 0, N, N,
+                                          std::back_inserter(source));
+    for (unsigned i = 0; i < N; ++i)
+      charge.push_back(meta::random<charge_type>::get());
+
+    std::cout << "Computing direct matvec..." << std::endl;
+
+    std::vector<result_type> exact(N);
+
+    Clock compTimer;
+    p2p(K, source.begin(), source.end(), charge.begin(), exact.begin());
+    double directCompTime = compTimer.elapsed();
+
+    print_error(exact, result);
+    std::cout << "DirectCompTime: " << directCompTime << std::endl;
+  }
+
+  MPI_Finalize();
+  return 0;
+}